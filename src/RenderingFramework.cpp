@@ -8,6 +8,10 @@
 #include "camera_model.hpp"
 #include "intersection.hpp"
 #include "light_model.hpp"
+#include "benchmark.hpp"
+#include "session.hpp"
+#include "regression.hpp"
+#include <shellapi.h>
 
 
 HINSTANCE hInst;                               
@@ -17,9 +21,18 @@ ATOM                MyRegisterClass(HINSTANCE hInstance);
 BOOL                InitInstance(HINSTANCE, int);
 LRESULT CALLBACK    WndProc(HWND, UINT, WPARAM, LPARAM);
 INT_PTR CALLBACK    About(HWND, UINT, WPARAM, LPARAM);
+bool                RunHeadless(int argc, LPWSTR* argv);
+void                HandleEvent(HWND hWnd, SessionEvent event);
+string              WideToString(LPWSTR argument);
+string              StartTraceFromCommandLine();
+
+//the trace starts before main_model is built, so the loading of the default scene is recorded
+string trace_filename = StartTraceFromCommandLine();
 
 //Ray Tracing definition
 RayTracing main_model;
+SessionRecorder session_recorder; //records the input events of the window if --record is given
+int headless_exit_code = 0; //1 if a headless check failed
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                      _In_opt_ HINSTANCE hPrevInstance,
@@ -29,6 +42,20 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     UNREFERENCED_PARAMETER(hPrevInstance);
     UNREFERENCED_PARAMETER(lpCmdLine);
 
+    //the headless modes run without the window
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    bool headless = RunHeadless(argc, argv);
+    LocalFree(argv);
+    if (headless)
+    {
+        //the default scene could not be read and no other scene was given
+        if (!main_model.scene_loaded)
+        {
+            headless_exit_code = 1;
+        }
+        return headless_exit_code;
+    }
 
 
 
@@ -40,6 +67,11 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
     {
         return FALSE;
     }
+    if (!main_model.scene_loaded)
+    {
+        MessageBoxW(NULL, L"Cannot load the scene " TEXT(DEFAULT_SCENE) L", the scene is empty.", szTitle,
+            MB_OK | MB_ICONWARNING);
+    }
 
 
 
@@ -62,6 +94,233 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
 
 
 
+/*
+Switch a wide command line argument to string
+Args:
+    argument [LPWSTR]: [the wide string]
+Returns:
+    result [string]: [the switched string]
+*/
+string WideToString(LPWSTR argument)
+{
+    int length = WideCharToMultiByte(CP_ACP, 0, argument, -1, NULL, 0, NULL, NULL);
+    string result(length, 0);
+    WideCharToMultiByte(CP_ACP, 0, argument, -1, &result[0], length, NULL, NULL);
+    result.resize(length - 1);
+    return result;
+}
+
+/*
+Start the trace if --trace is given in the command line, called before the model is built
+Returns:
+    trace_filename [string]: [the full filename of the trace, empty if not given]
+*/
+string StartTraceFromCommandLine()
+{
+    int argc = 0;
+    LPWSTR* argv = CommandLineToArgvW(GetCommandLineW(), &argc);
+    string filename = "";
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (WideToString(argv[i]) == "--trace")
+        {
+            filename = WideToString(argv[i + 1]);
+            StartTrace();
+            break;
+        }
+    }
+    LocalFree(argv);
+    return filename;
+}
+
+/*
+Run the headless modes given in the command line, the options are run in order
+    --memory [file]: write the current and peak memory of each object and of the scene when the options are done
+    --trace [file]: record the timing spans from the start, the default scene included, and write them as a Chrome trace
+        when the options are done
+    --scene [file]: load another scene description file, also used by the window
+    --paged [cache MB]: keep the leaf faces in a page file read through a bounded cache, 64 MB by default
+    --sink [name] [frames | tiles]: publish the frames, and the finished tiles in the tiles mode, to a shared memory ring
+        read by the viewers in other processes, see tools/frame_dump.cpp, also used by the window
+    --save [file]: render a frame and save it in the background, .png, .ppm, .exr and the other opencv formats
+    --costs [file]: render a frame and save it with false color maps of the traversal, triangle tests, secondary rays and time of each pixel
+    --poster [file] [size] [rgb32f | rgb16f | rgba8]: stream a picture of any size to a tiled .tif, rgb16f by default
+    --path [file] [prefix]: render a camera path with temporal reuse, save the frames if a prefix is given, and write sequence.txt
+    --turntable [frames] [degrees] [prefix]: the same with a turntable around the current camera
+    --counters [file]: append the ray and traversal counters of each frame as one line of JSON, only with ENABLE_RENDER_COUNTERS defined
+    --record [file]: record the input events of the window to a session file
+    --replay [file] [report]: replay a session file, render after each event and write the latency percentiles, replay.txt by default
+    --benchmark [report]: render with every pixel order and write the benchmark report
+    --regress [suite] [report]: render the cases of a regression suite, compare them with the golden pictures and the baselines,
+        write regression.txt by default and exit with 1 if a case failed
+    --regress-update [suite] [report]: render the cases and write their golden pictures and baselines
+Args:
+    argc [int]: [the number of arguments, including the program name]
+    argv [LPWSTR*]: [the arguments]
+Returns:
+    headless [bool]: [whether a headless mode is run or not]
+*/
+bool RunHeadless(int argc, LPWSTR* argv)
+{
+    bool headless = 0;
+    string memory_filename = "";
+    for (int i = 1; i < argc; i++)
+    {
+        string argument = WideToString(argv[i]);
+        if (argument == "--trace" && i + 1 < argc)
+        {
+            //started by StartTraceFromCommandLine
+            i++;
+        }
+        else if (argument == "--memory" && i + 1 < argc)
+        {
+            memory_filename = WideToString(argv[++i]);
+        }
+        else if (argument == "--scene" && i + 1 < argc)
+        {
+            string scene_file = WideToString(argv[++i]);
+            if (!main_model.LoadScene(scene_file))
+            {
+                cerr << "--scene: cannot load " << scene_file << ", the previous scene is kept" << endl;
+                headless_exit_code = 1;
+            }
+        }
+        else if (argument == "--paged")
+        {
+            size_t cache_bytes = PAGE_CACHE_BYTES;
+            if (i + 1 < argc && WideToString(argv[i + 1]).rfind("--", 0) != 0)
+            {
+                cache_bytes = size_t(atof(WideToString(argv[++i]).c_str()) * (1 << 20));
+            }
+            main_model.EnablePaging("pages.bin", cache_bytes);
+        }
+        else if (argument == "--sink" && i + 1 < argc)
+        {
+            string name = WideToString(argv[++i]);
+            int mode = SINK_FRAMES;
+            if (i + 1 < argc && WideToString(argv[i + 1]).rfind("--", 0) != 0)
+            {
+                mode = WideToString(argv[++i]) == "tiles" ? SINK_TILES : SINK_FRAMES;
+            }
+            main_model.frame_sink.Open(name, main_model.picture_size, main_model.picture_size, mode);
+        }
+        else if (argument == "--save" && i + 1 < argc)
+        {
+            main_model.Main();
+            main_model.SaveFrame(WideToString(argv[++i]));
+            headless = 1;
+        }
+        else if (argument == "--costs" && i + 1 < argc)
+        {
+            main_model.RenderCostMaps(WideToString(argv[++i]));
+            headless = 1;
+        }
+        else if (argument == "--poster" && i + 2 < argc)
+        {
+            string filename = WideToString(argv[++i]);
+            int size = atoi(WideToString(argv[++i]).c_str());
+            if (i + 1 < argc && WideToString(argv[i + 1]).rfind("--", 0) != 0)
+            {
+                string format = WideToString(argv[++i]);
+                main_model.stream_format = format == "rgb32f" ? FRAMEBUFFER_RGB32F : (format == "rgba8" ? FRAMEBUFFER_RGBA8 : FRAMEBUFFER_RGB16F);
+            }
+            main_model.RenderToFile(filename, size);
+            headless = 1;
+        }
+        else if ((argument == "--path" && i + 1 < argc) || (argument == "--turntable" && i + 2 < argc))
+        {
+            CameraPath path;
+            if (argument == "--path")
+            {
+                string path_file = WideToString(argv[++i]);
+                if (!path.Read(path_file))
+                {
+                    cerr << "--path: cannot read the camera path " << path_file << ", a bad line or no key, the options after it are not run"
+                        << endl;
+                    headless_exit_code = 1;
+                    headless = 1;
+                    break;
+                }
+            }
+            else
+            {
+                int frame_num = atoi(WideToString(argv[++i]).c_str());
+                double degrees = atof(WideToString(argv[++i]).c_str());
+                path = CameraPath(main_model.camera, frame_num, degrees);
+            }
+            string prefix = "";
+            if (i + 1 < argc && WideToString(argv[i + 1]).rfind("--", 0) != 0)
+            {
+                prefix = WideToString(argv[++i]);
+            }
+            main_model.RenderCameraPath(path, prefix, 1);
+            WriteSequenceReport(main_model, "sequence.txt");
+            headless = 1;
+        }
+        else if (argument == "--counters" && i + 1 < argc)
+        {
+            string counter_filename = WideToString(argv[++i]);
+#ifdef ENABLE_RENDER_COUNTERS
+            main_model.counter_file.open(counter_filename, ios::out);
+#else
+            cerr << "--counters: the render counters are not built in, define ENABLE_RENDER_COUNTERS, " << counter_filename
+                << " is not written" << endl;
+#endif
+        }
+        else if (argument == "--record" && i + 1 < argc)
+        {
+            session_recorder.Open(WideToString(argv[++i]));
+        }
+        else if (argument == "--replay" && i + 1 < argc)
+        {
+            vector<SessionEvent> events;
+            ReadSession(WideToString(argv[++i]), events);
+            string report = "replay.txt";
+            if (i + 1 < argc && WideToString(argv[i + 1]).rfind("--", 0) != 0)
+            {
+                report = WideToString(argv[++i]);
+            }
+            ReplaySession(main_model, events, report);
+            headless = 1;
+        }
+        else if ((argument == "--regress" || argument == "--regress-update") && i + 1 < argc)
+        {
+            string suite = WideToString(argv[++i]);
+            string report = "regression.txt";
+            if (i + 1 < argc && WideToString(argv[i + 1]).rfind("--", 0) != 0)
+            {
+                report = WideToString(argv[++i]);
+            }
+            if (!RunRegression(main_model, suite, report, argument == "--regress-update"))
+            {
+                headless_exit_code = 1;
+            }
+            headless = 1;
+        }
+        else if (argument == "--benchmark")
+        {
+            string report = "benchmark.txt";
+            if (i + 1 < argc)
+            {
+                report = WideToString(argv[++i]);
+            }
+            RunBenchmark(main_model, report, 3);
+            headless = 1;
+        }
+    }
+    main_model.picture_writer.Wait();
+    if (memory_filename.size() > 0)
+    {
+        WriteMemoryReport(main_model, memory_filename);
+    }
+    if (trace_filename.size() > 0)
+    {
+        WriteTrace(trace_filename);
+    }
+    return headless;
+}
+
+
 ATOM MyRegisterClass(HINSTANCE hInstance)
 {
     WNDCLASSEXW wcex;
@@ -88,7 +347,7 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
 {
    hInst = hInstance; 
    HWND hWnd = CreateWindowW(szWindowClass, szTitle, WS_OVERLAPPEDWINDOW,
-       CW_USEDEFAULT, 0, main_model.camera.width + 15, main_model.camera.height + 58, nullptr, nullptr, hInstance, nullptr);
+       CW_USEDEFAULT, 0, main_model.picture_size + 15, main_model.picture_size + 58, nullptr, nullptr, hInstance, nullptr);
 
    if (!hWnd)
    {
@@ -101,6 +360,25 @@ BOOL InitInstance(HINSTANCE hInstance, int nCmdShow)
 }
 
 
+/*
+Record an input event of the window if recording, apply it and repaint if the picture changes,
+the mouse moves without a button down change nothing and are not recorded
+Args:
+    hWnd [HWND]: [the window]
+    event [SessionEvent]: [the event]
+*/
+void HandleEvent(HWND hWnd, SessionEvent event)
+{
+    if (event.type != EVENT_MOUSE_MOVE || main_model.camera.mouse_down)
+    {
+        session_recorder.Record(event);
+    }
+    if (ApplySessionEvent(main_model, event))
+    {
+        InvalidateRect(hWnd, NULL, TRUE);
+    }
+}
+
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
     switch (message)
@@ -121,89 +399,39 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
             }
         }
         break;
-    case WM_LBUTTONDOWN: {
-        HDC hdc = GetDC(hWnd);
-        int x = LOWORD(lParam);
-        int y = HIWORD(lParam);
-        main_model.camera.MouseDown(x, y);
-        ReleaseDC(hWnd, hdc);
-        break;
-    }
+    case WM_LBUTTONDOWN:
     case WM_RBUTTONDOWN: {
-        HDC hdc = GetDC(hWnd);
-        int x = LOWORD(lParam);
-        int y = HIWORD(lParam);
-        main_model.camera.MouseDown(x, y);
-        ReleaseDC(hWnd, hdc);
-        break;
-    }
-    case WM_LBUTTONUP: {
-        main_model.camera.MouseUp();
-        InvalidateRect(hWnd, NULL, true);
+        HandleEvent(hWnd, SessionEvent(EVENT_MOUSE_DOWN, LOWORD(lParam), HIWORD(lParam)));
         break;
     }
+    case WM_LBUTTONUP:
     case WM_RBUTTONUP: {
-        main_model.camera.MouseUp();
-        InvalidateRect(hWnd, NULL, true);
+        HandleEvent(hWnd, SessionEvent(EVENT_MOUSE_UP, 0, 0));
         break;
     }
     case WM_MOUSEMOVE: {
-        HDC hdc = GetDC(hWnd);
-        int x = LOWORD(lParam);
-        int y = HIWORD(lParam);
-        main_model.camera.MouseMove(x, y);
-        ReleaseDC(hWnd, hdc);
+        HandleEvent(hWnd, SessionEvent(EVENT_MOUSE_MOVE, LOWORD(lParam), HIWORD(lParam)));
         break;
     }
     case WM_MOUSEWHEEL: {
-        HDC hdc = GetDC(hWnd);
-        main_model.camera.MouseWheel((short)HIWORD(wParam));
-        InvalidateRect(hWnd, NULL, TRUE);
-        ReleaseDC(hWnd, hdc);
+        HandleEvent(hWnd, SessionEvent(EVENT_MOUSE_WHEEL, (short)HIWORD(wParam), 0));
         break;
     }
     case WM_KEYUP: {
-        HDC hdc = GetDC(hWnd);
-        Vector3d move_direction_camera;
-        move_direction_camera << 0, 0, 0;
-        bool flush = 0;
-        switch (wParam)
-        {
-            case VK_LEFT: {
-                move_direction_camera << -1, 0, 0;
-                flush = 1;
-                break;
-            }
-            case VK_RIGHT: {
-                move_direction_camera << 1, 0, 0;
-                flush = 1;
-                break;
-            }
-            case VK_UP: {
-                move_direction_camera << 0, 0, 1;
-                flush = 1;
-                break;
-            }
-            case VK_DOWN: {
-                move_direction_camera << 0, 0, -1;
-                flush = 1;
-                break;
-            }
-        }
-        if (flush)
-        {
-            main_model.camera.KeyUp(move_direction_camera);
-            InvalidateRect(hWnd, NULL, TRUE);
-        }
-        ReleaseDC(hWnd, hdc);
+        HandleEvent(hWnd, SessionEvent(EVENT_KEY_UP, int(wParam), 0));
         break;
     }
     case WM_PAINT:{
         PAINTSTRUCT ps;
         HDC hdc = BeginPaint(hWnd, &ps);
         main_model.Main();
-        ShowPicture(main_model.results, main_model.camera.width, main_model.camera.height, hdc);
+        ShowPicture(main_model.results, main_model.picture_size, main_model.picture_size, hdc);
         EndPaint(hWnd, &ps);
+        WCHAR title[MAX_LOADSTRING * 2];
+        swprintf_s(title, MAX_LOADSTRING * 2, L"%s - %dx%d, %.3fs, %.0f%% traced, %.2f spp, %lld rays, %lld pruned", szTitle,
+            main_model.render_size, main_model.render_size, main_model.frame_time, main_model.traced_fraction * 100,
+            main_model.samples_per_pixel, main_model.traced_rays, main_model.pruned_rays);
+        SetWindowTextW(hWnd, title);
         break;
     }
     case WM_DESTROY:
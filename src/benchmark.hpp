@@ -0,0 +1,345 @@
+//the benchmark harness, measuring the frame time and the cache behaviour of the pixel orders, and the shadow map accuracy
+#pragma once
+#include "utils.hpp"
+#include "light_model.hpp"
+#include "pixel_order.hpp"
+using namespace std;
+using namespace Eigen;
+
+//a set associative LRU cache model, used in measuring the hit rate of a memory access sequence
+class CacheSimulator
+{
+public:
+	int line_size = 64;
+	int set_num = 0;
+	int ways = 0;
+	vector<vector<size_t>> sets; //the tags of each set, the most recently used first
+	long long hits = 0;
+	long long misses = 0;
+
+	CacheSimulator() {}
+
+	/*
+	Init the cache model
+	Args:
+		cache_size [int]: [the size of the cache in bytes]
+		line_size [int]: [the size of a cache line in bytes]
+		ways [int]: [the associativity of the cache]
+	*/
+	CacheSimulator(int cache_size, int line_size, int ways)
+	{
+		this->line_size = line_size;
+		this->ways = ways;
+		this->set_num = cache_size / line_size / ways;
+		this->sets.resize(this->set_num);
+	}
+
+	/*
+	Access a memory range, each touched cache line is counted once
+	Args:
+		address [const void*]: [the start of the memory range]
+		size [int]: [the size of the memory range in bytes]
+	*/
+	void Access(const void* address, int size)
+	{
+		size_t first_line = size_t(address) / this->line_size;
+		size_t last_line = (size_t(address) + size - 1) / this->line_size;
+		for (size_t line = first_line; line <= last_line; line++)
+		{
+			vector<size_t>& set = this->sets[line % this->set_num];
+			auto it = find(set.begin(), set.end(), line);
+			if (it != set.end())
+			{
+				this->hits++;
+				set.erase(it);
+			}
+			else
+			{
+				this->misses++;
+				if (set.size() >= this->ways)
+				{
+					set.pop_back();
+				}
+			}
+			set.insert(set.begin(), line);
+		}
+	}
+
+	/*
+	Get the hit rate of all the accesses
+	Returns:
+		rate [double]: [the hit rate, between[0, 1]]
+	*/
+	double HitRate()
+	{
+		long long total = this->hits + this->misses;
+		if (total == 0)
+		{
+			return 0;
+		}
+		return double(this->hits) / double(total);
+	}
+};
+
+/*
+Simulate the scene data and framebuffer accesses of one pixel order, 
+the scene data access of a pixel is its first hit face, the pixel samples must be recorded before
+Args:
+	model [RayTracing]: [the ray tracing model]
+	order [int]: [the pixel order, ORDER_ROW, ORDER_MORTON, ORDER_HILBERT, or -1 for the legacy column order]
+	scene_cache [CacheSimulator]: [the cache model of the scene data]
+	framebuffer_cache [CacheSimulator]: [the cache model of the framebuffer]
+*/
+void SimulatePixelOrder(RayTracing& model, int order, CacheSimulator& scene_cache, CacheSimulator& framebuffer_cache)
+{
+	int width = model.camera.width;
+	int height = model.camera.height;
+	int tile_size = model.tile_size;
+	int face_size = sizeof(TriangleMesh);
+	int pixel_size = sizeof(Vector3d);
+	vector<Vector3d> tile_buffer(tile_size * tile_size);
+
+	//touch the first hit face of a pixel
+	auto access_scene = [&](int i, int j)
+	{
+		PixelSample& sample = model.pixel_samples[j * width + i];
+		//the paged faces have no resident address to simulate
+		if (sample.object_id >= 0 && model.objects[sample.object_id].pager == NULL)
+		{
+			scene_cache.Access(&model.objects[sample.object_id].faces[sample.face_id], face_size);
+		}
+	};
+
+	if (order == ORDER_ROW || order < 0)
+	{
+		int outer = order < 0 ? width : height;
+		int inner = order < 0 ? height : width;
+		for (int a = 0; a < outer; a++)
+		{
+			for (int b = 0; b < inner; b++)
+			{
+				int i = order < 0 ? a : b;
+				int j = order < 0 ? b : a;
+				access_scene(i, j);
+				framebuffer_cache.Access(&model.results[j * width + i], pixel_size);
+			}
+		}
+		return;
+	}
+
+	int tiles_x = (width + tile_size - 1) / tile_size;
+	vector<int> tiles = BuildTileOrder(width, height, tile_size, order);
+	for (int k = 0; k < tiles.size(); k++)
+	{
+		int x0 = (tiles[k] % tiles_x) * tile_size;
+		int y0 = (tiles[k] / tiles_x) * tile_size;
+		int x1 = min(x0 + tile_size, width);
+		int y1 = min(y0 + tile_size, height);
+		for (int j = y0; j < y1; j++)
+		{
+			for (int i = x0; i < x1; i++)
+			{
+				access_scene(i, j);
+				framebuffer_cache.Access(&tile_buffer[(j - y0) * tile_size + i - x0], pixel_size);
+			}
+		}
+		for (int j = y0; j < y1; j++)
+		{
+			framebuffer_cache.Access(&tile_buffer[(j - y0) * tile_size], pixel_size * (x1 - x0));
+			framebuffer_cache.Access(&model.results[j * width + x0], pixel_size * (x1 - x0));
+		}
+	}
+}
+
+/*
+Write the time and the reuse of each frame of the last camera path
+Args:
+	model [RayTracing]: [the ray tracing model, after RenderCameraPath]
+	filename [string]: [the full filename of the report]
+*/
+void WriteSequenceReport(RayTracing& model, string filename)
+{
+	ofstream report;
+	report.open(filename, ios::out);
+	report << "frame, frame time (s), reused fraction, traced rays" << endl;
+	double total_time = 0;
+	double total_reused = 0;
+	int frame_num = model.sequence_stats.size();
+	for (int f = 0; f < frame_num; f++)
+	{
+		SequenceFrameStats& stats = model.sequence_stats[f];
+		report << f << ", " << stats.frame_time << ", " << stats.reused_fraction << ", " << stats.traced_rays << endl;
+		total_time += stats.frame_time;
+		total_reused += stats.reused_fraction;
+	}
+	if (frame_num > 0)
+	{
+		report << frame_num << " frames, " << total_time << " s, mean frame time " << total_time / frame_num
+			<< " s, mean reused fraction " << total_reused / frame_num << endl;
+	}
+	report.close();
+}
+
+/*
+Write the memory of each object and of the whole scene, the current and the peak bytes of each category
+Args:
+	model [RayTracing]: [the ray tracing model]
+	report [ofstream]: [the opened report]
+*/
+void ReportMemoryUsage(RayTracing& model, ofstream& report)
+{
+	model.UpdateMemoryUsage();
+	for (int i = 0; i < model.objects.size(); i++)
+	{
+		string name = i < model.load_stats.size() ? model.load_stats[i].filename : to_string(i);
+		report << "memory of " << name << ", " << model.objects[i].memory.ToString() << endl;
+	}
+	report << "memory of the scene, " << model.memory.ToString() << endl;
+}
+
+/*
+Write the memory report of the model
+Args:
+	model [RayTracing]: [the ray tracing model]
+	filename [string]: [the full filename of the report]
+*/
+void WriteMemoryReport(RayTracing& model, string filename)
+{
+	ofstream report;
+	report.open(filename, ios::out);
+	ReportMemoryUsage(model, report);
+	report.close();
+}
+
+/*
+Benchmark all the pixel orders, write the frame time and the simulated cache hit rates to a report,
+with the shadow map accuracy, the startup time and the memory of each object
+Args:
+	model [RayTracing]: [the ray tracing model]
+	filename [string]: [the full filename of the report]
+	repeat [int]: [the number of frames rendered for each order, the fastest one is reported]
+*/
+void RunBenchmark(RayTracing& model, string filename, int repeat)
+{
+	ofstream report;
+	report.open(filename, ios::out);
+	int old_order = model.pixel_order;
+
+	//record the first hits once, they do not depend on the order, the lighting caches are built before the first trace
+	model.PrepareFrame();
+	model.camera.SetPictureSize(model.picture_size);
+	model.TraceAllPixels(model.results, 1);
+
+	const int order_num = 4;
+	int orders[order_num] = { -1, ORDER_ROW, ORDER_MORTON, ORDER_HILBERT };
+	string names[order_num] = { "column (legacy)", "row", "morton tiles", "hilbert tiles" };
+	report << "picture " << model.picture_size << "x" << model.picture_size << ", tile " << model.tile_size << endl;
+	report << "order, frame time (s), scene hit rate, framebuffer hit rate" << endl;
+	for (int k = 0; k < order_num; k++)
+	{
+		CacheSimulator scene_cache(32 * 1024, 64, 8);
+		CacheSimulator framebuffer_cache(32 * 1024, 64, 8);
+		SimulatePixelOrder(model, orders[k], scene_cache, framebuffer_cache);
+
+		//the legacy order is only simulated
+		double best_time = -1;
+		if (orders[k] >= 0)
+		{
+			model.pixel_order = orders[k];
+			for (int r = 0; r < repeat; r++)
+			{
+				model.Main();
+				if (best_time < 0 || model.frame_time < best_time)
+				{
+					best_time = model.frame_time;
+				}
+			}
+		}
+		report << names[k] << ", " << best_time << ", " << scene_cache.HitRate() << ", " << framebuffer_cache.HitRate() << endl;
+	}
+	model.pixel_order = old_order;
+
+	//the last frame is saved next to the report, only the conversion blocks the renderer
+	double convert_time = model.picture_writer.convert_time;
+	double encode_time = model.picture_writer.encode_time;
+	model.SaveFrame(filename + ".png");
+	model.picture_writer.Wait();
+	report << "save picture, convert " << model.picture_writer.convert_time - convert_time << " s, encode "
+		<< model.picture_writer.encode_time - encode_time << " s in background" << endl;
+
+	//the same frame streamed to a tiled file, only the pending tiles are held
+	int size = model.picture_size;
+	model.RenderToFile(filename + ".tif", size);
+	report << "stream " << size << "x" << size << ", " << model.stream_time << " s, peak tile memory " 
+		<< double(model.stream_peak_memory) / 1e6 << " MB, full framebuffer " << double(size) * size * sizeof(Vector3d) / 1e6 << " MB" << endl;
+
+	//a short turntable traced fully and with temporal reuse, the reused frames are compared with the traced ones
+	Camera old_camera = model.camera;
+	CameraPath turntable(model.camera, 8, 16);
+	int total_size = model.picture_size * model.picture_size;
+	vector<Vector3d> traced_frame;
+	double sequence_time[2] = { 0, 0 };
+	double mean_reused = 0;
+	double reuse_error = 0;
+	for (int k = 0; k < 2; k++)
+	{
+		model.RenderCameraPath(turntable, "", k);
+		for (int f = 0; f < model.sequence_stats.size(); f++)
+		{
+			sequence_time[k] += model.sequence_stats[f].frame_time;
+			mean_reused += k ? model.sequence_stats[f].reused_fraction / model.sequence_stats.size() : 0;
+		}
+		if (k == 0)
+		{
+			traced_frame.assign(model.results, model.results + total_size);
+			continue;
+		}
+		for (int p = 0; p < total_size; p++)
+		{
+			reuse_error += (model.results[p] - traced_frame[p]).cwiseAbs().mean() / total_size;
+		}
+	}
+	model.camera = old_camera;
+	report << "turntable " << turntable.GetFrameNum() << " frames, traced " << sequence_time[0] << " s, reprojected "
+		<< sequence_time[1] << " s, mean reused fraction " << mean_reused << ", last frame mean error " << reuse_error << endl;
+
+	//the accuracy of the shadow map against the traced shadows
+	double mean_error = 0;
+	double mismatch_rate = 0;
+	model.MeasureShadowMapError(4, mean_error, mismatch_rate);
+	report << "shadow map " << model.shadow_map.resolution << "x" << model.shadow_map.resolution 
+		<< ", mean error " << mean_error << ", mismatch rate " << mismatch_rate << endl;
+
+	//the startup of the scene, the objects are loaded concurrently
+	report << "scene loaded in " << model.scene_load_time << " s" << endl;
+	for (int i = 0; i < model.load_stats.size(); i++)
+	{
+		MeshLoadStats& stats = model.load_stats[i];
+		report << "load " << stats.filename << ", " << stats.faces << " faces, " << stats.bytes << " bytes, " 
+			<< stats.threads << " threads, parse " << stats.parse_time << " s (" << stats.Throughput() << " MB/s), preprocess "
+			<< stats.preprocess_time << " s, read "
+			<< stats.total_time << " s, build " << stats.build_time << " s, ready at " << stats.ready_time << " s, peak memory "
+			<< double(stats.peak_memory) / 1e6 << " MB" << endl;
+	}
+
+	//the out of core geometry, the same frame with and without the ray reordering, both starting from an empty cache
+	if (model.paging)
+	{
+		GeometryPager& pager = model.pager;
+		report << "paging, " << pager.pages.size() << " pages, page file " << double(pager.file_size) / 1e6 
+			<< " MB, cache " << double(pager.cache_bytes) / 1e6 << " MB" << endl;
+		bool old_reordering = model.ray_reordering;
+		for (int k = 0; k < 2; k++)
+		{
+			model.ray_reordering = k;
+			pager.Flush();
+			model.Main();
+			report << (k ? "reordered" : "unordered") << " rays, " << model.frame_time << " s, hit rate " << pager.HitRate() 
+				<< ", " << pager.misses << " misses, " << pager.evictions << " evictions, read " << double(pager.bytes_read) / 1e6 
+				<< " MB, peak resident " << double(pager.peak_bytes) / 1e6 << " MB" << endl;
+		}
+		model.ray_reordering = old_reordering;
+	}
+	ReportMemoryUsage(model, report);
+	report.close();
+}
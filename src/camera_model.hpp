@@ -17,8 +17,22 @@ public:
 	double intensity = 1.0;
 	int type = TYPE_INIT;
 	int last_object_id = -1; //the id to not judge
+	double width = 0; //the width of the ray cone at the start, used in estimating the texture footprint
+	double spread = 0; //the increase of the width of the ray cone per unit length
 	Ray() {}
 
+	/*
+	Get the width of the ray cone after traveling
+	Args:
+		t [double]: [the t of the ray to be traveled]
+	Returns:
+		width [double]: [the width of the ray cone]
+	*/
+	double GetWidth(double t)
+	{
+		return this->width + this->spread * t;
+	}
+
 	/*
 	Init a ray
 	Args:
@@ -86,12 +100,7 @@ public:
 	Camera(int size, double r, double theta, double phi)
 	{
 		//load intrinsics
-		this->width = size;
-		this->height = size;
-		this->cx = size * 0.5;
-		this->cy = size * 0.5;
-		this->fx = size * 0.5;
-		this->fy = size * 0.5;
+		this->SetPictureSize(size);
 
 		//load extrinsics
 		this->r = r;
@@ -103,6 +112,21 @@ public:
 
 	}
 
+	/*
+	Reset the intrinsics according to the picture size, the field of view is not changed
+	Args:
+		size [int]: [the size of the picture, which equals to width and height]
+	*/
+	void SetPictureSize(int size)
+	{
+		this->width = size;
+		this->height = size;
+		this->cx = size * 0.5;
+		this->cy = size * 0.5;
+		this->fx = size * 0.5;
+		this->fy = size * 0.5;
+	}
+
 	/*
 	Reset the camera place and rotation matrix according to r, theta, phi
 	*/
@@ -220,27 +244,163 @@ public:
 	}
 };
 
+//a key of a camera path, the place of the camera on its unit sphere and its translation
+class CameraKey
+{
+public:
+	double r = 0;
+	double theta = 0;
+	double phi = 0;
+	Vector3d translation = Vector3d::Zero();
+};
+
+/*
+A camera path for turntables and fly-throughs, the frames are interpolated linearly between the keys,
+the path file gives one item on each line, for example
+	frames 30
+	key 14.142 135 0 0 0 0
+	key 14.142 135 90 0 0 0
+the key gives r, theta and phi in degrees and the translation, frames gives the number of frames from each key to the next,
+the lines starting with # are comments
+*/
+class CameraPath
+{
+public:
+	vector<CameraKey> keys;
+	int frames_per_key = 30;
+
+	CameraPath() {}
+
+	/*
+	Build a turntable around the current place of the camera
+	Args:
+		camera [Camera]: [the camera at the first frame]
+		frame_num [int]: [the number of frames, at least 1]
+		degrees [double]: [the turned phi over the whole path, in degrees, the last frame stops one step before it]
+	*/
+	CameraPath(Camera& camera, int frame_num, double degrees)
+	{
+		CameraKey key;
+		key.r = camera.r;
+		key.theta = camera.theta;
+		key.phi = camera.phi;
+		key.translation = camera.translation;
+		this->keys.push_back(key);
+		//a single frame is the first key alone
+		frame_num = max(frame_num, 1);
+		if (frame_num > 1)
+		{
+			key.phi += degrees / 180.0 * PI * (frame_num - 1) / frame_num;
+			this->keys.push_back(key);
+		}
+		this->frames_per_key = max(frame_num - 1, 1);
+	}
+
+	/*
+	Read a camera path file
+	Args:
+		filename [string]: [the full filename]
+	Returns:
+		result [bool]: [whether the file is read with at least one key and no bad line or not]
+	*/
+	bool Read(string filename)
+	{
+		ifstream path_file;
+		path_file.open(filename, ios::in);
+		if (!path_file.is_open())
+		{
+			return 0;
+		}
+		string line;
+		while (getline(path_file, line))
+		{
+			istringstream words(line);
+			string head;
+			if (!(words >> head) || head[0] == '#')
+			{
+				continue;
+			}
+			if (head == "frames")
+			{
+				if (!(words >> this->frames_per_key))
+				{
+					return 0;
+				}
+				this->frames_per_key = max(this->frames_per_key, 1);
+			}
+			else if (head == "key")
+			{
+				CameraKey key;
+				if (!(words >> key.r >> key.theta >> key.phi >> key.translation(0) >> key.translation(1) >> key.translation(2)))
+				{
+					return 0;
+				}
+				key.theta = key.theta / 180.0 * PI;
+				key.phi = key.phi / 180.0 * PI;
+				this->keys.push_back(key);
+			}
+		}
+		path_file.close();
+		return this->keys.size() > 0;
+	}
+
+	/*
+	Get the number of frames of the path
+	Returns:
+		frame_num [int]: [the number of frames, the first and the last are on the keys]
+	*/
+	int GetFrameNum()
+	{
+		if (this->keys.size() == 0)
+		{
+			return 0;
+		}
+		return (int(this->keys.size()) - 1) * this->frames_per_key + 1;
+	}
+
+	/*
+	Place the camera at a frame of the path
+	Args:
+		camera [Camera]: [the camera to be placed]
+		frame [int]: [the frame id]
+	*/
+	void Apply(Camera& camera, int frame)
+	{
+		int key_id = min(frame / this->frames_per_key, int(this->keys.size()) - 1);
+		int next_id = min(key_id + 1, int(this->keys.size()) - 1);
+		double rate = key_id == next_id ? 0 : double(frame - key_id * this->frames_per_key) / this->frames_per_key;
+		CameraKey& key = this->keys[key_id];
+		CameraKey& next = this->keys[next_id];
+		camera.r = key.r * (1 - rate) + next.r * rate;
+		camera.theta = key.theta * (1 - rate) + next.theta * rate;
+		camera.phi = key.phi * (1 - rate) + next.phi * rate;
+		camera.translation = key.translation * (1 - rate) + next.translation * rate;
+		camera.ResetCameraPlace();
+	}
+};
+
 /*
 Get the ray of a pixel at (u, v) in ray tracing
 Args:
 	camera [Camera]: [the camera model]
-	u [int]: [the u of the pixel]
-	v [int]: [the v of the pixel]
+	u [double]: [the u of the pixel, can be a sub-pixel position]
+	v [double]: [the v of the pixel, can be a sub-pixel position]
 Returns:
 	new_ray [Ray]: [the ray of the pixel in ray tracing]
 */
-Ray GetPixelRay(Camera& camera, int u, int v)
+Ray GetPixelRay(Camera& camera, double u, double v)
 {
 	Vector3d start;
 	start = camera.camera_position;
 
-	double x = (double(u) - camera.cx) / camera.fx;
-	double y = (double(v) - camera.cy) / camera.fy;
+	double x = (u - camera.cx) / camera.fx;
+	double y = (v - camera.cy) / camera.fy;
 	double z = 1;
 	Vector3d direction;
 	direction << x, y, z;
 	direction = direction / direction.norm();
 	direction = camera.rotation * direction;
 	Ray new_ray = Ray(start, direction, 1.0, TYPE_INIT, -1);
+	new_ray.spread = 1.0 / camera.fx; //the cone covers one pixel
 	return new_ray;
 }
@@ -0,0 +1,205 @@
+//the layout of the shared memory ring of frames, shared by the renderer and the viewers, only the standard library is used
+#pragma once
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace std;
+#define FRAME_RING_MAGIC 0x53465452u //"RTFS"
+#define FRAME_RING_VERSION 1
+#define FRAME_KIND_FRAME 0 //a whole frame
+#define FRAME_KIND_TILE 1 //a finished tile of the frame being traced
+#define FRAME_RING_ALIGN 64 //the headers and the pixels of each slot start on a cache line
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "the ring needs lock free 64 bit atomics");
+
+//the header at the start of the shared memory
+struct FrameRingHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int slot_num;
+	unsigned int slot_bytes; //the max pixel bytes of a slot
+	unsigned int max_width;
+	unsigned int max_height;
+	atomic<unsigned long long> write_sequence; //the sequence of the last published slot, 0 if nothing
+};
+
+/*
+The header of a slot, the pixels follow after FRAME_RING_ALIGN bytes, packed BGRA8 row by row,
+the sequence is a seqlock, odd while the slot is written, so a reader checks it before and after reading the pixels in place
+*/
+struct FrameSlotHeader
+{
+	atomic<unsigned long long> sequence; //2 * the published sequence, + 1 while being written
+	unsigned int kind; //FRAME_KIND_FRAME or FRAME_KIND_TILE
+	unsigned int width; //the width of the pixels in the slot
+	unsigned int height;
+	unsigned int x; //the place of a tile in its frame, 0 for a frame
+	unsigned int y;
+	unsigned int frame_width;
+	unsigned int frame_height;
+	unsigned int bytes; //the bytes of the pixels
+	unsigned long long frame_id;
+	double render_time; //the time of tracing the frame or the tile, in seconds
+	long long timestamp; //the steady clock of the publishing, in nanoseconds
+};
+
+/*
+Get the steady clock shared by all the processes of the machine
+Returns:
+	time [long long]: [nanoseconds]
+*/
+inline long long GetFrameRingClock()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+//the placement of the header and the slots in the shared memory
+inline size_t GetFrameSlotStride(size_t slot_bytes)
+{
+	return FRAME_RING_ALIGN + (slot_bytes + FRAME_RING_ALIGN - 1) / FRAME_RING_ALIGN * FRAME_RING_ALIGN;
+}
+
+inline size_t GetFrameRingBytes(size_t slot_num, size_t slot_bytes)
+{
+	return FRAME_RING_ALIGN + slot_num * GetFrameSlotStride(slot_bytes);
+}
+
+inline FrameSlotHeader* GetFrameSlot(unsigned char* memory, size_t slot_bytes, size_t slot_id)
+{
+	return (FrameSlotHeader*)(memory + FRAME_RING_ALIGN + slot_id * GetFrameSlotStride(slot_bytes));
+}
+
+inline unsigned char* GetFrameSlotPixels(FrameSlotHeader* slot)
+{
+	return (unsigned char*)slot + FRAME_RING_ALIGN;
+}
+
+//a named shared memory region, created by the renderer and opened by the viewers
+class SharedMemory
+{
+public:
+	string name;
+	unsigned char* memory = NULL;
+	size_t bytes = 0;
+	bool owner = 0; //the creator removes the name when closing
+#ifdef _WIN32
+	HANDLE mapping = NULL;
+#endif
+
+	SharedMemory() {}
+	SharedMemory(const SharedMemory&) = delete;
+	SharedMemory& operator=(const SharedMemory&) = delete;
+	~SharedMemory()
+	{
+		this->Close();
+	}
+
+	/*
+	Create or open a named region
+	Args:
+		name [string]: [the name without the platform prefix]
+		bytes [size_t]: [the size of the region, 0 to open an existing region with its size]
+	Returns:
+		result [bool]: [whether the region is mapped or not]
+	*/
+	bool Open(string name, size_t bytes)
+	{
+		this->Close();
+		this->owner = bytes > 0;
+#ifdef _WIN32
+		string full_name = "Local\\" + name;
+		if (this->owner)
+		{
+			this->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, DWORD(bytes >> 32), DWORD(bytes & 0xffffffffu),
+				full_name.c_str());
+		}
+		else
+		{
+			this->mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, full_name.c_str());
+		}
+		if (this->mapping == NULL)
+		{
+			return 0;
+		}
+		this->memory = (unsigned char*)MapViewOfFile(this->mapping, FILE_MAP_ALL_ACCESS, 0, 0, bytes);
+		if (this->memory == NULL)
+		{
+			this->Close();
+			return 0;
+		}
+		if (bytes == 0)
+		{
+			MEMORY_BASIC_INFORMATION info;
+			VirtualQuery(this->memory, &info, sizeof(info));
+			bytes = info.RegionSize;
+		}
+#else
+		string full_name = "/" + name;
+		int file = this->owner ? shm_open(full_name.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600) : shm_open(full_name.c_str(), O_RDWR, 0);
+		if (file < 0)
+		{
+			return 0;
+		}
+		struct stat file_stat;
+		if ((this->owner && ftruncate(file, off_t(bytes)) != 0) || fstat(file, &file_stat) != 0)
+		{
+			close(file);
+			return 0;
+		}
+		bytes = size_t(file_stat.st_size);
+		void* address = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		close(file);
+		if (address == MAP_FAILED)
+		{
+			if (this->owner)
+			{
+				shm_unlink(full_name.c_str());
+			}
+			return 0;
+		}
+		this->memory = (unsigned char*)address;
+#endif
+		this->name = name;
+		this->bytes = bytes;
+		return 1;
+	}
+
+	/*
+	Unmap the region, the creator also removes its name
+	*/
+	void Close()
+	{
+#ifdef _WIN32
+		if (this->memory != NULL)
+		{
+			UnmapViewOfFile(this->memory);
+		}
+		if (this->mapping != NULL)
+		{
+			CloseHandle(this->mapping);
+		}
+		this->mapping = NULL;
+#else
+		if (this->memory != NULL)
+		{
+			munmap(this->memory, this->bytes);
+			if (this->owner)
+			{
+				shm_unlink(("/" + this->name).c_str());
+			}
+		}
+#endif
+		this->memory = NULL;
+		this->bytes = 0;
+	}
+};
@@ -0,0 +1,169 @@
+//the frames and the finished tiles published to a shared memory ring, so a viewer in another process can show them
+#pragma once
+#include "utils.hpp"
+#include "frame_ring.hpp"
+using namespace std;
+using namespace Eigen;
+#define FRAME_SINK_SLOTS 4 //the slots of the ring, a viewer lagging more frames than this skips the overwritten ones
+#define SINK_FRAMES 0 //publish each finished frame
+#define SINK_TILES 1 //also publish each tile as it is traced, then the finished frame
+
+class FrameSink
+{
+public:
+	SharedMemory shared;
+	FrameRingHeader* header = NULL;
+	int mode = SINK_FRAMES;
+	unsigned long long sequence = 0; //the sequence of the last published slot
+	unsigned long long frame_id = 0; //the id of the frame being traced, the tiles carry it too
+	long long published = 0; //the number of published slots
+	long long dropped = 0; //the number of frames or tiles larger than a slot
+	double publish_time = 0; //the time of packing and publishing, in seconds
+
+	FrameSink() {}
+
+	/*
+	Create the ring, a ring of the same name is replaced
+	Args:
+		name [string]: [the name of the shared memory]
+		max_width [int]: [the max width of the published frames]
+		max_height [int]: [the max height of the published frames]
+		mode [int]: [SINK_FRAMES or SINK_TILES]
+	Returns:
+		result [bool]: [whether the ring is created or not]
+	*/
+	bool Open(string name, int max_width, int max_height, int mode)
+	{
+		size_t slot_bytes = size_t(max_width) * max_height * 4;
+		if (!this->shared.Open(name, GetFrameRingBytes(FRAME_SINK_SLOTS, slot_bytes)))
+		{
+			this->header = NULL;
+			return 0;
+		}
+		memset(this->shared.memory, 0, this->shared.bytes);
+		this->header = new (this->shared.memory) FrameRingHeader();
+		this->header->version = FRAME_RING_VERSION;
+		this->header->slot_num = FRAME_SINK_SLOTS;
+		this->header->slot_bytes = (unsigned int)slot_bytes;
+		this->header->max_width = max_width;
+		this->header->max_height = max_height;
+		for (int i = 0; i < FRAME_SINK_SLOTS; i++)
+		{
+			new (GetFrameSlot(this->shared.memory, slot_bytes, i)) FrameSlotHeader();
+		}
+		this->mode = mode;
+		this->sequence = 0;
+		//the magic is written last, so a viewer never sees a ring being set up
+		atomic_thread_fence(memory_order_release);
+		this->header->magic = FRAME_RING_MAGIC;
+		return 1;
+	}
+
+	/*
+	Remove the ring, the viewers keep their mappings until they close them
+	*/
+	void Close()
+	{
+		this->shared.Close();
+		this->header = NULL;
+	}
+
+	bool IsOpen()
+	{
+		return this->header != NULL;
+	}
+
+	/*
+	Pack a block of pixels into the next slot and publish it,
+	the slot sequence is odd while the pixels are written, so the readers can detect a torn slot
+	Args:
+		data [array of Vector3d]: [the first pixel of the block]
+		stride [int]: [the pixels between two rows of the data]
+		kind [int]: [FRAME_KIND_FRAME or FRAME_KIND_TILE]
+		x [int]: [the column of the block in the frame]
+		y [int]: [the row of the block in the frame]
+		width [int]: [the width of the block]
+		height [int]: [the height of the block]
+		frame_width [int]: [the width of the frame]
+		frame_height [int]: [the height of the frame]
+		render_time [double]: [the time of tracing the block, in seconds]
+	*/
+	void Publish(Vector3d* data, int stride, int kind, int x, int y, int width, int height, int frame_width, int frame_height,
+		double render_time)
+	{
+		auto start_time = chrono::steady_clock::now();
+		size_t bytes = size_t(width) * height * 4;
+		if (bytes > this->header->slot_bytes)
+		{
+			this->dropped++;
+			return;
+		}
+		unsigned long long sequence = this->sequence + 1;
+		FrameSlotHeader* slot = GetFrameSlot(this->shared.memory, this->header->slot_bytes, sequence % this->header->slot_num);
+		slot->sequence.store(sequence * 2 + 1, memory_order_relaxed);
+		atomic_thread_fence(memory_order_release);
+
+		unsigned char* pixels = GetFrameSlotPixels(slot);
+		for (int j = 0; j < height; j++)
+		{
+			QuantizePicture(data + size_t(j) * stride, width, pixels + size_t(j) * width * 4, PIXEL_BGRA8);
+		}
+		slot->kind = kind;
+		slot->width = width;
+		slot->height = height;
+		slot->x = x;
+		slot->y = y;
+		slot->frame_width = frame_width;
+		slot->frame_height = frame_height;
+		slot->bytes = (unsigned int)bytes;
+		slot->frame_id = this->frame_id;
+		slot->render_time = render_time;
+		slot->timestamp = GetFrameRingClock();
+
+		slot->sequence.store(sequence * 2, memory_order_release);
+		this->header->write_sequence.store(sequence, memory_order_release);
+		this->sequence = sequence;
+		this->published++;
+		this->publish_time += chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+	}
+
+	/*
+	Publish a finished tile of the frame being traced, only in the tiles mode
+	Args:
+		data [array of Vector3d]: [the tile data]
+		stride [int]: [the pixels between two rows of the tile data]
+		x0 [int]: [the first column of the tile]
+		y0 [int]: [the first row of the tile]
+		x1 [int]: [the column after the tile]
+		y1 [int]: [the row after the tile]
+		frame_width [int]: [the width of the frame]
+		frame_height [int]: [the height of the frame]
+		render_time [double]: [the time of tracing the tile, in seconds]
+	*/
+	void PublishTile(Vector3d* data, int stride, int x0, int y0, int x1, int y1, int frame_width, int frame_height, double render_time)
+	{
+		if (this->header == NULL || this->mode != SINK_TILES)
+		{
+			return;
+		}
+		this->Publish(data, stride, FRAME_KIND_TILE, x0, y0, x1 - x0, y1 - y0, frame_width, frame_height, render_time);
+	}
+
+	/*
+	Publish a finished frame, the next tiles belong to the next frame
+	Args:
+		data [array of Vector3d], [H * W]: [the frame data]
+		width [int]: [the width of the frame]
+		height [int]: [the height of the frame]
+		render_time [double]: [the time of the frame, in seconds]
+	*/
+	void PublishFrame(Vector3d* data, int width, int height, double render_time)
+	{
+		if (this->header == NULL)
+		{
+			return;
+		}
+		this->Publish(data, width, FRAME_KIND_FRAME, 0, 0, width, height, width, height, render_time);
+		this->frame_id++;
+	}
+};
@@ -0,0 +1,417 @@
+//the compact framebuffer formats and the streaming of finished tiles to a tiled image file
+#pragma once
+#include "utils.hpp"
+#include "thread_pool.hpp"
+using namespace std;
+using namespace Eigen;
+#define FRAMEBUFFER_RGB32F 0 //3 floats, 12 bytes per pixel
+#define FRAMEBUFFER_RGB16F 1 //3 half floats, 6 bytes per pixel
+#define FRAMEBUFFER_RGBA8 2 //4 bytes per pixel, clamped to [0, 1)
+#define STREAM_MAX_PENDING_TILES 64 //the max tiles waiting to be written, the tracing waits beyond it
+
+/*
+Convert a float to a half float, rounded to the nearest even, the values too large become infinity
+Args:
+	value [float]: [the float]
+Returns:
+	half [unsigned short]: [the bits of the half float]
+*/
+unsigned short FloatToHalf(float value)
+{
+	unsigned int bits;
+	memcpy(&bits, &value, 4);
+	unsigned int sign = (bits >> 16) & 0x8000u;
+	unsigned int exponent = (bits >> 23) & 0xffu;
+	unsigned int mantissa = bits & 0x7fffffu;
+	if (exponent == 0xffu)
+	{
+		//infinity or nan
+		return (unsigned short)(sign | 0x7c00u | (mantissa != 0 ? 0x200u : 0));
+	}
+	int half_exponent = int(exponent) - 127 + 15;
+	if (half_exponent >= 31)
+	{
+		return (unsigned short)(sign | 0x7c00u);
+	}
+	if (half_exponent <= 0)
+	{
+		//denormal half, the hidden bit is shifted into the mantissa
+		if (half_exponent < -10)
+		{
+			return (unsigned short)sign;
+		}
+		mantissa |= 0x800000u;
+		int shift = 14 - half_exponent;
+		unsigned int result = mantissa >> shift;
+		unsigned int rest = mantissa & ((1u << shift) - 1);
+		unsigned int halfway = 1u << (shift - 1);
+		if (rest > halfway || (rest == halfway && (result & 1u)))
+		{
+			result++;
+		}
+		return (unsigned short)(sign | result);
+	}
+	unsigned int result = (unsigned int)(half_exponent << 10) | (mantissa >> 13);
+	unsigned int rest = mantissa & 0x1fffu;
+	if (rest > 0x1000u || (rest == 0x1000u && (result & 1u)))
+	{
+		//the carry may reach the exponent, which is still the right rounding
+		result++;
+	}
+	return (unsigned short)(sign | result);
+}
+
+/*
+Convert a half float to a float
+Args:
+	half [unsigned short]: [the bits of the half float]
+Returns:
+	value [float]: [the float]
+*/
+float HalfToFloat(unsigned short half)
+{
+	unsigned int sign = (unsigned int)(half & 0x8000u) << 16;
+	unsigned int exponent = (half >> 10) & 0x1fu;
+	unsigned int mantissa = half & 0x3ffu;
+	unsigned int bits;
+	if (exponent == 0x1fu)
+	{
+		bits = sign | 0x7f800000u | (mantissa << 13);
+	}
+	else if (exponent != 0)
+	{
+		bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+	else if (mantissa == 0)
+	{
+		bits = sign;
+	}
+	else
+	{
+		//normalize the denormal half
+		int shift = 0;
+		while ((mantissa & 0x400u) == 0)
+		{
+			mantissa <<= 1;
+			shift++;
+		}
+		bits = sign | ((unsigned int)(127 - 15 + 1 - shift) << 23) | ((mantissa & 0x3ffu) << 13);
+	}
+	float value;
+	memcpy(&value, &bits, 4);
+	return value;
+}
+
+//the pixels of a picture packed in one of the framebuffer formats, row by row
+class Framebuffer
+{
+public:
+	int width = 0;
+	int height = 0;
+	int format = FRAMEBUFFER_RGB32F;
+	vector<unsigned char> data;
+
+	Framebuffer() {}
+
+	/*
+	Init a black framebuffer
+	Args:
+		width [int]: [the width of the picture]
+		height [int]: [the height of the picture]
+		format [int]: [FRAMEBUFFER_RGB32F, FRAMEBUFFER_RGB16F or FRAMEBUFFER_RGBA8]
+	*/
+	Framebuffer(int width, int height, int format)
+	{
+		this->width = width;
+		this->height = height;
+		this->format = format;
+		this->data.assign(size_t(width) * height * this->GetPixelBytes(), 0);
+	}
+
+	int GetSampleNum()
+	{
+		return this->format == FRAMEBUFFER_RGBA8 ? 4 : 3;
+	}
+
+	int GetSampleBits()
+	{
+		return this->format == FRAMEBUFFER_RGB32F ? 32 : (this->format == FRAMEBUFFER_RGB16F ? 16 : 8);
+	}
+
+	int GetPixelBytes()
+	{
+		return this->GetSampleNum() * this->GetSampleBits() / 8;
+	}
+
+	size_t GetMemory()
+	{
+		return this->data.capacity();
+	}
+
+	/*
+	Store the colors of a run of pixels in one row
+	Args:
+		x [int]: [the column of the first pixel]
+		y [int]: [the row of the pixels]
+		colors [array of Vector3d], [count]: [the RGB colors]
+		count [int]: [the number of pixels]
+	*/
+	void StoreRow(int x, int y, Vector3d* colors, int count)
+	{
+		unsigned char* pixel = &this->data[(size_t(y) * this->width + x) * this->GetPixelBytes()];
+		if (this->format == FRAMEBUFFER_RGBA8)
+		{
+			QuantizePicture(colors, count, pixel, PIXEL_RGBA8);
+		}
+		else if (this->format == FRAMEBUFFER_RGB16F)
+		{
+			unsigned short* samples = (unsigned short*)pixel;
+			for (int i = 0; i < count * 3; i++)
+			{
+				samples[i] = FloatToHalf(float(colors[i / 3](i % 3)));
+			}
+		}
+		else
+		{
+			Map<Matrix<float, Dynamic, 1>> samples((float*)pixel, count * 3);
+			samples = Map<Matrix<double, Dynamic, 1>>(colors[0].data(), count * 3).cast<float>();
+		}
+	}
+
+	/*
+	Get the color of a pixel
+	Args:
+		x [int]: [the column of the pixel]
+		y [int]: [the row of the pixel]
+	Returns:
+		color [Vector3d]: [the RGB color]
+	*/
+	Vector3d Load(int x, int y)
+	{
+		unsigned char* pixel = &this->data[(size_t(y) * this->width + x) * this->GetPixelBytes()];
+		Vector3d color;
+		for (int k = 0; k < 3; k++)
+		{
+			if (this->format == FRAMEBUFFER_RGBA8)
+			{
+				color(k) = pixel[k] / 255.0;
+			}
+			else if (this->format == FRAMEBUFFER_RGB16F)
+			{
+				color(k) = HalfToFloat(((unsigned short*)pixel)[k]);
+			}
+			else
+			{
+				color(k) = ((float*)pixel)[k];
+			}
+		}
+		return color;
+	}
+};
+
+/*
+Write the finished tiles of a picture to an uncompressed tiled TIFF file, the place of every tile is known when the file is created,
+so the tiles are written in any order by a background thread and only the pending tiles are held in memory,
+the RGBA8 pictures are 8 bit integers with an unassociated alpha, the others are 32 or 16 bit floats
+*/
+class TiledImageWriter
+{
+public:
+	FILE* file = NULL;
+	int width = 0;
+	int height = 0;
+	int tile_size = 16; //a multiple of 16 as required by TIFF
+	int format = FRAMEBUFFER_RGB32F;
+	int tiles_x = 0;
+	int tiles_y = 0;
+	size_t tile_bytes = 0;
+	long long data_offset = 0; //the place of the first tile in the file
+
+	mutex lock;
+	condition_variable tile_done; //notified when a tile is written
+	int pending = 0; //the number of tiles submitted but not written
+	int max_pending = 0; //the most tiles held at once
+	int tiles_written = 0;
+	long long bytes_written = 0;
+	bool failed = 0;
+	ThreadPool pool = ThreadPool(1); //declared last, so the worker stops before the members it uses
+
+	TiledImageWriter() {}
+
+	TiledImageWriter(const TiledImageWriter&) = delete;
+	TiledImageWriter& operator=(const TiledImageWriter&) = delete;
+
+	~TiledImageWriter()
+	{
+		this->Close();
+	}
+
+	/*
+	Create the file and write the header, the tile table and the format, the tiles are filled later
+	Args:
+		filename [string]: [the full filename, .tif]
+		width [int]: [the width of the picture]
+		height [int]: [the height of the picture]
+		tile_size [int]: [the size of the tiles, rounded up to a multiple of 16]
+		format [int]: [the framebuffer format of the tiles]
+	Returns:
+		result [bool]: [whether the file is created or not, the classic TIFF is limited to 4 GB]
+	*/
+	bool Open(string filename, int width, int height, int tile_size, int format)
+	{
+		this->Close();
+		this->width = width;
+		this->height = height;
+		this->tile_size = (tile_size + 15) / 16 * 16;
+		this->format = format;
+		this->tiles_x = (width + this->tile_size - 1) / this->tile_size;
+		this->tiles_y = (height + this->tile_size - 1) / this->tile_size;
+		Framebuffer sample(0, 0, format);
+		int sample_num = sample.GetSampleNum();
+		int sample_bits = sample.GetSampleBits();
+		this->tile_bytes = size_t(this->tile_size) * this->tile_size * sample.GetPixelBytes();
+		int tile_num = this->tiles_x * this->tiles_y;
+
+		//the header, the directory, then the arrays too long to be put in the entries
+		int entry_num = sample_num == 4 ? 13 : 12;
+		long long directory_offset = 8;
+		long long arrays_offset = directory_offset + 2 + entry_num * 12 + 4;
+		long long offsets_offset = arrays_offset;
+		long long counts_offset = offsets_offset + 4ll * tile_num;
+		long long bits_offset = counts_offset + 4ll * tile_num;
+		long long formats_offset = bits_offset + 2ll * sample_num;
+		this->data_offset = (formats_offset + 2ll * sample_num + 15) / 16 * 16;
+		if (this->data_offset + (long long)this->tile_bytes * tile_num > 0xffffffffll)
+		{
+			return 0;
+		}
+		this->file = OpenFile(filename, "wb");
+		if (this->file == NULL)
+		{
+			return 0;
+		}
+
+		vector<unsigned char> head(this->data_offset, 0);
+		auto put16 = [&](long long place, unsigned int value)
+		{
+			head[place] = (unsigned char)(value & 255);
+			head[place + 1] = (unsigned char)((value >> 8) & 255);
+		};
+		auto put32 = [&](long long place, unsigned int value)
+		{
+			put16(place, value & 0xffffu);
+			put16(place + 2, value >> 16);
+		};
+		int entry = 0;
+		auto put_entry = [&](unsigned int tag, unsigned int type, unsigned int count, unsigned int value)
+		{
+			long long place = directory_offset + 2 + entry * 12;
+			put16(place, tag);
+			put16(place + 2, type);
+			put32(place + 4, count);
+			if (type == 3 && count <= 2)
+			{
+				put16(place + 8, value);
+			}
+			else
+			{
+				put32(place + 8, value);
+			}
+			entry++;
+		};
+		head[0] = 'I';
+		head[1] = 'I';
+		put16(2, 42);
+		put32(4, unsigned(directory_offset));
+		put16(directory_offset, entry_num);
+		//the types are 3 for 16 bit and 4 for 32 bit integers, the entries are sorted by the tag
+		put_entry(256, 4, 1, width);
+		put_entry(257, 4, 1, height);
+		put_entry(258, 3, sample_num, unsigned(bits_offset));
+		put_entry(259, 3, 1, 1); //no compression
+		put_entry(262, 3, 1, 2); //RGB
+		put_entry(277, 3, 1, sample_num);
+		put_entry(284, 3, 1, 1); //the samples of a pixel are together
+		put_entry(322, 4, 1, this->tile_size);
+		put_entry(323, 4, 1, this->tile_size);
+		//a single tile offset and byte count fit in their entries and must be put there, the arrays are then unused
+		put_entry(324, 4, tile_num, unsigned(tile_num == 1 ? this->data_offset : offsets_offset));
+		put_entry(325, 4, tile_num, unsigned(tile_num == 1 ? this->tile_bytes : counts_offset));
+		if (sample_num == 4)
+		{
+			put_entry(338, 3, 1, 2); //the alpha is unassociated
+		}
+		put_entry(339, 3, sample_num, unsigned(formats_offset));
+		put32(directory_offset + 2 + entry_num * 12, 0);
+		for (int i = 0; i < tile_num; i++)
+		{
+			put32(offsets_offset + 4ll * i, unsigned(this->data_offset + (long long)this->tile_bytes * i));
+			put32(counts_offset + 4ll * i, unsigned(this->tile_bytes));
+		}
+		for (int k = 0; k < sample_num; k++)
+		{
+			put16(bits_offset + 2ll * k, sample_bits);
+			put16(formats_offset + 2ll * k, format == FRAMEBUFFER_RGBA8 ? 1 : 3); //unsigned integers or floats
+		}
+		this->failed = fwrite(head.data(), 1, head.size(), this->file) != head.size();
+		this->bytes_written = head.size();
+		return this->failed == 0;
+	}
+
+	/*
+	Queue a finished tile to be written, the data of the tile is taken
+	Args:
+		tile_x [int]: [the column of the tile]
+		tile_y [int]: [the row of the tile]
+		tile [Framebuffer]: [the tile, tile_size x tile_size in the format of the file, emptied]
+	*/
+	void WriteTile(int tile_x, int tile_y, Framebuffer& tile)
+	{
+		auto data = make_shared<vector<unsigned char>>(move(tile.data));
+		tile.data.clear();
+		long long offset = this->data_offset + (long long)this->tile_bytes * (tile_y * this->tiles_x + tile_x);
+		{
+			unique_lock<mutex> guard(this->lock);
+			this->tile_done.wait(guard, [this] { return this->pending < STREAM_MAX_PENDING_TILES; });
+			this->pending++;
+			this->max_pending = max(this->max_pending, this->pending);
+		}
+		this->pool.Submit([this, data, offset, tile_x, tile_y]()
+		{
+			bool result = 0;
+			{
+				//the span ends before the waiting threads are notified
+				TRACE_SPAN("WriteTile", "output", tile_x, tile_y);
+				result = SeekFile(this->file, offset) && fwrite(data->data(), 1, data->size(), this->file) == data->size();
+			}
+			{
+				unique_lock<mutex> guard(this->lock);
+				this->pending--;
+				this->tiles_written++;
+				this->bytes_written += data->size();
+				this->failed = this->failed || !result;
+			}
+			this->tile_done.notify_all();
+		});
+	}
+
+	/*
+	Wait for the pending tiles and close the file
+	Returns:
+		result [bool]: [whether all the tiles are written or not]
+	*/
+	bool Close()
+	{
+		{
+			unique_lock<mutex> guard(this->lock);
+			this->tile_done.wait(guard, [this] { return this->pending == 0; });
+		}
+		if (this->file == NULL)
+		{
+			return 0;
+		}
+		this->failed = fclose(this->file) != 0 || this->failed;
+		this->file = NULL;
+		return this->failed == 0;
+	}
+};
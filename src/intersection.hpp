@@ -3,6 +3,7 @@
 #include "utils.hpp"
 #include "mesh_model.hpp"
 #include "camera_model.hpp"
+#include "render_counters.hpp"
 
 /*
 Judge whether a 2D point is inside a 2D rectangle
@@ -40,6 +41,7 @@ Args:
 */
 void GetIntersectionRayMesh(Ray& ray, TriangleMesh& face, double& t, Vector3d& fraction)
 {
+	COUNT_RENDER(triangle_tests);
 	Vector3d o = ray.start;
 	Vector3d d = ray.direction;
 	Vector3d p0 = face.vertexs[0].point;
@@ -78,6 +80,7 @@ Returns:
 */
 bool JudgeIntersectionRayBoundingBox(Ray& ray, BoundingBox& bounding_box)
 {
+	COUNT_RENDER(box_tests);
 	double t_x_min = -1, t_x_max = -1, t_y_min = -1, t_y_max = -1, t_z_min = -1, t_z_max = -1;
 	if (ray.direction(0) != 0)
 	{
@@ -159,21 +162,28 @@ Args:
 	ray [Ray]: [the ray to be intersected]
 	oct_node [OctNode*]: [the octreee node to be intersected]
 	intersection_mesh_list [vector<TriangleMesh>]: [the possible intersecting mesh to be judged]
+	pager [GeometryPager*]: [the pager of the paged leaves, NULL if the faces are resident]
 */
-void GetAllIntersectionRayOctNode( Ray& ray, OctNode* oct_node, vector<TriangleMesh>& intersection_mesh_list)
+void GetAllIntersectionRayOctNode( Ray& ray, OctNode* oct_node, vector<TriangleMesh>& intersection_mesh_list,
+	GeometryPager* pager = NULL)
 {
 	bool intersect = JudgeIntersectionRayBoundingBox(ray, oct_node->bounding_box);
 	if (intersect == 0)
 	{
 		return;
 	}
+	COUNT_RENDER(nodes_visited);
 	if (oct_node->sons[0] != NULL)
 	{
 		for (int i = 0; i < 8; i++)
 		{
-			GetAllIntersectionRayOctNode(ray, oct_node->sons[i], intersection_mesh_list);
+			GetAllIntersectionRayOctNode(ray, oct_node->sons[i], intersection_mesh_list, pager);
 		}
 	}
+	else if (oct_node->page_id >= 0 && pager != NULL)
+	{
+		pager->ReadPage(oct_node->page_id, intersection_mesh_list);
+	}
 	else
 	{
 		for (int i = 0; i < oct_node->faces.size(); i++)
@@ -183,6 +193,77 @@ void GetAllIntersectionRayOctNode( Ray& ray, OctNode* oct_node, vector<TriangleM
 	}
 }
 
+/*
+Get the t where a ray enters a bounding box, using the slabs of the 3 axes
+Args:
+	ray [Ray]: [the ray]
+	bounding_box [BoundingBox]: [the bounding box]
+Returns:
+	t [double]: [the t of entering, 0 if the ray starts inside, -1 if the ray misses the box]
+*/
+double GetRayBoundingBoxEntry(Ray& ray, BoundingBox& bounding_box)
+{
+	COUNT_RENDER(box_tests);
+	double mins[3] = { bounding_box.min_x, bounding_box.min_y, bounding_box.min_z };
+	double maxs[3] = { bounding_box.max_x, bounding_box.max_y, bounding_box.max_z };
+	double t_near = -DBL_MAX;
+	double t_far = DBL_MAX;
+	for (int k = 0; k < 3; k++)
+	{
+		if (ray.direction(k) == 0)
+		{
+			if (ray.start(k) < mins[k] || ray.start(k) > maxs[k])
+			{
+				return -1;
+			}
+			continue;
+		}
+		double t_1 = (mins[k] - ray.start(k)) / ray.direction(k);
+		double t_2 = (maxs[k] - ray.start(k)) / ray.direction(k);
+		if (t_1 > t_2)
+		{
+			swap(t_1, t_2);
+		}
+		t_near = max(t_near, t_1);
+		t_far = min(t_far, t_2);
+	}
+	if (t_near > t_far || t_far <= 0)
+	{
+		return -1;
+	}
+	return max(t_near, 0.0);
+}
+
+/*
+Get the first paged leaf entered by a ray, only the resident hierarchy is used so nothing is read, recursive function
+Args:
+	ray [Ray]: [the ray]
+	oct_node [OctNode*]: [the octree node]
+	page_id [int]: [the page of the nearest leaf found, not changed if nothing]
+	t [double]: [the entering t of the nearest leaf found, the leaves farther than it are skipped]
+*/
+void GetFirstPageRayOctNode(Ray& ray, OctNode* oct_node, int& page_id, double& t)
+{
+	double entry = GetRayBoundingBoxEntry(ray, oct_node->bounding_box);
+	if (entry < 0 || entry >= t)
+	{
+		return;
+	}
+	COUNT_RENDER(nodes_visited);
+	if (oct_node->sons[0] != NULL)
+	{
+		for (int i = 0; i < 8; i++)
+		{
+			GetFirstPageRayOctNode(ray, oct_node->sons[i], page_id, t);
+		}
+	}
+	else if (oct_node->page_id >= 0)
+	{
+		page_id = oct_node->page_id;
+		t = entry;
+	}
+}
+
 
 /*
 Get the intersection point of a ray with a mesh model
@@ -199,7 +280,7 @@ void GetIntersectionRayMeshModel(Ray& ray, MeshModel& mesh_model, int& id, doubl
 	id = -1;
 	vector<TriangleMesh> all_possible_faces;
 	all_possible_faces.clear();
-	GetAllIntersectionRayOctNode(ray, mesh_model.root, all_possible_faces);
+	GetAllIntersectionRayOctNode(ray, mesh_model.root, all_possible_faces, mesh_model.pager);
 	for (int i = 0; i < all_possible_faces.size(); i++)
 	{
 		double the_t = -1;
@@ -243,10 +324,11 @@ Args:
 	face [TriangleMesh]: [the face to be intersected]
 	t [double]: [the t of the ray to be traveled]
 	last_object_id [int]: [the last met object id] 
+	k_reflection [double]: [the reflection coefficient of the face]
 Returns:
 	new_ray [Ray]: [the new reflection ray]
 */
-Ray GetReflectionRay(Ray& ray, TriangleMesh& face, double t, int last_object_id)
+Ray GetReflectionRay(Ray& ray, TriangleMesh& face, double t, int last_object_id, double k_reflection)
 {
 	Vector3d normal_direction = face.normal; //out normal direction
 	//the normal direction must be opposite the ray direction
@@ -259,8 +341,10 @@ Ray GetReflectionRay(Ray& ray, TriangleMesh& face, double t, int last_object_id)
 	new_direction = new_direction / new_direction.norm();
 
 
-	double new_intensity = ray.intensity * face.k_reflection; //change the intensity
+	double new_intensity = ray.intensity * k_reflection; //change the intensity
 	Ray new_ray(intersection_point, new_direction, new_intensity, TYPE_REFLECTION, last_object_id);
+	new_ray.width = ray.GetWidth(t);
+	new_ray.spread = ray.spread;
 	return new_ray;
 }
 
@@ -271,13 +355,16 @@ Args:
 	face [TriangleMesh]: [the face to be intersected]
 	t [double]: [the t of the ray to be traveled]
 	last_object_id [int]: [the id of the last met object]
+	k_refraction [double]: [the refraction coefficient of the face]
 Returns:
 	new_ray [Ray]: [the new refraction ray]
 */
-Ray GetRefractionRay(Ray& ray, TriangleMesh& face, double t, int last_object_id)
+Ray GetRefractionRay(Ray& ray, TriangleMesh& face, double t, int last_object_id, double k_refraction)
 {
 	Vector3d intersection_point = ray.start + ray.direction * t;
-	double new_intensity = ray.intensity * face.k_refraction; //change the intensity
+	double new_intensity = ray.intensity * k_refraction; //change the intensity
 	Ray new_ray(intersection_point, ray.direction, new_intensity, TYPE_REFRACTION, last_object_id);
+	new_ray.width = ray.GetWidth(t);
+	new_ray.spread = ray.spread;
 	return new_ray;
 }
\ No newline at end of file
@@ -0,0 +1,142 @@
+//the bounding volume hierarchy of the point lights, used to find the lights reaching a point
+#pragma once
+#include "utils.hpp"
+using namespace std;
+using namespace Eigen;
+
+//a node of the light tree, the leaves store a range of the light list
+class LightTreeNode
+{
+public:
+	Vector3d min_corner;
+	Vector3d max_corner;
+	int left = -1; //the left son, -1 if leaf
+	int right = -1; //the right son, -1 if leaf
+	int start = 0; //the first light of the leaf in the light list
+	int count = 0; //the number of lights of the leaf
+};
+
+class LightTree
+{
+public:
+	const int leaf_size = 4;
+	vector<LightTreeNode> nodes;
+	vector<int> order; //the light places, sorted so that each leaf is a continuous range
+	vector<int> ids; //the ids of the lights returned in query
+	vector<Vector3d> positions;
+	vector<double> ranges;
+
+	LightTree() {}
+
+	/*
+	Build the tree of the lights
+	Args:
+		positions [vector<Vector3d>]: [the positions of the lights]
+		ranges [vector<double>]: [the ranges of the lights]
+		ids [vector<int>]: [the ids of the lights returned in query]
+	*/
+	void Build(vector<Vector3d>& positions, vector<double>& ranges, vector<int>& ids)
+	{
+		this->positions = positions;
+		this->ranges = ranges;
+		this->ids = ids;
+		this->nodes.clear();
+		this->order.resize(ids.size());
+		for (int i = 0; i < ids.size(); i++)
+		{
+			this->order[i] = i;
+		}
+		if (ids.size() > 0)
+		{
+			this->BuildNode(0, ids.size());
+		}
+	}
+
+	/*
+	Recursively build a node of the tree
+	Args:
+		start [int]: [the first light of the node]
+		end [int]: [the end of the lights of the node]
+	Returns:
+		node_id [int]: [the id of the node]
+	*/
+	int BuildNode(int start, int end)
+	{
+		LightTreeNode node;
+		node.min_corner << DBL_MAX, DBL_MAX, DBL_MAX;
+		node.max_corner << -DBL_MAX, -DBL_MAX, -DBL_MAX;
+		Vector3d min_center = node.min_corner;
+		Vector3d max_center = node.max_corner;
+		for (int i = start; i < end; i++)
+		{
+			Vector3d center = this->positions[this->order[i]];
+			Vector3d radius;
+			radius << this->ranges[this->order[i]], this->ranges[this->order[i]], this->ranges[this->order[i]];
+			node.min_corner = node.min_corner.cwiseMin(center - radius);
+			node.max_corner = node.max_corner.cwiseMax(center + radius);
+			min_center = min_center.cwiseMin(center);
+			max_center = max_center.cwiseMax(center);
+		}
+		int node_id = this->nodes.size();
+		this->nodes.push_back(node);
+		if (end - start <= this->leaf_size)
+		{
+			this->nodes[node_id].start = start;
+			this->nodes[node_id].count = end - start;
+			return node_id;
+		}
+
+		//split at the median of the longest axis of the centers
+		int axis = 0;
+		Vector3d extent = max_center - min_center;
+		extent.maxCoeff(&axis);
+		int mid = (start + end) / 2;
+		nth_element(this->order.begin() + start, this->order.begin() + mid, this->order.begin() + end,
+			[&](int a, int b) { return this->positions[a](axis) < this->positions[b](axis); });
+		int left = this->BuildNode(start, mid);
+		int right = this->BuildNode(mid, end);
+		this->nodes[node_id].left = left;
+		this->nodes[node_id].right = right;
+		return node_id;
+	}
+
+	/*
+	Get all the lights whose range contains a point
+	Args:
+		point [Vector3d]: [the point]
+		result [vector<int>]: [the ids of the lights, appended]
+		stack [vector<int>]: [the traversal stack, kept by the caller so it grows to the depth of the tree only once]
+	*/
+	void Query(Vector3d& point, vector<int>& result, vector<int>& stack)
+	{
+		if (this->nodes.size() == 0)
+		{
+			return;
+		}
+		stack.clear();
+		stack.push_back(0);
+		while (stack.size() > 0)
+		{
+			LightTreeNode& node = this->nodes[stack.back()];
+			stack.pop_back();
+			if ((point.array() < node.min_corner.array()).any() || (point.array() > node.max_corner.array()).any())
+			{
+				continue;
+			}
+			if (node.left < 0)
+			{
+				for (int i = node.start; i < node.start + node.count; i++)
+				{
+					int place = this->order[i];
+					if ((this->positions[place] - point).squaredNorm() < this->ranges[place] * this->ranges[place])
+					{
+						result.push_back(this->ids[place]);
+					}
+				}
+				continue;
+			}
+			stack.push_back(node.left);
+			stack.push_back(node.right);
+		}
+	}
+};
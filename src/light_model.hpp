@@ -3,6 +3,16 @@
 #include "mesh_model.hpp"
 #include "camera_model.hpp"
 #include "intersection.hpp"
+#include "pixel_order.hpp"
+#include "shadow_map.hpp"
+#include "light_culling.hpp"
+#include "scene.hpp"
+#include "picture_writer.hpp"
+#include "framebuffer.hpp"
+#include "frame_sink.hpp"
+#define LIGHT_DIRECTIONAL 0 //light from infinity, with the same direction everywhere
+#define LIGHT_POINT 1 //light from a point, fading out at its range
+#define DEFAULT_SCENE "res/scene.txt" //the scene loaded when the model is built
 
 
 /*
@@ -11,7 +21,10 @@ Definition of light and phong model
 class Light
 {
 public:
+	int type = LIGHT_DIRECTIONAL;
 	Vector3d direction;
+	Vector3d position;
+	double range = 0;
 	Vector3d ambient;
 	Vector3d diffuse;
 	Vector3d specular;
@@ -20,28 +33,79 @@ public:
 
 	Light(Vector3d& direction, Vector3d& ambient, Vector3d& diffuse, Vector3d specular)
 	{
+		this->type = LIGHT_DIRECTIONAL;
 		this->direction = direction;
+		this->position << 0, 0, 0;
+		this->ambient = ambient;
+		this->diffuse = diffuse;
+		this->specular = specular;
+	}
+
+	/*
+	Init a point light
+	Args:
+		position [Vector3d]: [the position of the light]
+		range [double]: [the distance where the light fades out]
+		ambient [Vector3d]: [the ambient color of the light]
+		diffuse [Vector3d]: [the diffuse color of the light]
+		specular [Vector3d]: [the specular color of the light]
+	*/
+	Light(Vector3d& position, double range, Vector3d& ambient, Vector3d& diffuse, Vector3d specular)
+	{
+		this->type = LIGHT_POINT;
+		this->position = position;
+		this->range = range;
+		this->direction << 0, -1, 0;
 		this->ambient = ambient;
 		this->diffuse = diffuse;
 		this->specular = specular;
 	}
 };
 
+/*
+Get the directional light equal to a light at a point, the point light is attenuated by the distance
+Args:
+	light [Light]: [the light source]
+	point [Vector3d]: [the point to be lighted]
+	distance [double]: [the distance from the point to the light, DBL_MAX for directional light]
+Returns:
+	local_light [Light]: [the directional light at the point]
+*/
+Light GetLightAtPoint(Light& light, Vector3d& point, double& distance)
+{
+	Light local_light = light;
+	distance = DBL_MAX;
+	if (light.type == LIGHT_POINT)
+	{
+		Vector3d offset = point - light.position;
+		distance = offset.norm();
+		local_light.direction = offset / distance;
+		double rate = distance / light.range;
+		double attenuation = max(1 - rate * rate, 0.0);
+		attenuation = attenuation * attenuation;
+		local_light.ambient = light.ambient * attenuation;
+		local_light.diffuse = light.diffuse * attenuation;
+		local_light.specular = light.specular * attenuation;
+	}
+	return local_light;
+}
+
 /*
 Get the ambient light on a vertex
 Args:
 	light [Light]: [the light source]
 	ray [Ray]: [the looking ray]
 	vertex [Vertex]: [the vertex to be lighted]
+	weight [Vector3d]: [the ambient weight of the material at the vertex]
 Returns:
 	ambient [Vector3d]: [the RGB result, between[0, 1)]
 */
-Vector3d GetAmbient(Light& light, Ray& ray, Vertex& vertex)
+Vector3d GetAmbient(Light& light, Ray& ray, Vertex& vertex, Vector3d weight)
 {
 	Vector3d ambient;
-	double r = vertex.ambient(0) * light.ambient(0);
-	double g = vertex.ambient(1) * light.ambient(1);
-	double b = vertex.ambient(2) * light.ambient(2);
+	double r = weight(0) * light.ambient(0);
+	double g = weight(1) * light.ambient(1);
+	double b = weight(2) * light.ambient(2);
 	ambient << r, g, b;
 	return ambient;
 }
@@ -52,22 +116,23 @@ Args:
 	light [Light]: [the light source]
 	ray [Ray]: [the looking ray]
 	vertex [Vertex]: [the vertex to be lighted]
+	weight [Vector3d]: [the diffuse weight of the material at the vertex]
 Returns:
 	diffuse [Vector3d]: [the RGB result, between[0, 1)]
 */
-Vector3d GetDiffuse(Light& light, Ray& ray, Vertex& vertex)
+Vector3d GetDiffuse(Light& light, Ray& ray, Vertex& vertex, Vector3d weight)
 {
 	Vector3d diffuse;
 	Vector3d n = vertex.normal;
 	Vector3d l = light.direction;
-	double weight = -n.dot(l);
-	if (weight <= 0)
+	double rate = -n.dot(l);
+	if (rate <= 0)
 	{
-		weight = 0;
+		rate = 0;
 	}
-	double r = vertex.diffuse(0) * light.diffuse(0) * weight;
-	double g = vertex.diffuse(1) * light.diffuse(1) * weight;
-	double b = vertex.diffuse(2) * light.diffuse(2) * weight;
+	double r = weight(0) * light.diffuse(0) * rate;
+	double g = weight(1) * light.diffuse(1) * rate;
+	double b = weight(2) * light.diffuse(2) * rate;
 	diffuse << r, g, b;
 	return diffuse;
 }
@@ -78,10 +143,11 @@ Args:
 	light [Light]: [the light source]
 	ray [Ray]: [the looking ray]
 	vertex [Vertex]: [the vertex to be lighted]
+	weight [Vector3d]: [the specular weight of the material at the vertex]
 Returns:
 	specular [Vector3d]: [the RGB result, between[0, 1)]
 */
-Vector3d GetSpecular(Light& light, Ray& ray, Vertex& vertex)
+Vector3d GetSpecular(Light& light, Ray& ray, Vertex& vertex, Vector3d weight)
 {
 	int p = 10;
 	Vector3d n = vertex.normal;
@@ -97,20 +163,73 @@ Vector3d GetSpecular(Light& light, Ray& ray, Vertex& vertex)
 	{
 		rv = 0;
 	}
-	double weight = 1;
+	double rate = 1;
 	for (int i = 1; i <= p; i++)
 	{
-		weight = weight * rv;
+		rate = rate * rv;
 	}
 
 	Vector3d specular;
-	double red = vertex.specular(0) * light.specular(0) * weight;
-	double green = vertex.specular(1) * light.specular(1) * weight;
-	double blue = vertex.specular(2) * light.specular(2) * weight;
+	double red = weight(0) * light.specular(0) * rate;
+	double green = weight(1) * light.specular(1) * rate;
+	double blue = weight(2) * light.specular(2) * rate;
 	specular << red, green, blue;
 	return specular;
 }
 
+/*
+Get the view independent lighting of the 3 vertexs of a face, the textured channels are sampled at the hit point instead
+Args:
+	light [Light]: [the light source]
+	face [TriangleMesh]: [the face to be lighted]
+	materials [MaterialTable]: [the material table]
+	colors [Vector3f*], [3]: [the ambient + diffuse color of each vertex]
+*/
+void GetViewIndependent(Light& light, TriangleMesh& face, MaterialTable& materials, Vector3f* colors)
+{
+	Ray ray;
+	for (int j = 0; j < 3; j++)
+	{
+		Vector3d color = GetAmbient(light, ray, face.vertexs[j], materials.GetColor(face, CHANNEL_AMBIENT)) + 
+			GetDiffuse(light, ray, face.vertexs[j], materials.GetColor(face, CHANNEL_DIFFUSE));
+		colors[j] = color.cast<float>();
+	}
+}
+
+/*
+Rebuild the view independent lighting of all the vertexs of a mesh model if the light or the materials changed,
+the paged mesh models are not cached and get their lighting on each hit
+Args:
+	light [Light]: [the light source]
+	mesh_model [MeshModel]: [the mesh model to be lighted]
+	materials [MaterialTable]: [the material table]
+*/
+void UpdateLightingCache(Light& light, MeshModel& mesh_model, MaterialTable& materials)
+{
+	LightingCache& cache = mesh_model.lighting_cache;
+	if (mesh_model.pager != NULL)
+	{
+		cache = LightingCache();
+		return;
+	}
+	Matrix3d light_key;
+	light_key << light.direction, light.ambient, light.diffuse;
+	if (cache.valid && cache.light_key == light_key && cache.material_version == materials.version)
+	{
+		return;
+	}
+
+	cache.colors.resize(mesh_model.faces.size() * 3);
+	for (int i = 0; i < mesh_model.faces.size(); i++)
+	{
+		GetViewIndependent(light, mesh_model.faces[i], materials, &cache.colors[i * 3]);
+	}
+	cache.light_key = light_key;
+	cache.material_version = materials.version;
+	cache.valid = 1;
+	mesh_model.memory.Set(MEMORY_SCRATCH, GetVectorBytes(cache.colors));
+}
+
 /*
 Get the color of the intersection point of a mesh using the phong model
 Args:
@@ -118,19 +237,31 @@ Args:
 	ray [Ray]: [the seeing direction]
 	face [TriangleMesh]: [the mesh to be lighted]
 	fraction [Vector3d]: [the fraction of the seeing point on the mesh]
+	view_independent [Vector3f*], [3]: [the cached ambient + diffuse color of the 3 vertexs of the mesh]
+	hit_colors [Vector3d*], [3]: [the ambient, diffuse and specular weight at the seeing point]
+	materials [MaterialTable]: [the material table]
 Returns:
 	color [Vector3d]: [the result RGB color, between[0, 1)]
 */
-Vector3d PhongModel(Light& light, Ray& ray, TriangleMesh& face, Vector3d& fraction)
+Vector3d PhongModel(Light& light, Ray& ray, TriangleMesh& face, Vector3d& fraction, Vector3f* view_independent,
+	Vector3d* hit_colors, MaterialTable& materials)
 {
 	Vector3d color;
 	color << 0, 0, 0;
+	bool textured_ambient = materials.IsTextured(face, CHANNEL_AMBIENT);
+	bool textured_diffuse = materials.IsTextured(face, CHANNEL_DIFFUSE);
 	for (int i = 0; i < 3; i++)
 	{
-		Vector3d ambient = GetAmbient(light, ray, face.vertexs[0]);
-		Vector3d diffuse = GetDiffuse(light, ray, face.vertexs[0]);
-		Vector3d specular = GetSpecular(light, ray, face.vertexs[0]);
-		Vector3d the_color = ambient + diffuse + specular;
+		Vector3d specular = GetSpecular(light, ray, face.vertexs[i], hit_colors[CHANNEL_SPECULAR]);
+		Vector3d the_color = view_independent[i].cast<double>() + specular;
+		if (textured_ambient)
+		{
+			the_color = the_color + GetAmbient(light, ray, face.vertexs[i], hit_colors[CHANNEL_AMBIENT]);
+		}
+		if (textured_diffuse)
+		{
+			the_color = the_color + GetDiffuse(light, ray, face.vertexs[i], hit_colors[CHANNEL_DIFFUSE]);
+		}
 		color = color + the_color * fraction(i);
 	}
 	color = color * ray.intensity;
@@ -138,21 +269,164 @@ Vector3d PhongModel(Light& light, Ray& ray, TriangleMesh& face, Vector3d& fracti
 }
 
 
+#define RAY_STACK_SIZE 32 //the max number of rays waiting in the ray tree stack
+
+//a ray waiting to be traced in the ray tree
+class RayStackEntry
+{
+public:
+	Ray ray;
+	int depth = 1;
+	int reflections = 0; //the number of reflections on the path of the ray
+	int refractions = 0; //the number of refractions on the path of the ray
+};
+
+//the color and the first hit of a pixel, used in adaptive sampling
+class PixelSample
+{
+public:
+	Vector3d color;
+	int object_id = -1; //the id of the first hit object, -1 if nothing
+	int face_id = -1; //the id of the first hit face, -1 if nothing
+	double depth = -1; //the t of the first hit, -1 if nothing
+	PixelSample() 
+	{
+		color << 0, 0, 0;
+	}
+};
+
+
+#define COST_TRAVERSAL 0 //the octree nodes entered by the rays of a pixel, needs ENABLE_RENDER_COUNTERS
+#define COST_TRIANGLES 1 //the triangle tests of a pixel, needs ENABLE_RENDER_COUNTERS
+#define COST_SECONDARY 2 //the rays traced after the primary ray of a pixel
+#define COST_TIME 3 //the wall time of a pixel
+#define COST_MAP_NUM 4
+const string cost_map_names[COST_MAP_NUM] = { "traversal", "triangles", "secondary", "time" };
+
+//the statistics of a frame of a camera path
+class SequenceFrameStats
+{
+public:
+	double frame_time = 0; //in seconds
+	double reused_fraction = 0; //the fraction of pixels reused from the last frame
+	long long traced_rays = 0;
+};
+
 
 //the main class of ray tracing
 class RayTracing
 {
 public:
 	vector<MeshModel> objects;
+	MaterialTable materials;
+	vector<MeshLoadStats> load_stats; //the loading statistics of each object
+	bool scene_loaded = 0; //whether a scene is loaded, the scene is empty if the default scene cannot be read
+	double scene_load_time = 0; //the time of loading all the objects of the scene
 	Camera camera;
 	Light light;
 	const double threshold = 0.01;
 	const int max_depth = 3;
+	int max_reflection_bounces = 2; //the max reflections on the path of a ray
+	int max_refraction_bounces = 2; //the max refractions on the path of a ray
+	long long traced_rays = 0; //the number of rays traced in the last frame
+	long long pruned_rays = 0; //the number of rays pruned before creation in the last frame
+	//the additional lights besides the main light, culled by range and orientation on each hit
+	vector<Light> lights;
+	bool light_importance_sampling = 0; //only trace the shadow rays of the most important lights
+	int max_shadow_rays = 4; //the max shadow rays of the additional lights on each hit in importance sampling
+	LightTree light_tree; //the index of the point lights
+	vector<int> directional_lights; //the directional lights, never culled by range
+	vector<int> light_candidates;
+	vector<double> light_index_key; //the type, position and range of each light the index was built with
+	//the buffers of the lights of a hit, kept between the hits
+	vector<int> light_stack;
+	vector<pair<double, int>> light_importances;
+	vector<Light> local_lights;
+	vector<double> light_distances;
+	long long culled_lights = 0; //the number of lights culled on all the hits in the last frame
+	bool shadow_mapping = 0; //look up the shadows in the shadow map instead of tracing local rays
+	ShadowMap shadow_map;
+	int picture_size = 300; //the size of the output picture
 	Vector3d* results;
 
+	//dynamic resolution, render at a lower resolution and upscale to meet the frame time budget
+	bool dynamic_resolution = 0;
+	double target_frame_time = 0.5; //the frame time budget, in seconds
+	int min_render_size = 60;
+	const int render_size_step = 4;
+	int render_size = 300; //the current internal resolution
+	double frame_time = 0; //the measured time of the last frame, in seconds
+	Vector3d* render_results;
+
+	//adaptive sampling, trace a sparse grid and only refine the blocks whose corners differ
+	bool adaptive_sampling = 0;
+	int adaptive_grid_size = 8; //the initial distance between the traced pixels, power of 2
+	double adaptive_color_threshold = 0.05; //the max difference of the corner colors to interpolate
+	double adaptive_depth_threshold = 0.05; //the max relative difference of the corner depths to interpolate
+	double traced_fraction = 1; //the fraction of pixels actually traced in the last frame
+	vector<PixelSample> pixel_samples;
+	vector<char> pixel_traced;
+
+	//temporal reprojection, the first hits of the last frame are moved into the new camera and their colors are reused
+	//where the depths and the objects around them agree, the other pixels are traced again
+	bool temporal_reuse = 0;
+	int reuse_max_age = 4; //the frames a color can be reused before it is traced again, bounds the drift of the view dependent shading
+	double reuse_depth_threshold = 0.02; //the max relative difference of the reprojected depths of the neighbours
+	double reused_fraction = 0; //the fraction of pixels reused from the last frame in the last frame
+	int history_width = 0; //the width of the frame kept in the history, 0 if there is no history
+	vector<PixelSample> history_samples; //the first hits of the last frame
+	vector<Vector3d> history_positions; //the world position of the first hit of each pixel of the last frame, the direction of a miss
+	vector<int> history_ages; //the frames the color of each pixel of the last frame has been reused
+	vector<int> reuse_sources; //the pixel of the last frame reprojected to each pixel, -1 if none
+	vector<double> reuse_depths; //the depth of the reprojected hit of each pixel
+	vector<SequenceFrameStats> sequence_stats; //the statistics of each frame of the last camera path
+
+	//edge adaptive antialiasing, only the pixels on geometric and shading edges get extra samples
+	bool antialiasing = 0;
+	int aa_max_samples = 5; //the sample budget of an edge pixel, the extra samples are rounded down to a square
+	double aa_color_threshold = 0.1; //the max color contrast with the neighbours of a non-edge pixel
+	double aa_normal_threshold = 0.9; //the min cos between the face normals of a non-edge pixel and its neighbours
+	double samples_per_pixel = 1; //the average samples of each pixel in the last frame
+	vector<char> pixel_edge;
+
+	//the traversal order of the pixels, the tiles are traced into a contiguous buffer and then copied row by row
+	int pixel_order = ORDER_ROW;
+	int tile_size = 16;
+	vector<Vector3d> tile_results;
+
+	//out of core geometry, the leaf faces live in a page file and only the hierarchy stays resident
+	bool paging = 0;
+	bool ray_reordering = 1; //trace the primary rays of a tile grouped by the first page they enter
+	GeometryPager pager;
+	vector<pair<int, int>> tile_keys; //the first page and the place in the tile of each pixel
+
+	PictureWriter picture_writer; //writes the saved frames on a background thread
+
+	//streaming output, the finished tiles go straight to a tiled file and no framebuffer of the full size is kept
+	int stream_format = FRAMEBUFFER_RGB16F;
+	double stream_time = 0; //the time of the last streamed picture, in seconds
+	size_t stream_peak_memory = 0; //the most bytes of tiles held by the last streamed picture
+
+	FrameSink frame_sink; //publishes the frames, and the tiles in the tiles mode, to a shared memory ring for the viewers
+
+	//the cost of each pixel in the diagnostic render, see RenderCostMaps
+	bool record_costs = 0;
+	vector<double> pixel_costs[COST_MAP_NUM];
+	double cost_scales[COST_MAP_NUM] = { 0 }; //the cost mapped to white in each map of the last diagnostic render
+
+	//the counters of the work of the last frame, only counted with ENABLE_RENDER_COUNTERS defined
+	RenderCounters frame_counters;
+	long long frame_count = 0; //the number of frames rendered by Main
+	ofstream counter_file; //each frame appends its counters as one line of JSON if opened
+
+	//the memory of the scene, the objects and the buffers of the model, sampled after loading and after each frame
+	MemoryUsage memory;
+
 	~RayTracing()
 	{
 		this->objects.clear();
+		delete[] this->results;
+		delete[] this->render_results;
 	}
 
 	RayTracing()
@@ -167,124 +441,158 @@ public:
 		light_specular << 1.0, 1.0, 1.0;
 		this->light = Light(light_direction, light_ambient, light_diffuse, light_specular);
 
-		int picture_size = 300;
 		double r = 10 * sqrt(2.0);
 		double theta = 135.0 / 180.0 * PI;
 		double phi = 0;
-		this->camera = Camera(picture_size, r, theta, phi);
+		this->camera = Camera(this->picture_size, r, theta, phi);
 
-		this->objects.clear();
-		Vector3d center;
-		double size = 1;
-		Vector3d ambient;
-		Vector3d diffuse;
-		Vector3d specular;
-		double k_reflection = 0;
-		double k_refraction = 0;
-		
-		
-		string name_board = "res\\board.ply";
-		size = 10 * sqrt(2);
-		center << 0, 0, 0;
-		ambient << 0.2, 0.2, 0.2;
-		diffuse << 0.4, 0.4, 0.4;
-		specular << 0.2, 0.2, 0.2;
-		k_reflection = 0.4;
-		k_refraction = 0;
-		vector<TriangleMesh> board_mesh = ReadPLYMesh(name_board, size, center, ambient, diffuse, specular, 
-			k_reflection, k_refraction);
-		MeshModel board = MeshModel(board_mesh);
-		this->objects.push_back(board);
-		
-
-		string name_shiba = "res\\shiba.obj";
-		size = 2;
-		center << 0, 3, 5;
-		k_reflection = 0;
-		k_refraction = 0;
-		vector<TriangleMesh> shiba_mesh = ReadOBJMesh(name_shiba, size, center, k_reflection, k_refraction);
-		MeshModel shiba = MeshModel(shiba_mesh);
-		this->objects.push_back(shiba);
-		
-		string name_bunny = "res\\bunny.ply";
-		size = 2;
-		center << 5, 2, 0;
-		ambient << 0.2, 0.2, 0.2;
-		diffuse << 0.7, 0.7, 0.2;
-		specular << 0.2, 0.2, 0.2;
-		k_reflection = 0.2;
-		k_refraction = 0.1;
-		vector<TriangleMesh> bunny_mesh = ReadPLYMesh(name_bunny, size, center, ambient, diffuse, specular,
-			k_reflection, k_refraction);
-		MeshModel bunny = MeshModel(bunny_mesh);
-		this->objects.push_back(bunny);
-		
-		string name_cube = "res\\cube.ply";
-		size = 2;
-		center << -5, 4, 4;
-		ambient << 0.2, 0.2, 0.2;
-		diffuse << 0.2, 0.2, 0.2;
-		specular << 0.2, 0.2, 0.2;		
-		k_reflection = 0.1;
-		k_refraction = 0.6;
-		vector<TriangleMesh> cube_mesh = ReadPLYMesh(name_cube, size, center, ambient, diffuse, specular,
-			k_reflection, k_refraction);
-		MeshModel cube = MeshModel(cube_mesh);
-		this->objects.push_back(cube);
-		
-
-		int total_size = this->camera.height * this->camera.width;
+		if (!this->LoadScene(DEFAULT_SCENE))
+		{
+			cerr << "cannot load the default scene " << DEFAULT_SCENE << ", the scene is empty" << endl;
+		}
+
+		int total_size = this->picture_size * this->picture_size;
 		this->results = new Vector3d[total_size];
-		
+		this->render_results = new Vector3d[total_size];
+		this->render_size = this->picture_size;
 	}
 
 	/*
-	Recursively trace one ray
+	Load a scene description file, the objects, the materials and the additional lights are replaced,
+	the first directional light becomes the main light, the scene is kept if the file cannot be read
 	Args:
-		ray [Ray]: [the ray to be traced]
-		depth [int]: [current depth]
+		filename [string]: [the full filename of the scene description]
 	Returns:
-		color [Vector3d]: [result color of the ray]
+		result [bool]: [whether the scene is loaded or not]
 	*/
-	Vector3d TraceOneRay(Ray& ray, int depth)
+	bool LoadScene(string filename)
 	{
-		Vector3d color;
-		color << 0, 0, 0;
-		if (depth > this->max_depth || ray.intensity <= this->threshold)
+		SceneDescription scene;
+		if (!scene.Read(filename))
 		{
-			return color;
+			return 0;
+		}
+		auto start_time = chrono::steady_clock::now();
+		if (scene.has_camera)
+		{
+			this->camera = Camera(this->picture_size, scene.camera_r, scene.camera_theta, scene.camera_phi);
+		}
+		this->lights.clear();
+		this->history_width = 0;
+		bool main_light = 0;
+		for (int i = 0; i < scene.lights.size(); i++)
+		{
+			SceneLight& scene_light = scene.lights[i];
+			if (scene_light.point)
+			{
+				this->lights.push_back(Light(scene_light.place, scene_light.range, scene_light.ambient, scene_light.diffuse,
+					scene_light.specular));
+			}
+			else if (main_light == 0)
+			{
+				this->light = Light(scene_light.place, scene_light.ambient, scene_light.diffuse, scene_light.specular);
+				main_light = 1;
+			}
+			else
+			{
+				this->lights.push_back(Light(scene_light.place, scene_light.ambient, scene_light.diffuse, scene_light.specular));
+			}
 		}
 
-		//local ray need special judge, judge all the objects
-		if (ray.type == TYPE_LOCAL)
+		//the new octrees can reuse the addresses of the freed ones, so the shadow map is always rebuilt
+		this->objects.clear();
+		this->materials = MaterialTable();
+		this->shadow_map.valid = 0;
+		int thread_num = min(max(int(scene.objects.size()), 1), max(int(thread::hardware_concurrency()), 1));
+		ThreadPool pool(thread_num);
+		LoadSceneObjects(scene, pool, this->objects, this->materials, this->load_stats);
+		if (this->paging)
 		{
-			color << 1, 1, 1;
-			color = color * ray.intensity;
-			for (int i = 0; i < this->objects.size(); i++)
+			//the pages of the replaced objects are dropped with the old page file
+			this->paging = 0;
+			this->EnablePaging(this->pager.filename, this->pager.cache_bytes);
+		}
+		this->scene_load_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+		this->UpdateMemoryUsage();
+		this->scene_loaded = 1;
+		return 1;
+	}
+
+	/*
+	Page out the leaf faces of all the objects, the objects loaded later are paged out too,
+	if paging is already enabled only the budget changes and the page file is kept
+	Args:
+		filename [string]: [the full filename of the page file]
+		cache_bytes [size_t]: [the max bytes of the resident pages]
+	Returns:
+		result [bool]: [whether the page file is created or not]
+	*/
+	bool EnablePaging(string filename, size_t cache_bytes)
+	{
+		if (this->paging == 0 && !this->pager.Open(filename, cache_bytes))
+		{
+			return 0;
+		}
+		this->pager.cache_bytes = cache_bytes;
+		for (int i = 0; i < this->objects.size(); i++)
+		{
+			if (this->objects[i].pager == NULL)
 			{
-				if (i == ray.last_object_id)
-				{
-					continue;
-				}
-				double t;
-				int mesh_id;
-				Vector3d fraction;
-				GetIntersectionRayMeshModel(ray, this->objects[i], mesh_id, t, fraction);
-				if (t > 0)
-				{
-					color = color * this->objects[i].faces[mesh_id].k_refraction;
-				}
+				this->objects[i].PageOut(&this->pager);
 			}
-			return color;
 		}
+		this->pager.ResetStats();
+		this->paging = 1;
+		this->UpdateMemoryUsage();
+		return 1;
+	}
 
+	/*
+	Sample the memory of the scene, the usages of the objects are added to the buffers of the model
+	Args:
+		transient_framebuffer [size_t]: [the bytes of the framebuffer held only during the last pass, counted in the peak]
+	*/
+	void UpdateMemoryUsage(size_t transient_framebuffer = 0)
+	{
+		MemoryUsage usage;
+		for (int i = 0; i < this->objects.size(); i++)
+		{
+			usage.Merge(this->objects[i].memory);
+		}
+		usage.Add(MEMORY_GEOMETRY, this->pager.resident_bytes);
+		usage.Add(MEMORY_TEXTURES, this->materials.textures.GetBytes());
+		size_t picture_bytes = size_t(this->picture_size) * this->picture_size * sizeof(Vector3d);
+		usage.Add(MEMORY_FRAMEBUFFER, picture_bytes * 2 + GetVectorBytes(this->tile_results));
+		usage.Add(MEMORY_FRAMEBUFFER, transient_framebuffer);
+		usage.Remove(MEMORY_FRAMEBUFFER, transient_framebuffer);
 
+		size_t scratch_bytes = GetVectorBytes(this->pixel_samples) + GetVectorBytes(this->pixel_traced) + GetVectorBytes(this->pixel_edge)
+			+ GetVectorBytes(this->history_samples) + GetVectorBytes(this->history_positions) + GetVectorBytes(this->history_ages)
+			+ GetVectorBytes(this->reuse_sources) + GetVectorBytes(this->reuse_depths) + GetVectorBytes(this->tile_keys)
+			+ GetVectorBytes(this->shadow_map.depths) + GetVectorBytes(this->shadow_map.transmittances);
+		for (int k = 0; k < COST_MAP_NUM; k++)
+		{
+			scratch_bytes += GetVectorBytes(this->pixel_costs[k]);
+		}
+		usage.Add(MEMORY_SCRATCH, scratch_bytes);
+		this->memory.Sample(usage);
+	}
 
-		//get intersection results with all the models
-		double best_t = DBL_MAX;
-		int best_mesh_id = -1;
-		Vector3d best_fraction;
-		int best_i = -1;
+	/*
+	Trace a local ray to the light, judge all the objects to get the shadow
+	Args:
+		ray [Ray]: [the local ray to be traced]
+		max_t [double]: [the t of the light, the objects behind the light are not judged]
+	Returns:
+		color [Vector3d]: [the light color passing through the objects]
+	*/
+	Vector3d TraceLocalRay(Ray& ray, double max_t = DBL_MAX)
+	{
+		COUNT_RENDER(rays[TYPE_LOCAL]);
+		Vector3d color;
+		color << 1, 1, 1;
+		color = color * ray.intensity;
+		bool hit = 0;
 		for (int i = 0; i < this->objects.size(); i++)
 		{
 			if (i == ray.last_object_id)
@@ -295,53 +603,1186 @@ public:
 			int mesh_id;
 			Vector3d fraction;
 			GetIntersectionRayMeshModel(ray, this->objects[i], mesh_id, t, fraction);
-			if (t > 0 && t < best_t)
+			if (t > 0 && t < max_t)
+			{
+				color = color * this->materials.materials[this->objects[i].GetFace(mesh_id).material_id].k_refraction;
+				hit = 1;
+			}
+		}
+		if (hit)
+		{
+			COUNT_RENDER(hits);
+		}
+		return color;
+	}
+
+	/*
+	Measure the accuracy of the shadow map against the traced local rays at the first hits of a pixel grid
+	Args:
+		step [int]: [the distance between the measured pixels]
+		mean_error [double]: [the mean absolute error of the transmittance]
+		mismatch_rate [double]: [the rate of the points whose error is larger than 0.1]
+	*/
+	void MeasureShadowMapError(int step, double& mean_error, double& mismatch_rate)
+	{
+		this->camera.SetPictureSize(this->picture_size);
+		this->shadow_map.Update(this->light.direction, this->objects, this->materials);
+		double error_sum = 0;
+		int mismatch_num = 0;
+		int point_num = 0;
+		for (int j = 0; j < this->camera.height; j += step)
+		{
+			for (int i = 0; i < this->camera.width; i += step)
+			{
+				PixelSample sample = this->TracePixel(i, j);
+				if (sample.object_id < 0)
+				{
+					continue;
+				}
+				Ray ray = GetPixelRay(this->camera, i, j);
+				Ray local = GetLocalRay(ray, this->light.direction, sample.depth, sample.object_id);
+				double traced = this->TraceLocalRay(local)(0);
+				double looked_up = this->shadow_map.Lookup(local.start, sample.object_id);
+				double error = fabs(traced - looked_up);
+				error_sum += error;
+				if (error > 0.1)
+				{
+					mismatch_num++;
+				}
+				point_num++;
+			}
+		}
+		mean_error = point_num > 0 ? error_sum / point_num : 0;
+		mismatch_rate = point_num > 0 ? double(mismatch_num) / point_num : 0;
+	}
+
+	/*
+	Build the index of the additional lights, the point lights are put in the light tree,
+	the index is only rebuilt when the type, the position or the range of a light changed
+	*/
+	void BuildLightIndex()
+	{
+		vector<double> key;
+		for (int i = 0; i < this->lights.size(); i++)
+		{
+			//a directional light has no position or range, only its place in the list matters
+			Light& light = this->lights[i];
+			key.push_back(double(light.type));
+			if (light.type == LIGHT_POINT)
 			{
-				best_t = t;
-				best_mesh_id = mesh_id;
-				best_fraction = fraction;
-				best_i = i;
+				key.insert(key.end(), { light.position(0), light.position(1), light.position(2), light.range });
 			}
 		}
+		if (key == this->light_index_key)
+		{
+			return;
+		}
+		this->light_index_key = key;
 
+		vector<Vector3d> positions;
+		vector<double> ranges;
+		vector<int> ids;
+		this->directional_lights.clear();
+		for (int i = 0; i < this->lights.size(); i++)
+		{
+			if (this->lights[i].type == LIGHT_DIRECTIONAL)
+			{
+				this->directional_lights.push_back(i);
+			}
+			else
+			{
+				positions.push_back(this->lights[i].position);
+				ranges.push_back(this->lights[i].range);
+				ids.push_back(i);
+			}
+		}
+		this->light_tree.Build(positions, ranges, ids);
+	}
 
-		//generate ray tree, recursively get results
-		if (best_i < 0)
+	/*
+	Get the color of a hit lighted by the additional lights, the lights out of range or behind the face are culled,
+	in importance sampling only the most important lights trace shadow rays, the others use their average visibility
+	Args:
+		ray [Ray]: [the seeing ray]
+		face [TriangleMesh]: [the face to be lighted]
+		fraction [Vector3d]: [the fraction of the seeing point on the face]
+		t [double]: [the t of the seeing ray]
+		object_id [int]: [the id of the object of the face]
+		hit_colors [Vector3d*], [3]: [the ambient, diffuse and specular weight at the seeing point]
+	Returns:
+		color [Vector3d]: [the result RGB color]
+	*/
+	Vector3d ShadeLights(Ray& ray, TriangleMesh& face, Vector3d& fraction, double t, int object_id, Vector3d* hit_colors)
+	{
+		Vector3d color;
+		color << 0, 0, 0;
+		if (this->lights.size() == 0)
 		{
 			return color;
 		}
+		Vector3d point = ray.start + ray.direction * t;
+		this->light_candidates = this->directional_lights;
+		this->light_tree.Query(point, this->light_candidates, this->light_stack);
+		this->culled_lights += this->lights.size() - this->light_candidates.size();
 
+		//the ambient is not shadowed, the lights behind the face only give ambient
+		vector<pair<double, int>>& importances = this->light_importances;
+		vector<Light>& local_lights = this->local_lights;
+		vector<double>& distances = this->light_distances;
+		importances.clear();
+		local_lights.clear();
+		distances.clear();
+		for (int k = 0; k < this->light_candidates.size(); k++)
+		{
+			double distance;
+			Light local_light = GetLightAtPoint(this->lights[this->light_candidates[k]], point, distance);
+			for (int i = 0; i < 3; i++)
+			{
+				color = color + GetAmbient(local_light, ray, face.vertexs[i], hit_colors[CHANNEL_AMBIENT]) * fraction(i);
+			}
+			double facing = -face.normal.dot(local_light.direction);
+			if (facing <= 0)
+			{
+				this->culled_lights++;
+				continue;
+			}
+			double importance = facing * local_light.diffuse.sum() + local_light.specular.sum();
+			importances.push_back(make_pair(-importance, int(local_lights.size())));
+			local_lights.push_back(local_light);
+			distances.push_back(distance);
+		}
 
-		TriangleMesh final_mesh = this->objects[best_i].faces[best_mesh_id];
-		Vector3d color_phong = PhongModel(this->light, ray, final_mesh, best_fraction);
-		double k_reflection = final_mesh.k_reflection;
-		double k_refraction = final_mesh.k_refraction;
-		Ray local = GetLocalRay(ray, this->light.direction, best_t, best_i);
-		Ray reflection = GetReflectionRay(ray, final_mesh, best_t, best_i);
-		Ray refraction = GetRefractionRay(ray, final_mesh, best_t, best_i);
-		Vector3d color_local = this->TraceOneRay(local, depth);
-		Vector3d color_reflection = this->TraceOneRay(reflection, depth + 1);
-		Vector3d color_refraction = this->TraceOneRay(refraction, depth + 1);
-		color(0) = color_phong(0) * color_local(0);
-		color(1) = color_phong(1) * color_local(1);
-		color(2) = color_phong(2) * color_local(2);
-		color = color + color_reflection + color_refraction;
+		int traced_num = importances.size();
+		if (this->light_importance_sampling && traced_num > this->max_shadow_rays)
+		{
+			traced_num = this->max_shadow_rays;
+			partial_sort(importances.begin(), importances.begin() + traced_num, importances.end());
+		}
+		Vector3d untraced_color;
+		untraced_color << 0, 0, 0;
+		double visibility_sum = 0;
+		for (int k = 0; k < importances.size(); k++)
+		{
+			Light& local_light = local_lights[importances[k].second];
+			Vector3d direct;
+			direct << 0, 0, 0;
+			for (int i = 0; i < 3; i++)
+			{
+				direct = direct + (GetDiffuse(local_light, ray, face.vertexs[i], hit_colors[CHANNEL_DIFFUSE]) +
+					GetSpecular(local_light, ray, face.vertexs[i], hit_colors[CHANNEL_SPECULAR])) * fraction(i);
+			}
+			if (k >= traced_num)
+			{
+				untraced_color = untraced_color + direct;
+				continue;
+			}
+			Ray shadow_ray(point, -local_light.direction, 1.0, TYPE_LOCAL, object_id);
+			this->traced_rays++;
+			Vector3d visibility = this->TraceLocalRay(shadow_ray, distances[importances[k].second]);
+			visibility_sum += visibility(0);
+			color = color + direct.cwiseProduct(visibility);
+		}
+		if (traced_num > 0)
+		{
+			color = color + untraced_color * (visibility_sum / traced_num);
+		}
+		color = color * ray.intensity;
 		return color;
 	}
 
 	/*
-	The main function of ray tracing
+	Push a reflection or refraction ray to the ray stack, the ray is pruned if its contribution or the bounces are out of limit
+	Args:
+		stack [RayStackEntry*], [RAY_STACK_SIZE]: [the ray stack]
+		stack_top [int]: [the number of rays in the stack]
+		entry [RayStackEntry]: [the ray to be pushed]
 	*/
-	void Main()
+	void PushRay(RayStackEntry* stack, int& stack_top, RayStackEntry& entry)
+	{
+		if (entry.depth > this->max_depth || entry.ray.intensity <= this->threshold ||
+			entry.reflections > this->max_reflection_bounces || entry.refractions > this->max_refraction_bounces ||
+			stack_top >= RAY_STACK_SIZE)
+		{
+			this->pruned_rays++;
+			return;
+		}
+		stack[stack_top] = entry;
+		stack_top++;
+	}
+
+	/*
+	Trace one ray and its ray tree iteratively with an explicit stack, 
+	the color of the tree is the sum of the local colors of all the hits
+	Args:
+		ray [Ray]: [the ray to be traced]
+		depth [int]: [current depth]
+		sample [PixelSample*]: [if not NULL, record the first hit of the ray]
+	Returns:
+		color [Vector3d]: [result color of the ray]
+	*/
+	Vector3d TraceOneRay(Ray& ray, int depth, PixelSample* sample = NULL)
 	{
-		for (int i = 0; i < this->camera.width; i++)
+		Vector3d color;
+		color << 0, 0, 0;
+		if (depth > this->max_depth || ray.intensity <= this->threshold)
+		{
+			return color;
+		}
+
+		RayStackEntry stack[RAY_STACK_SIZE];
+		int stack_top = 0;
+		stack[0].ray = ray;
+		stack[0].depth = depth;
+		stack_top = 1;
+		bool first = 1;
+		while (stack_top > 0)
 		{
-			for (int j = 0; j < this->camera.height; j++)
+			stack_top--;
+			RayStackEntry entry = stack[stack_top];
+			Ray& the_ray = entry.ray;
+			this->traced_rays++;
+			COUNT_RENDER(rays[the_ray.type]);
+			COUNT_RENDER(depth_histogram[min(entry.depth, COUNTER_MAX_DEPTH)]);
+
+			//get intersection results with all the models
+			double best_t = DBL_MAX;
+			int best_mesh_id = -1;
+			Vector3d best_fraction;
+			int best_i = -1;
+			for (int i = 0; i < this->objects.size(); i++)
 			{
-				Ray the_ray = GetPixelRay(this->camera, i, j);
-				Vector3d the_color = this->TraceOneRay(the_ray, 1);
-				this->results[j * this->camera.width + i] = the_color;
+				if (i == the_ray.last_object_id)
+				{
+					continue;
+				}
+				double t;
+				int mesh_id;
+				Vector3d fraction;
+				GetIntersectionRayMeshModel(the_ray, this->objects[i], mesh_id, t, fraction);
+				if (t > 0 && t < best_t)
+				{
+					best_t = t;
+					best_mesh_id = mesh_id;
+					best_fraction = fraction;
+					best_i = i;
+				}
+			}
+			if (first && sample != NULL && best_i >= 0)
+			{
+				sample->object_id = best_i;
+				sample->face_id = best_mesh_id;
+				sample->depth = best_t;
+			}
+			first = 0;
+			if (best_i < 0)
+			{
+				continue;
+			}
+			COUNT_RENDER(hits);
+
+			//the local color
+			TriangleMesh final_mesh = this->objects[best_i].GetFace(best_mesh_id);
+			Vector3f paged_lighting[3];
+			Vector3f* view_independent = paged_lighting;
+			if (this->objects[best_i].pager == NULL)
+			{
+				view_independent = &this->objects[best_i].lighting_cache.colors[best_mesh_id * 3];
 			}
+			else
+			{
+				GetViewIndependent(this->light, final_mesh, this->materials, paged_lighting);
+			}
+			Vector3d hit_colors[3];
+			this->materials.GetHitColors(final_mesh, best_fraction, the_ray.GetWidth(best_t), hit_colors);
+			Vector3d color_phong = PhongModel(this->light, the_ray, final_mesh, best_fraction, view_independent, hit_colors,
+				this->materials);
+			Ray local = GetLocalRay(the_ray, this->light.direction, best_t, best_i);
+			Vector3d color_local;
+			if (this->shadow_mapping)
+			{
+				color_local << 1, 1, 1;
+				color_local = color_local * (local.intensity * this->shadow_map.Lookup(local.start, best_i));
+			}
+			else
+			{
+				this->traced_rays++;
+				color_local = this->TraceLocalRay(local);
+			}
+			color(0) += color_phong(0) * color_local(0);
+			color(1) += color_phong(1) * color_local(1);
+			color(2) += color_phong(2) * color_local(2);
+			color = color + this->ShadeLights(the_ray, final_mesh, best_fraction, best_t, best_i, hit_colors);
+
+			//generate the ray tree, the rays of little contribution are pruned before creation
+			RayStackEntry reflection;
+			reflection.depth = entry.depth + 1;
+			reflection.reflections = entry.reflections + 1;
+			reflection.refractions = entry.refractions;
+			Material& material = this->materials.materials[final_mesh.material_id];
+			reflection.ray.intensity = the_ray.intensity * material.k_reflection;
+			if (reflection.ray.intensity > this->threshold)
+			{
+				reflection.ray = GetReflectionRay(the_ray, final_mesh, best_t, best_i, material.k_reflection);
+			}
+			this->PushRay(stack, stack_top, reflection);
+
+			RayStackEntry refraction;
+			refraction.depth = entry.depth + 1;
+			refraction.reflections = entry.reflections;
+			refraction.refractions = entry.refractions + 1;
+			refraction.ray.intensity = the_ray.intensity * material.k_refraction;
+			if (refraction.ray.intensity > this->threshold)
+			{
+				refraction.ray = GetRefractionRay(the_ray, final_mesh, best_t, best_i, material.k_refraction);
+			}
+			this->PushRay(stack, stack_top, refraction);
+		}
+		return color;
+	}
+
+	/*
+	Trace the ray through a pixel and record its first hit
+	Args:
+		u [double]: [the u of the pixel]
+		v [double]: [the v of the pixel]
+	Returns:
+		sample [PixelSample]: [the color and first hit of the pixel]
+	*/
+	PixelSample TracePixel(double u, double v)
+	{
+		PixelSample sample;
+		Ray the_ray = GetPixelRay(this->camera, u, v);
+		sample.color = this->TraceOneRay(the_ray, 1, &sample);
+		return sample;
+	}
+
+	/*
+	Trace a pixel in adaptive sampling if it is not traced yet
+	Args:
+		i [int]: [the x of the pixel]
+		j [int]: [the y of the pixel]
+	*/
+	void SamplePixel(int i, int j)
+	{
+		int place = j * this->camera.width + i;
+		if (this->pixel_traced[place] == 1)
+		{
+			return;
+		}
+		this->pixel_samples[place] = this->TracePixel(i, j);
+		this->pixel_traced[place] = 1;
+	}
+
+	/*
+	Judge whether the corners of a block are similar enough to interpolate the pixels between them
+	Args:
+		corners [PixelSample*], [4]: [the samples of the 4 corners]
+	Returns:
+		result [bool]: [whether the block can be interpolated or not]
+	*/
+	bool JudgeBlockSimilar(PixelSample** corners)
+	{
+		double min_depth = DBL_MAX;
+		double max_depth = -DBL_MAX;
+		for (int k = 0; k < 4; k++)
+		{
+			if (corners[k]->object_id != corners[0]->object_id)
+			{
+				return 0;
+			}
+			for (int c = 0; c < 3; c++)
+			{
+				if (fabs(corners[k]->color(c) - corners[0]->color(c)) > this->adaptive_color_threshold)
+				{
+					return 0;
+				}
+			}
+			min_depth = min(min_depth, corners[k]->depth);
+			max_depth = max(max_depth, corners[k]->depth);
+		}
+		if (corners[0]->object_id >= 0 && max_depth - min_depth > min_depth * this->adaptive_depth_threshold)
+		{
+			return 0;
+		}
+		return 1;
+	}
+
+	/*
+	Recursively refine a block in adaptive sampling, the corners are traced, 
+	the block is interpolated if the corners are similar, otherwise it is split into 4 sub blocks
+	Args:
+		x0 [int]: [the min x of the block]
+		y0 [int]: [the min y of the block]
+		x1 [int]: [the max x of the block]
+		y1 [int]: [the max y of the block]
+	*/
+	void RefineBlock(int x0, int y0, int x1, int y1)
+	{
+		int width = this->camera.width;
+		this->SamplePixel(x0, y0);
+		this->SamplePixel(x1, y0);
+		this->SamplePixel(x0, y1);
+		this->SamplePixel(x1, y1);
+		if (x1 - x0 <= 1 && y1 - y0 <= 1)
+		{
+			return;
+		}
+
+		PixelSample* corners[4] = { &this->pixel_samples[y0 * width + x0], &this->pixel_samples[y0 * width + x1],
+			&this->pixel_samples[y1 * width + x0], &this->pixel_samples[y1 * width + x1] };
+		if (this->JudgeBlockSimilar(corners))
+		{
+			for (int j = y0; j <= y1; j++)
+			{
+				double rate_y = double(j - y0) / double(y1 - y0);
+				for (int i = x0; i <= x1; i++)
+				{
+					int place = j * width + i;
+					if (this->pixel_traced[place] == 1)
+					{
+						continue;
+					}
+					double rate_x = double(i - x0) / double(x1 - x0);
+					Vector3d color_down = corners[0]->color * (1 - rate_x) + corners[1]->color * rate_x;
+					Vector3d color_up = corners[2]->color * (1 - rate_x) + corners[3]->color * rate_x;
+					this->pixel_samples[place].color = color_down * (1 - rate_y) + color_up * rate_y;
+					this->pixel_samples[place].object_id = corners[0]->object_id;
+					this->pixel_samples[place].face_id = corners[0]->face_id;
+					this->pixel_samples[place].depth = corners[0]->depth;
+				}
+			}
+			return;
+		}
+
+		//split the block, the sides of length 1 are not split
+		int mid_x = (x0 + x1) / 2;
+		int mid_y = (y0 + y1) / 2;
+		if (x1 - x0 <= 1)
+		{
+			this->RefineBlock(x0, y0, x1, mid_y);
+			this->RefineBlock(x0, mid_y, x1, y1);
+		}
+		else if (y1 - y0 <= 1)
+		{
+			this->RefineBlock(x0, y0, mid_x, y1);
+			this->RefineBlock(mid_x, y0, x1, y1);
+		}
+		else
+		{
+			this->RefineBlock(x0, y0, mid_x, mid_y);
+			this->RefineBlock(mid_x, y0, x1, mid_y);
+			this->RefineBlock(x0, mid_y, mid_x, y1);
+			this->RefineBlock(mid_x, mid_y, x1, y1);
+		}
+	}
+
+	/*
+	Trace the pixels of the camera with adaptive sampling, 
+	a sparse grid is traced first and only the differing blocks are refined, the rest are interpolated
+	Args:
+		target [array of Vector3d], [H * W]: [the result data, with the size of the camera]
+	*/
+	void RenderPictureAdaptive(Vector3d* target)
+	{
+		TRACE_SPAN("RenderPictureAdaptive", "trace");
+		int width = this->camera.width;
+		int height = this->camera.height;
+		this->pixel_samples.assign(width * height, PixelSample());
+		this->pixel_traced.assign(width * height, 0);
+
+		//the grid lines, the last row and column are always included
+		vector<int> grid_x;
+		vector<int> grid_y;
+		for (int i = 0; i < width - 1; i += this->adaptive_grid_size)
+		{
+			grid_x.push_back(i);
+		}
+		grid_x.push_back(width - 1);
+		for (int j = 0; j < height - 1; j += this->adaptive_grid_size)
+		{
+			grid_y.push_back(j);
+		}
+		grid_y.push_back(height - 1);
+
+		for (int b = 0; b + 1 < grid_y.size(); b++)
+		{
+			for (int a = 0; a + 1 < grid_x.size(); a++)
+			{
+				this->RefineBlock(grid_x[a], grid_y[b], grid_x[a + 1], grid_y[b + 1]);
+			}
+		}
+
+		int traced_num = 0;
+		for (int k = 0; k < width * height; k++)
+		{
+			target[k] = this->pixel_samples[k].color;
+			traced_num += this->pixel_traced[k];
+		}
+		this->traced_fraction = double(traced_num) / double(width * height);
+	}
+
+	/*
+	Reproject the first hits of the last frame into the current camera, each hit goes to its nearest pixel and the nearest hit wins,
+	a pixel reuses its hit and color only if its 4 neighbours also got hits of the same object at close depths,
+	so the disoccluded pixels and the pixels on the edges are traced, the first hits of the frame are kept for the next frame,
+	the misses are reprojected as directions at infinity behind all the hits
+	Args:
+		target [array of Vector3d], [H * W]: [the result data, with the size of the camera]
+	*/
+	void RenderPictureReprojected(Vector3d* target)
+	{
+		TRACE_SPAN("RenderPictureReprojected", "trace");
+		int width = this->camera.width;
+		int height = this->camera.height;
+		int total_size = width * height;
+		this->pixel_samples.assign(total_size, PixelSample());
+		this->pixel_traced.assign(total_size, 0);
+		this->reuse_sources.assign(total_size, -1);
+		this->reuse_depths.assign(total_size, DBL_MAX);
+		if (this->history_width != width || this->history_samples.size() != total_size)
+		{
+			this->history_width = 0;
+		}
+
+		//scatter the hits of the last frame, the nearest one is kept in each pixel
+		Matrix3d inverse_rotation = this->camera.rotation.transpose();
+		for (int k = 0; k < total_size && this->history_width > 0; k++)
+		{
+			if (this->history_ages[k] >= this->reuse_max_age)
+			{
+				continue;
+			}
+			bool miss = this->history_samples[k].object_id < 0;
+			Vector3d place = inverse_rotation * (miss ? this->history_positions[k] : 
+				Vector3d(this->history_positions[k] - this->camera.camera_position));
+			if (place(2) <= 0)
+			{
+				continue;
+			}
+			int i = int(floor(place(0) / place(2) * this->camera.fx + this->camera.cx + 0.5));
+			int j = int(floor(place(1) / place(2) * this->camera.fy + this->camera.cy + 0.5));
+			if (i < 0 || i >= width || j < 0 || j >= height)
+			{
+				continue;
+			}
+			double depth = miss ? FLT_MAX : place.norm();
+			if (depth < this->reuse_depths[j * width + i])
+			{
+				this->reuse_depths[j * width + i] = depth;
+				this->reuse_sources[j * width + i] = k;
+			}
+		}
+
+		//validate the reprojected hits with their neighbours and trace the rest
+		const int neighbour_x[4] = { -1, 1, 0, 0 };
+		const int neighbour_y[4] = { 0, 0, -1, 1 };
+		int traced_num = 0;
+		for (int j = 0; j < height; j++)
+		{
+			for (int i = 0; i < width; i++)
+			{
+				int place = j * width + i;
+				int source = this->reuse_sources[place];
+				bool valid = source >= 0;
+				for (int n = 0; n < 4 && valid; n++)
+				{
+					int x = i + neighbour_x[n];
+					int y = j + neighbour_y[n];
+					if (x < 0 || x >= width || y < 0 || y >= height)
+					{
+						continue;
+					}
+					int neighbour = this->reuse_sources[y * width + x];
+					valid = neighbour >= 0 && this->history_samples[neighbour].object_id == this->history_samples[source].object_id &&
+						fabs(this->reuse_depths[y * width + x] - this->reuse_depths[place]) <= this->reuse_depth_threshold * this->reuse_depths[place];
+				}
+				if (valid)
+				{
+					this->pixel_samples[place] = this->history_samples[source];
+					if (this->pixel_samples[place].object_id >= 0)
+					{
+						this->pixel_samples[place].depth = this->reuse_depths[place];
+					}
+				}
+				else
+				{
+					this->pixel_samples[place] = this->TracePixel(i, j);
+					this->pixel_traced[place] = 1;
+					traced_num++;
+				}
+				target[place] = this->pixel_samples[place].color;
+			}
+		}
+
+		//keep the first hits for the next frame, the reused pixels keep the hits they came from
+		vector<Vector3d> positions(total_size, Vector3d::Zero());
+		vector<int> ages(total_size, 0);
+		for (int j = 0; j < height; j++)
+		{
+			for (int i = 0; i < width; i++)
+			{
+				int place = j * width + i;
+				int source = this->reuse_sources[place];
+				if (this->pixel_traced[place] == 0)
+				{
+					positions[place] = this->history_positions[source];
+					ages[place] = this->history_ages[source] + 1;
+				}
+				else
+				{
+					Ray the_ray = GetPixelRay(this->camera, i, j);
+					positions[place] = this->pixel_samples[place].object_id >= 0 ? 
+						Vector3d(the_ray.start + the_ray.direction * this->pixel_samples[place].depth) : the_ray.direction;
+				}
+			}
+		}
+		this->history_positions.swap(positions);
+		this->history_ages.swap(ages);
+		this->history_samples = this->pixel_samples;
+		this->history_width = width;
+		this->traced_fraction = double(traced_num) / double(total_size);
+		this->reused_fraction = 1 - this->traced_fraction;
+	}
+
+	/*
+	Judge whether there is an edge between two pixel samples
+	Args:
+		a [PixelSample]: [the first sample]
+		b [PixelSample]: [the second sample]
+	Returns:
+		result [bool]: [whether there is a geometric or shading edge or not]
+	*/
+	bool JudgeEdge(PixelSample& a, PixelSample& b)
+	{
+		if (a.object_id != b.object_id)
+		{
+			return 1;
+		}
+		if (a.object_id >= 0 && a.face_id != b.face_id)
+		{
+			Vector3d normal_a = this->objects[a.object_id].GetFace(a.face_id).normal;
+			Vector3d normal_b = this->objects[b.object_id].GetFace(b.face_id).normal;
+			if (normal_a.dot(normal_b) < this->aa_normal_threshold)
+			{
+				return 1;
+			}
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			if (fabs(a.color(c) - b.color(c)) > this->aa_color_threshold)
+			{
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	/*
+	Add stratified samples to the edge pixels, the pixel samples of the first pass must be ready
+	Args:
+		target [array of Vector3d], [H * W]: [the result data, with the size of the camera]
+	*/
+	void AntialiasPicture(Vector3d* target)
+	{
+		TRACE_SPAN("AntialiasPicture", "shade");
+		int width = this->camera.width;
+		int height = this->camera.height;
+		this->pixel_edge.assign(width * height, 0);
+		for (int j = 0; j < height; j++)
+		{
+			for (int i = 0; i < width; i++)
+			{
+				int place = j * width + i;
+				if (i + 1 < width && this->JudgeEdge(this->pixel_samples[place], this->pixel_samples[place + 1]))
+				{
+					this->pixel_edge[place] = 1;
+					this->pixel_edge[place + 1] = 1;
+				}
+				if (j + 1 < height && this->JudgeEdge(this->pixel_samples[place], this->pixel_samples[place + width]))
+				{
+					this->pixel_edge[place] = 1;
+					this->pixel_edge[place + width] = 1;
+				}
+			}
+		}
+
+		//the extra samples are jittered in a n * n grid of strata, and averaged with the first sample
+		int strata = int(sqrt(double(max(this->aa_max_samples - 1, 0))));
+		int extra_num = 0;
+		if (strata > 0)
+		{
+			for (int j = 0; j < height; j++)
+			{
+				for (int i = 0; i < width; i++)
+				{
+					int place = j * width + i;
+					if (this->pixel_edge[place] == 0)
+					{
+						continue;
+					}
+					Vector3d color = this->pixel_samples[place].color;
+					for (int k = 0; k < strata * strata; k++)
+					{
+						double du = (k % strata + HashRandom(i, j, 2 * k)) / strata - 0.5;
+						double dv = (k / strata + HashRandom(i, j, 2 * k + 1)) / strata - 0.5;
+						Ray the_ray = GetPixelRay(this->camera, i + du, j + dv);
+						color = color + this->TraceOneRay(the_ray, 1);
+					}
+					target[place] = color / double(strata * strata + 1);
+					extra_num += strata * strata;
+				}
+			}
+		}
+		this->samples_per_pixel = this->traced_fraction + double(extra_num) / double(width * height);
+	}
+
+	/*
+	Trace one pixel, used in tracing all the pixels
+	Args:
+		i [int]: [the x of the pixel]
+		j [int]: [the y of the pixel]
+		record [bool]: [whether to record the first hit in the pixel samples or not]
+	Returns:
+		color [Vector3d]: [the color of the pixel]
+	*/
+	Vector3d TraceOnePixel(int i, int j, bool record)
+	{
+		int place = j * this->camera.width + i;
+		RenderCounters counters;
+		long long rays = this->traced_rays;
+		chrono::steady_clock::time_point start_time;
+		if (this->record_costs)
+		{
+			counters = ReadThreadRenderCounters();
+			start_time = chrono::steady_clock::now();
+		}
+
+		Vector3d color;
+		if (record)
+		{
+			this->pixel_samples[place] = this->TracePixel(i, j);
+			color = this->pixel_samples[place].color;
+		}
+		else
+		{
+			Ray the_ray = GetPixelRay(this->camera, i, j);
+			color = this->TraceOneRay(the_ray, 1);
+		}
+
+		if (this->record_costs)
+		{
+			RenderCounters counters_after = ReadThreadRenderCounters();
+			this->pixel_costs[COST_TRAVERSAL][place] = double(counters_after.nodes_visited - counters.nodes_visited);
+			this->pixel_costs[COST_TRIANGLES][place] = double(counters_after.triangle_tests - counters.triangle_tests);
+			this->pixel_costs[COST_SECONDARY][place] = double(max(this->traced_rays - rays - 1, 0LL));
+			this->pixel_costs[COST_TIME][place] = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+		}
+		return color;
+	}
+
+	/*
+	Trace the pixels of a tile into the tile buffer grouped by the first page their primary rays enter,
+	so the rays reading the same leaves follow each other and the pages are read once while resident,
+	the first page is found in the resident hierarchy without reading any page
+	Args:
+		x0 [int]: [the first column of the tile]
+		y0 [int]: [the first row of the tile]
+		x1 [int]: [the column after the tile]
+		y1 [int]: [the row after the tile]
+		record [bool]: [whether to record the first hits in the pixel samples or not]
+	*/
+	void TraceTileReordered(int x0, int y0, int x1, int y1, bool record)
+	{
+		this->tile_keys.clear();
+		for (int j = y0; j < y1; j++)
+		{
+			for (int i = x0; i < x1; i++)
+			{
+				Ray the_ray = GetPixelRay(this->camera, i, j);
+				int page_id = -1;
+				double t = DBL_MAX;
+				for (int k = 0; k < this->objects.size(); k++)
+				{
+					GetFirstPageRayOctNode(the_ray, this->objects[k].root, page_id, t);
+				}
+				this->tile_keys.push_back(make_pair(page_id, (j - y0) * this->tile_size + i - x0));
+			}
+		}
+		sort(this->tile_keys.begin(), this->tile_keys.end());
+		for (int k = 0; k < this->tile_keys.size(); k++)
+		{
+			int place = this->tile_keys[k].second;
+			this->tile_results[place] = this->TraceOnePixel(x0 + place % this->tile_size, y0 + place / this->tile_size, record);
+		}
+	}
+
+	/*
+	Trace the pixels of a tile into the tile buffer, grouped by page if the geometry is paged
+	Args:
+		x0 [int]: [the first column of the tile]
+		y0 [int]: [the first row of the tile]
+		x1 [int]: [the column after the tile]
+		y1 [int]: [the row after the tile]
+		record [bool]: [whether to record the first hits in the pixel samples or not]
+	*/
+	void TraceTile(int x0, int y0, int x1, int y1, bool record)
+	{
+		TRACE_SPAN("TraceTile", "trace", x0, y0);
+		if (this->paging && this->ray_reordering)
+		{
+			this->TraceTileReordered(x0, y0, x1, y1, record);
+			return;
+		}
+		for (int j = y0; j < y1; j++)
+		{
+			for (int i = x0; i < x1; i++)
+			{
+				this->tile_results[(j - y0) * this->tile_size + i - x0] = this->TraceOnePixel(i, j, record);
+			}
+		}
+	}
+
+	/*
+	Trace all the pixels one by one in the chosen pixel order
+	Args:
+		target [array of Vector3d], [H * W]: [the result data, with the size of the camera]
+		record [bool]: [whether to record the first hits in the pixel samples or not]
+	*/
+	void TraceAllPixels(Vector3d* target, bool record)
+	{
+		int width = this->camera.width;
+		int height = this->camera.height;
+		if (record)
+		{
+			this->pixel_samples.resize(width * height);
+		}
+		bool reordering = this->paging && this->ray_reordering;
+		bool sink_tiles = this->frame_sink.IsOpen() && this->frame_sink.mode == SINK_TILES;
+		if (this->pixel_order == ORDER_ROW && reordering == 0 && sink_tiles == 0)
+		{
+			TRACE_SPAN("TraceRows", "trace");
+			for (int j = 0; j < height; j++)
+			{
+				for (int i = 0; i < width; i++)
+				{
+					target[j * width + i] = this->TraceOnePixel(i, j, record);
+				}
+			}
+			return;
+		}
+
+		int tiles_x = (width + this->tile_size - 1) / this->tile_size;
+		vector<int> tiles = BuildTileOrder(width, height, this->tile_size, this->pixel_order);
+		this->tile_results.resize(this->tile_size * this->tile_size);
+		for (int k = 0; k < tiles.size(); k++)
+		{
+			int x0 = (tiles[k] % tiles_x) * this->tile_size;
+			int y0 = (tiles[k] / tiles_x) * this->tile_size;
+			int x1 = min(x0 + this->tile_size, width);
+			int y1 = min(y0 + this->tile_size, height);
+			auto tile_start = chrono::steady_clock::now();
+			this->TraceTile(x0, y0, x1, y1, record);
+			//the target stays row major, the adaptive sampling, the antialiasing, the temporal reuse, the resize and the savers
+			//all read the rows of the picture, and the copy of a row of the tile costs little next to tracing its pixels
+			for (int j = y0; j < y1; j++)
+			{
+				copy(this->tile_results.begin() + (j - y0) * this->tile_size,
+					this->tile_results.begin() + (j - y0) * this->tile_size + x1 - x0, target + j * width + x0);
+			}
+			if (sink_tiles)
+			{
+				this->frame_sink.PublishTile(this->tile_results.data(), this->tile_size, x0, y0, x1, y1, width, height,
+					chrono::duration<double>(chrono::steady_clock::now() - tile_start).count());
+			}
+		}
+	}
+
+	/*
+	Trace all the pixels of the camera
+	Args:
+		target [array of Vector3d], [H * W]: [the result data, with the size of the camera]
+	*/
+	void RenderPicture(Vector3d* target)
+	{
+		this->reused_fraction = 0;
+		if (this->temporal_reuse == 0 || this->adaptive_sampling)
+		{
+			this->history_width = 0;
+		}
+		if (this->adaptive_sampling)
+		{
+			this->RenderPictureAdaptive(target);
+		}
+		else if (this->temporal_reuse)
+		{
+			this->RenderPictureReprojected(target);
+		}
+		else
+		{
+			//the first pass of antialiasing needs the first hits
+			this->TraceAllPixels(target, this->antialiasing);
+			this->traced_fraction = 1;
+		}
+
+		if (this->antialiasing)
+		{
+			this->AntialiasPicture(target);
+		}
+		else
+		{
+			this->samples_per_pixel = this->traced_fraction;
+		}
+	}
+
+	/*
+	Choose the render size of the next frame according to the measured frame time, 
+	the cost is proportional to the pixel number, so the size is scaled by the square root of the time ratio
+	*/
+	void UpdateRenderSize()
+	{
+		//do not change the size if the frame time is close enough to the budget
+		if (this->frame_time <= 0 || fabs(this->frame_time - this->target_frame_time) < this->target_frame_time * 0.1)
+		{
+			return;
+		}
+		double scale = sqrt(this->target_frame_time / this->frame_time);
+		if (scale < 0.5)
+		{
+			scale = 0.5;
+		}
+		else if (scale > 2)
+		{
+			scale = 2;
+		}
+		int new_size = int(this->render_size * scale / this->render_size_step + 0.5) * this->render_size_step;
+		if (new_size < this->min_render_size)
+		{
+			new_size = this->min_render_size;
+		}
+		else if (new_size > this->picture_size)
+		{
+			new_size = this->picture_size;
+		}
+		this->render_size = new_size;
+	}
+
+	/*
+	Save the last frame, the picture is written on a background thread so the next frame can start at once
+	Args:
+		filename [string]: [the full saving place, the format is chosen by the extension]
+	*/
+	void SaveFrame(string filename)
+	{
+		this->picture_writer.Submit(this->results, filename, this->picture_size, this->picture_size);
+	}
+
+	/*
+	Render a frame with the cost of each pixel recorded, and save the picture with a false color map of each cost next to it,
+	as name_traversal.png, name_triangles.png, name_secondary.png and name_time.png for name.png,
+	each pixel is traced once at full size, so adaptive sampling, antialiasing, temporal reuse and dynamic resolution are off,
+	the 99th percentile of each cost is mapped to white so a few outliers do not darken the map,
+	the traversal and triangle maps need the render counters and are only written with ENABLE_RENDER_COUNTERS defined
+	Args:
+		filename [string]: [the full saving place of the picture]
+	*/
+	void RenderCostMaps(string filename)
+	{
+		bool old_options[4] = { this->adaptive_sampling, this->antialiasing, this->temporal_reuse, this->dynamic_resolution };
+		this->adaptive_sampling = 0;
+		this->antialiasing = 0;
+		this->temporal_reuse = 0;
+		this->dynamic_resolution = 0;
+		int total_size = this->picture_size * this->picture_size;
+		for (int k = 0; k < COST_MAP_NUM; k++)
+		{
+			this->pixel_costs[k].assign(total_size, 0);
+		}
+		this->record_costs = 1;
+		this->Main();
+		this->record_costs = 0;
+		this->adaptive_sampling = old_options[0];
+		this->antialiasing = old_options[1];
+		this->temporal_reuse = old_options[2];
+		this->dynamic_resolution = old_options[3];
+		SavePicture(this->results, filename, this->picture_size, this->picture_size);
+
+#ifdef ENABLE_RENDER_COUNTERS
+		int first_map = COST_TRAVERSAL;
+#else
+		int first_map = COST_SECONDARY;
+#endif
+		size_t dot = filename.find_last_of('.');
+		string stem = dot == string::npos ? filename : filename.substr(0, dot);
+		string extension = dot == string::npos ? ".png" : filename.substr(dot);
+		vector<Vector3d> colors(total_size);
+		for (int k = first_map; k < COST_MAP_NUM; k++)
+		{
+			vector<double> sorted_costs = this->pixel_costs[k];
+			int rank = min(int(total_size * 0.99), total_size - 1);
+			nth_element(sorted_costs.begin(), sorted_costs.begin() + rank, sorted_costs.end());
+			this->cost_scales[k] = sorted_costs[rank];
+			FalseColorPicture(this->pixel_costs[k].data(), total_size, this->cost_scales[k], colors.data());
+			SavePicture(colors.data(), stem + "_" + cost_map_names[k] + extension, this->picture_size, this->picture_size);
+		}
+	}
+
+	/*
+	Render every frame of a camera path, the first frame is traced fully and the others reuse the reprojected last frame,
+	the camera is put back after the path
+	Args:
+		path [CameraPath]: [the camera path]
+		prefix [string]: [the frames are saved as prefix_0000.png and so on, not saved if empty]
+		reuse [bool]: [whether to use temporal reprojection or not]
+	*/
+	void RenderCameraPath(CameraPath& path, string prefix, bool reuse)
+	{
+		bool old_reuse = this->temporal_reuse;
+		this->temporal_reuse = reuse;
+		this->history_width = 0;
+		this->sequence_stats.clear();
+		Camera old_camera = this->camera;
+		int frame_num = path.GetFrameNum();
+		for (int f = 0; f < frame_num; f++)
+		{
+			path.Apply(this->camera, f);
+			this->Main();
+			SequenceFrameStats stats;
+			stats.frame_time = this->frame_time;
+			stats.reused_fraction = this->reused_fraction;
+			stats.traced_rays = this->traced_rays;
+			this->sequence_stats.push_back(stats);
+			if (prefix.size() > 0)
+			{
+				char filename[16];
+				snprintf(filename, sizeof(filename), "_%04d.png", f);
+				this->SaveFrame(prefix + filename);
+			}
+		}
+		//the history was traced from the last frame of the path
+		this->camera = old_camera;
+		this->history_width = 0;
+		this->temporal_reuse = old_reuse;
+	}
+
+	/*
+	Rebuild the light index, the lighting caches and the shadow map if the scene changed
+	*/
+	void PrepareFrame()
+	{
+		TRACE_SPAN("PrepareFrame", "shade");
+		this->pager.ResetStats();
+		this->BuildLightIndex();
+		for (int i = 0; i < this->objects.size(); i++)
+		{
+			TRACE_SPAN("UpdateLightingCache", "shade");
+			UpdateLightingCache(this->light, this->objects[i], this->materials);
+		}
+		if (this->shadow_mapping)
+		{
+			TRACE_SPAN("UpdateShadowMap", "shade");
+			this->shadow_map.Update(this->light.direction, this->objects, this->materials);
+		}
+	}
+
+	/*
+	Render a picture of any size straight to a tiled TIFF file, each tile is traced, packed in the stream format
+	and queued to the writer, so the memory only holds the pending tiles,
+	the passes reading back the whole picture, adaptive sampling, antialiasing and dynamic resolution, are not used
+	Args:
+		filename [string]: [the full filename, .tif]
+		size [int]: [the width and height of the picture]
+	Returns:
+		result [bool]: [whether the picture is written or not]
+	*/
+	bool RenderToFile(string filename, int size)
+	{
+		TRACE_SPAN("RenderToFile", "output");
+		auto start_time = chrono::steady_clock::now();
+		this->traced_rays = 0;
+		this->pruned_rays = 0;
+		this->culled_lights = 0;
+		this->PrepareFrame();
+		TiledImageWriter writer;
+		if (!writer.Open(filename, size, size, this->tile_size, this->stream_format))
+		{
+			return 0;
+		}
+		int old_tile_size = this->tile_size;
+		this->tile_size = writer.tile_size;
+		this->camera.SetPictureSize(size);
+		this->tile_results.assign(this->tile_size * this->tile_size, Vector3d::Zero());
+
+		vector<int> tiles = BuildTileOrder(size, size, this->tile_size, this->pixel_order);
+		for (int k = 0; k < tiles.size(); k++)
+		{
+			int tile_x = tiles[k] % writer.tiles_x;
+			int tile_y = tiles[k] / writer.tiles_x;
+			int x0 = tile_x * this->tile_size;
+			int y0 = tile_y * this->tile_size;
+			int x1 = min(x0 + this->tile_size, size);
+			int y1 = min(y0 + this->tile_size, size);
+			this->TraceTile(x0, y0, x1, y1, 0);
+
+			//the edge tiles are padded with black
+			Framebuffer tile(this->tile_size, this->tile_size, this->stream_format);
+			for (int j = y0; j < y1; j++)
+			{
+				tile.StoreRow(0, j - y0, &this->tile_results[(j - y0) * this->tile_size], x1 - x0);
+			}
+			writer.WriteTile(tile_x, tile_y, tile);
+		}
+		bool result = writer.Close();
+
+		this->tile_size = old_tile_size;
+		this->camera.SetPictureSize(this->picture_size);
+		this->stream_peak_memory = (writer.max_pending + 1) * writer.tile_bytes;
+		this->stream_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+		this->UpdateMemoryUsage(this->stream_peak_memory);
+		return result;
+	}
+
+	/*
+	The main function of ray tracing
+	*/
+	void Main()
+	{
+		TRACE_SPAN("Frame", "frame");
+		auto start_time = chrono::steady_clock::now();
+		this->traced_rays = 0;
+		this->pruned_rays = 0;
+		this->culled_lights = 0;
+		GatherRenderCounters(); //drop the counts of the work between the frames
+		this->PrepareFrame();
+		if (this->dynamic_resolution == 0 || this->render_size >= this->picture_size)
+		{
+			this->camera.SetPictureSize(this->picture_size);
+			this->RenderPicture(this->results);
+		}
+		else
+		{
+			this->camera.SetPictureSize(this->render_size);
+			this->RenderPicture(this->render_results);
+			TRACE_SPAN("ResizePicture", "output");
+			ResizePicture(this->render_results, this->render_size, this->render_size, 
+				this->results, this->picture_size, this->picture_size);
+		}
+		auto end_time = chrono::steady_clock::now();
+		this->frame_time = chrono::duration<double>(end_time - start_time).count();
+		this->frame_sink.PublishFrame(this->results, this->picture_size, this->picture_size, this->frame_time);
+		this->frame_counters = GatherRenderCounters();
+		if (this->counter_file.is_open())
+		{
+			this->counter_file << this->frame_counters.ToJson(this->frame_count, this->frame_time) << endl;
+		}
+		this->frame_count++;
+		this->UpdateMemoryUsage();
+		if (this->dynamic_resolution)
+		{
+			this->UpdateRenderSize();
+		}
+		else
+		{
+			this->render_size = this->picture_size;
 		}
 	}
 };
\ No newline at end of file
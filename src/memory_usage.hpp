@@ -0,0 +1,133 @@
+//the memory accounting, the bytes held by each category are added and removed where the buffers grow and shrink,
+//each object keeps its own usage and the model samples the usage of the whole scene
+#pragma once
+#include "utils.hpp"
+using namespace std;
+#define MEMORY_GEOMETRY 0 //the faces of the objects and the resident pages
+#define MEMORY_HIERARCHY 1 //the octree nodes and the faces of their leaves
+#define MEMORY_TEXTURES 2 //the mip chains of the textures
+#define MEMORY_FRAMEBUFFER 3 //the pictures and the tiles of the frame
+#define MEMORY_SCRATCH 4 //the per pixel and per vertex buffers of the passes
+#define MEMORY_CATEGORY_NUM 5
+const string memory_category_names[MEMORY_CATEGORY_NUM] = { "geometry", "hierarchy", "textures", "framebuffer", "scratch" };
+
+class MemoryUsage
+{
+public:
+	size_t current[MEMORY_CATEGORY_NUM] = { 0 }; //the bytes held now
+	size_t peak[MEMORY_CATEGORY_NUM] = { 0 }; //the most bytes held by each category
+	size_t peak_total = 0; //the most bytes held by all the categories together
+
+	MemoryUsage() {}
+
+	/*
+	Count the bytes of a new allocation
+	Args:
+		category [int]: [the category of the allocation]
+		bytes [size_t]: [the size of the allocation]
+	*/
+	void Add(int category, size_t bytes)
+	{
+		this->current[category] += bytes;
+		this->peak[category] = max(this->peak[category], this->current[category]);
+		this->peak_total = max(this->peak_total, this->GetTotal());
+	}
+
+	/*
+	Count the bytes of a freed allocation
+	Args:
+		category [int]: [the category of the allocation]
+		bytes [size_t]: [the size of the allocation]
+	*/
+	void Remove(int category, size_t bytes)
+	{
+		this->current[category] -= min(bytes, this->current[category]);
+	}
+
+	/*
+	Replace the bytes of a category, used for the buffers measured as a whole
+	Args:
+		category [int]: [the category]
+		bytes [size_t]: [the bytes held now]
+	*/
+	void Set(int category, size_t bytes)
+	{
+		this->Remove(category, this->current[category]);
+		this->Add(category, bytes);
+	}
+
+	/*
+	Add the usage of a part, the peaks of the parts are added too,
+	which is an upper bound of the peak of the whole when the parts peak at different times
+	Args:
+		other [MemoryUsage]: [the usage of the part]
+	*/
+	void Merge(MemoryUsage& other)
+	{
+		for (int k = 0; k < MEMORY_CATEGORY_NUM; k++)
+		{
+			this->current[k] += other.current[k];
+			this->peak[k] += other.peak[k];
+		}
+		this->peak_total += other.peak_total;
+	}
+
+	/*
+	Take a new measure of the same usage, the peaks are kept if higher
+	Args:
+		other [MemoryUsage]: [the new measure]
+	*/
+	void Sample(MemoryUsage& other)
+	{
+		for (int k = 0; k < MEMORY_CATEGORY_NUM; k++)
+		{
+			this->current[k] = other.current[k];
+			this->peak[k] = max(this->peak[k], other.peak[k]);
+		}
+		this->peak_total = max(this->peak_total, other.peak_total);
+	}
+
+	/*
+	Get the bytes held by all the categories
+	Returns:
+		bytes [size_t]: [the bytes held now]
+	*/
+	size_t GetTotal()
+	{
+		size_t total = 0;
+		for (int k = 0; k < MEMORY_CATEGORY_NUM; k++)
+		{
+			total += this->current[k];
+		}
+		return total;
+	}
+
+	/*
+	Write the usage as one line, in MB
+	Returns:
+		text [string]: [the current and the peak of each category and of the total]
+	*/
+	string ToString()
+	{
+		ostringstream text;
+		for (int k = 0; k < MEMORY_CATEGORY_NUM; k++)
+		{
+			text << memory_category_names[k] << " " << this->current[k] / 1e6 << " (peak " << this->peak[k] / 1e6 << "), ";
+		}
+		text << "total " << this->GetTotal() / 1e6 << " (peak " << this->peak_total / 1e6 << ") MB";
+		return text.str();
+	}
+};
+
+/*
+Get the bytes allocated by a vector
+Args:
+	values [vector<T>]: [the vector]
+Returns:
+	bytes [size_t]: [the capacity in bytes]
+*/
+template <class T>
+size_t GetVectorBytes(vector<T>& values)
+{
+	return values.capacity() * sizeof(T);
+}
@@ -1,6 +1,8 @@
 //definition of the vertexs, triangle face and mesh models
 #pragma once
 #include "utils.hpp"
+#include "texture.hpp"
+#include "memory_usage.hpp"
 using namespace std;
 using namespace Eigen;
 using namespace cv;
@@ -10,19 +12,13 @@ class Vertex
 public:
 	Vector3d point;
 	Vector3d normal;
-	Vector3d ambient;
-	Vector3d diffuse;
-	Vector3d specular;
 	int id = -1;
 	Vertex() {}
-	Vertex(int id, Vector3d point, Vector3d normal, Vector3d ambient, Vector3d diffuse, Vector3d specular)
+	Vertex(int id, Vector3d point, Vector3d normal)
 	{
 		this->id = id;
 		this->point = point;
 		this->normal = normal / normal.norm();
-		this->ambient = ambient;
-		this->diffuse = diffuse;
-		this->specular = specular;
 	}
 };
 
@@ -32,10 +28,10 @@ public:
 	Vertex vertexs[3];
 	Vector3d normal;
 	int id = -1;
-	double k_reflection = 0;
-	double k_refraction = 0;
+	int texture_id = -1; //the first texture coordinate of the face in the material table, -1 if not textured
+	short material_id = 0; //the material of the face in the material table
 	TriangleMesh() {}
-	TriangleMesh(int id, Vertex& vertex_a, Vertex& vertex_b, Vertex& vertex_c, double k_reflection, double k_refraction)
+	TriangleMesh(int id, Vertex& vertex_a, Vertex& vertex_b, Vertex& vertex_c, int material_id)
 	{
 		this->id = id;
 		this->vertexs[0] = vertex_a;
@@ -43,230 +39,1163 @@ public:
 		this->vertexs[2] = vertex_c;
 		this->normal = (this->vertexs[0].normal + this->vertexs[1].normal + this->vertexs[2].normal) / 3;
 		this->normal = this->normal / this->normal.norm();
+		this->material_id = material_id;
+	}
+};
+
+#define CHANNEL_AMBIENT 0
+#define CHANNEL_DIFFUSE 1
+#define CHANNEL_SPECULAR 2
+
+//the material shared by faces, the textured channels are sampled from the texture at the hit point
+class Material
+{
+public:
+	Vector3d colors[3]; //the ambient, diffuse and specular weight
+	int texture_ids[3] = { -1, -1, -1 }; //the textures of the ambient, diffuse and specular in the texture cache, -1 if not textured
+	double k_reflection = 0;
+	double k_refraction = 0;
+	Material() 
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			this->colors[i] << 0, 0, 0;
+		}
+	}
+	Material(Vector3d& ambient, Vector3d& diffuse, Vector3d& specular, double k_reflection, double k_refraction)
+	{
+		this->colors[CHANNEL_AMBIENT] = ambient;
+		this->colors[CHANNEL_DIFFUSE] = diffuse;
+		this->colors[CHANNEL_SPECULAR] = specular;
 		this->k_reflection = k_reflection;
 		this->k_refraction = k_refraction;
 	}
 };
 
+//the materials of the scene, referred by the material id of each face
+class MaterialTable
+{
+public:
+	vector<Material> materials;
+	TextureCache textures;
+	vector<Vector2f> texture_uvs; //the texture coordinates of the textured faces, 3 vertexs for each face
+	int version = 0; //increased when a material changes
+
+	MaterialTable() {}
+
+	/*
+	Add a material to the table
+	Args:
+		material [Material]: [the new material]
+	Returns:
+		material_id [int]: [the id of the material]
+	*/
+	int AddMaterial(Material& material)
+	{
+		this->materials.push_back(material);
+		this->version++;
+		return this->materials.size() - 1;
+	}
+
+	/*
+	Change a material, all the faces using it are changed
+	Args:
+		material_id [int]: [the id of the material]
+		material [Material]: [the new material]
+	*/
+	void SetMaterial(int material_id, Material& material)
+	{
+		this->materials[material_id] = material;
+		this->version++;
+	}
+
+	/*
+	Move the materials and textures of another table into this table, used in loading objects concurrently
+	Args:
+		other [MaterialTable]: [the table the faces are loaded with]
+		faces [vector<TriangleMesh>]: [the faces referring to the other table, changed to refer to this table]
+	*/
+	void Merge(MaterialTable& other, vector<TriangleMesh>& faces)
+	{
+		vector<int> texture_ids = this->textures.Merge(other.textures);
+		int material_offset = this->materials.size();
+		int uv_offset = this->texture_uvs.size();
+		for (int i = 0; i < other.materials.size(); i++)
+		{
+			Material material = other.materials[i];
+			for (int k = 0; k < 3; k++)
+			{
+				if (material.texture_ids[k] >= 0)
+				{
+					material.texture_ids[k] = texture_ids[material.texture_ids[k]];
+				}
+			}
+			this->materials.push_back(material);
+		}
+		this->texture_uvs.insert(this->texture_uvs.end(), other.texture_uvs.begin(), other.texture_uvs.end());
+		for (int i = 0; i < faces.size(); i++)
+		{
+			faces[i].material_id += material_offset;
+			if (faces[i].texture_id >= 0)
+			{
+				faces[i].texture_id += uv_offset;
+			}
+		}
+		this->version++;
+	}
+
+	/*
+	Judge whether a channel of a face is sampled from a texture
+	Args:
+		face [TriangleMesh]: [the face]
+		channel [int]: [CHANNEL_AMBIENT, CHANNEL_DIFFUSE or CHANNEL_SPECULAR]
+	Returns:
+		result [bool]: [whether textured or not]
+	*/
+	bool IsTextured(TriangleMesh& face, int channel)
+	{
+		return face.texture_id >= 0 && this->materials[face.material_id].texture_ids[channel] >= 0;
+	}
+
+	/*
+	Get the constant color of a channel of a face, the textured channels are 0 as they are sampled at the hit point
+	Args:
+		face [TriangleMesh]: [the face]
+		channel [int]: [CHANNEL_AMBIENT, CHANNEL_DIFFUSE or CHANNEL_SPECULAR]
+	Returns:
+		color [Vector3d]: [the color weight]
+	*/
+	Vector3d GetColor(TriangleMesh& face, int channel)
+	{
+		if (this->IsTextured(face, channel))
+		{
+			return Vector3d::Zero();
+		}
+		return this->materials[face.material_id].colors[channel];
+	}
+
+	/*
+	Get the colors of all the channels at a hit point, the textures are sampled with the footprint of the ray
+	Args:
+		face [TriangleMesh]: [the face]
+		fraction [Vector3d]: [the fraction of the hit point on the face]
+		width [double]: [the width of the ray cone at the hit point]
+		colors [Vector3d*], [3]: [the ambient, diffuse and specular weight]
+	*/
+	void GetHitColors(TriangleMesh& face, Vector3d& fraction, double width, Vector3d* colors)
+	{
+		Material& material = this->materials[face.material_id];
+		if (face.texture_id < 0)
+		{
+			for (int channel = 0; channel < 3; channel++)
+			{
+				colors[channel] = material.colors[channel];
+			}
+			return;
+		}
+
+		//the footprint in texture coordinates is scaled by the ratio of the texture area and the face area
+		Vector2f* uvs = &this->texture_uvs[face.texture_id];
+		Vector2f uv = uvs[0] * float(fraction(0)) + uvs[1] * float(fraction(1)) + uvs[2] * float(fraction(2));
+		Vector3d edge_a = face.vertexs[1].point - face.vertexs[0].point;
+		Vector3d edge_b = face.vertexs[2].point - face.vertexs[0].point;
+		Vector2f uv_a = uvs[1] - uvs[0];
+		Vector2f uv_b = uvs[2] - uvs[0];
+		double area = edge_a.cross(edge_b).norm();
+		double uv_area = fabs(uv_a(0) * uv_b(1) - uv_a(1) * uv_b(0));
+		double footprint = 0;
+		if (area > 0)
+		{
+			footprint = width * sqrt(uv_area / area);
+		}
+		for (int channel = 0; channel < 3; channel++)
+		{
+			if (material.texture_ids[channel] < 0)
+			{
+				colors[channel] = material.colors[channel];
+				continue;
+			}
+			colors[channel] = this->textures.Sample(material.texture_ids[channel], uv, footprint).cast<double>();
+		}
+	}
+};
+
+
+class BoundingBox
+{
+public:
+	double min_x = 0;
+	double min_y = 0;
+	double min_z = 0;
+	double max_x = 0;
+	double max_y = 0;
+	double max_z = 0;
+	BoundingBox() {}
+	/*
+	Init a bounding box
+	Args:
+		min_x [double]: [the min x of the object]
+		min_y [double]: [the min y of the object]
+		min_z [double]: [the min z of the object]
+		max_x [double]: [the max x of the object]
+		max_y [double]: [the max y of the object]
+		max_z [double]: [the max z of the object]
+	*/
+	BoundingBox(double min_x, double min_y, double min_z, double max_x, double max_y, double max_z)
+	{
+		this->min_x = min_x;
+		this->min_y = min_y;
+		this->min_z = min_z;
+		this->max_x = max_x;
+		this->max_y = max_y;
+		this->max_z = max_z;
+	}
+
+	void Set(double min_x, double min_y, double min_z, double max_x, double max_y, double max_z)
+	{
+		this->min_x = min_x;
+		this->min_y = min_y;
+		this->min_z = min_z;
+		this->max_x = max_x;
+		this->max_y = max_y;
+		this->max_z = max_z;
+	}
+};
+
+//the parsing statistics of a mesh file
+class MeshLoadStats
+{
+public:
+	string filename;
+	size_t bytes = 0; //the size of the file
+	int threads = 0; //the number of parsing threads
+	double parse_time = 0; //the time of parsing the text into the vertex and face streams
+	double preprocess_time = 0; //the time of normalizing the points, generating the normals and getting the bounds
+	double total_time = 0; //the time of the whole loading
+	size_t peak_memory = 0; //the peak bytes held by the loader
+	int faces = 0; //the number of triangles
+	double build_time = 0; //the time of building the hierarchy of the object
+	double ready_time = 0; //the time from the start of the scene loading to the object being ready
+
+	/*
+	Get the parse throughput
+	Returns:
+		throughput [double]: [MB per second]
+	*/
+	double Throughput()
+	{
+		if (this->parse_time <= 0)
+		{
+			return 0;
+		}
+		return double(this->bytes) / 1e6 / this->parse_time;
+	}
+};
+
+#define PREPROCESS_MIN_POINTS (1 << 16) //the meshes with fewer points are preprocessed by one thread
+#define PREPROCESS_BLOCK_POINTS 4096 //the points of a block stay in the cache between the two reads of the statistics
+
+/*
+Run a task on the ranges of [0, count) split evenly among threads, the calling thread runs the last range
+Args:
+	count [int]: [the number of items]
+	thread_num [int]: [the number of ranges]
+	task [function<void(int, int, int)>]: [the task given the range id, the first item and the item after the range]
+*/
+void RunRanges(int count, int thread_num, function<void(int, int, int)> task)
+{
+	vector<thread> threads;
+	for (int i = 0; i < thread_num; i++)
+	{
+		int begin = int((long long)count * i / thread_num);
+		int end = int((long long)count * (i + 1) / thread_num);
+		if (i == thread_num - 1)
+		{
+			task(i, begin, end);
+		}
+		else
+		{
+			threads.push_back(thread(task, i, begin, end));
+		}
+	}
+	for (int i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+}
+
+/*
+Merge the statistics of two sets of points
+Args:
+	count [int]: [the number of points of the first set, updated to the merged set]
+	mean [Vector3d]: [the mean of the first set, updated to the merged set]
+	square_error [double]: [the sum of the squared distances to the mean of the first set, updated to the merged set]
+	other_count [int]: [the number of points of the second set]
+	other_mean [Vector3d]: [the mean of the second set]
+	other_square_error [double]: [the sum of the squared distances to the mean of the second set]
+*/
+void MergePointStatistics(int& count, Vector3d& mean, double& square_error, int other_count, Vector3d other_mean, 
+	double other_square_error)
+{
+	if (other_count == 0)
+	{
+		return;
+	}
+	Vector3d delta = other_mean - mean;
+	int new_count = count + other_count;
+	mean += delta * (double(other_count) / new_count);
+	square_error += other_square_error + delta.dot(delta) * (double(count) * other_count / new_count);
+	count = new_count;
+}
 
-Mat image;
 /*
-Texture Mapping function
+Normalize the points of a mesh to the center and the size, generate the smooth normals and get the bounds, in two parallel sweeps,
+the first sweep gets the mean and spread of each block of points and the area weighted normal and degrees of the triangles,
+the second sweep transforms the points, sums the normals of the triangles around each point and gets the bounds,
+the normals of a point are summed in the order of the triangles, so the result does not depend on the threads
 Args:
-	filename [string]: [the full filename of the texture file]
-	pixels [vector<Vector2d>]: [all the 2D pixel coordinates]
+	points [vector<Vector3d>]: [the points, transformed in place]
+	triangles [vector<int>], [3 * triangles]: [the point ids of the triangles, all valid]
+	normals [vector<Vector3d>*]: [if not NULL, filled with the smooth normal of each point, (0, 1, 0) if no triangle around]
+	size [double]: [the new standard deviation of the points to the center]
+	center [Vector3d]: [the new center of the points]
 Returns:
-	textures [vector<Vector3d>]: [the RGB color of all corresponding pixels in the texture picture]
+	bounding_box [BoundingBox]: [the bounds of the transformed points]
 */
-vector<Vector3d> TextureMapping(string filename, vector<Vector2d>& pixels)
+BoundingBox PreprocessMesh(vector<Vector3d>& points, vector<int>& triangles, vector<Vector3d>* normals, double size, Vector3d center)
 {
-	vector<Vector3d> textures;
-	textures.clear();
-	image = imread(filename);
-	int width = image.rows;
-	int height = image.cols;
-	for (int i = 0; i < pixels.size(); i++)
+	TRACE_SPAN("PreprocessMesh", "load");
+	int point_num = points.size();
+	int triangle_num = triangles.size() / 3;
+	int thread_num = max(1, min(GetTaskThreads(), point_num / PREPROCESS_MIN_POINTS));
+
+	//the first sweep, the statistics of each block are merged into its range and the ranges are merged after
+	vector<int> counts(thread_num, 0);
+	vector<Vector3d> means(thread_num, Vector3d::Zero());
+	vector<double> square_errors(thread_num, 0);
+	vector<Vector3d> face_normals(normals != NULL ? triangle_num : 0);
+	vector<atomic<int>> degrees(normals != NULL ? point_num + 1 : 0);
+	RunRanges(point_num, thread_num, [&](int range, int begin, int end)
 	{
-		double x_exact = pixels[i](0) * double(width) - 1;
-		double y_exact = pixels[i](1) * double(height) - 1;
-		if (x_exact <= 0.5)
+		for (int block = begin; block < end; block += PREPROCESS_BLOCK_POINTS)
 		{
-			x_exact = 0.51;
+			int block_end = min(block + PREPROCESS_BLOCK_POINTS, end);
+			Vector3d mean = Vector3d::Zero();
+			double square_error = 0;
+			for (int i = block; i < block_end; i++)
+			{
+				mean = mean + points[i];
+			}
+			mean = mean / double(block_end - block);
+			for (int i = block; i < block_end; i++)
+			{
+				Vector3d dist = mean - points[i];
+				square_error += dist.dot(dist);
+			}
+			MergePointStatistics(counts[range], means[range], square_errors[range], block_end - block, mean, square_error);
 		}
-		else if (x_exact >= width - 0.5)
+		if (normals == NULL)
 		{
-			x_exact = width - 0.51;
+			return;
 		}
-		if (y_exact <= 0.5)
+		int first = int((long long)triangle_num * range / thread_num);
+		int last = int((long long)triangle_num * (range + 1) / thread_num);
+		for (int i = first; i < last; i++)
 		{
-			y_exact = 0.51;
+			int* ids = &triangles[i * 3];
+			face_normals[i] = (points[ids[1]] - points[ids[0]]).cross(points[ids[2]] - points[ids[0]]);
+			for (int c = 0; c < 3; c++)
+			{
+				degrees[ids[c]].fetch_add(1, memory_order_relaxed);
+			}
 		}
-		else if (y_exact >= height - 0.5)
+	});
+	int count = 0;
+	Vector3d mean = Vector3d::Zero();
+	double square_error = 0;
+	for (int i = 0; i < thread_num; i++)
+	{
+		MergePointStatistics(count, mean, square_error, counts[i], means[i], square_errors[i]);
+	}
+	double std_error = sqrt(square_error / double(max(count, 1)));
+	if (std_error == 0)
+	{
+		std_error = 1;
+	}
+
+	//the triangles around each point, the offsets are the prefix sums of the degrees
+	vector<int> offsets;
+	vector<int> adjacency;
+	if (normals != NULL)
+	{
+		offsets.resize(point_num + 1, 0);
+		for (int i = 0; i < point_num; i++)
 		{
-			y_exact = height - 0.51;
+			offsets[i + 1] = offsets[i] + degrees[i].load(memory_order_relaxed);
+			degrees[i].store(offsets[i], memory_order_relaxed);
 		}
-		int x_up = round(x_exact);
-		int y_up = round(y_exact);
-		int x_down = x_up - 1;
-		int y_down = y_up - 1;
-		double rate_x = x_exact - x_down - 0.5;
-		double rate_y = y_exact - y_down - 0.5;
-		
-		Vector3d result;
-		for (int k = 0; k < 3; k++)
+		adjacency.resize(offsets[point_num]);
+		RunRanges(triangle_num, thread_num, [&](int range, int begin, int end)
+		{
+			for (int i = begin; i < end; i++)
+			{
+				for (int c = 0; c < 3; c++)
+				{
+					adjacency[degrees[triangles[i * 3 + c]].fetch_add(1, memory_order_relaxed)] = i;
+				}
+			}
+		});
+		normals->resize(point_num);
+	}
+
+	//the second sweep
+	vector<BoundingBox> bounds(thread_num);
+	RunRanges(point_num, thread_num, [&](int range, int begin, int end)
+	{
+		Vector3d low = Vector3d::Constant(DBL_MAX);
+		Vector3d high = Vector3d::Constant(-DBL_MAX);
+		for (int i = begin; i < end; i++)
+		{
+			Vector3d p = points[i];
+			p = p - mean;
+			p = p / std_error;
+			p = p * size;
+			p = p + center;
+			points[i] = p;
+			low = low.cwiseMin(p);
+			high = high.cwiseMax(p);
+			if (normals != NULL)
+			{
+				sort(adjacency.begin() + offsets[i], adjacency.begin() + offsets[i + 1]);
+				Vector3d normal = Vector3d::Zero();
+				for (int k = offsets[i]; k < offsets[i + 1]; k++)
+				{
+					normal += face_normals[adjacency[k]];
+				}
+				if (normal.norm() == 0)
+				{
+					normal << 0, 1, 0;
+				}
+				(*normals)[i] = normal;
+			}
+		}
+		bounds[range].Set(low(0), low(1), low(2), high(0), high(1), high(2));
+	});
+	BoundingBox bounding_box = bounds[0];
+	for (int i = 1; i < thread_num; i++)
+	{
+		bounding_box.Set(min(bounding_box.min_x, bounds[i].min_x), min(bounding_box.min_y, bounds[i].min_y),
+			min(bounding_box.min_z, bounds[i].min_z), max(bounding_box.max_x, bounds[i].max_x),
+			max(bounding_box.max_y, bounds[i].max_y), max(bounding_box.max_z, bounds[i].max_z));
+	}
+	return bounding_box;
+}
+
+
+#define PLY_ASCII 0
+#define PLY_BINARY_LITTLE_ENDIAN 1
+#define PLY_BINARY_BIG_ENDIAN 2
+#define PLY_INT8 0
+#define PLY_UINT8 1
+#define PLY_INT16 2
+#define PLY_UINT16 3
+#define PLY_INT32 4
+#define PLY_UINT32 5
+#define PLY_FLOAT32 6
+#define PLY_FLOAT64 7
+const int PLY_TYPE_SIZES[8] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+//a property declared in the ply header
+class PLYProperty
+{
+public:
+	string name;
+	int type = -1;
+	int count_type = -1; //the type of the count of a list property, -1 if not a list
+	int offset = 0; //the byte offset in a binary element without lists
+};
+
+//an element declared in the ply header, the properties are stored in the declared order
+class PLYElement
+{
+public:
+	string name;
+	int count = 0;
+	vector<PLYProperty> properties;
+	int stride = 0; //the bytes of one binary element, 0 if the element has lists
+
+	/*
+	Find a property of the element
+	Args:
+		name [string]: [the name of the property]
+	Returns:
+		property_id [int]: [the id of the property, -1 if not found]
+	*/
+	int Find(string name)
+	{
+		for (int i = 0; i < this->properties.size(); i++)
+		{
+			if (this->properties[i].name == name)
+			{
+				return i;
+			}
+		}
+		return -1;
+	}
+};
+
+/*
+Switch the type name of a ply property to the type id
+Args:
+	name [string]: [the type name, both "float" and "float32" styles are supported]
+Returns:
+	type [int]: [the type id, -1 if unknown]
+*/
+int GetPLYType(string name)
+{
+	const char* names[16] = { "char", "uchar", "short", "ushort", "int", "uint", "float", "double",
+		"int8", "uint8", "int16", "uint16", "int32", "uint32", "float32", "float64" };
+	for (int i = 0; i < 16; i++)
+	{
+		if (name == names[i])
+		{
+			return i % 8;
+		}
+	}
+	return -1;
+}
+
+/*
+Decode a binary value of a ply property
+Args:
+	data [const char*]: [the bytes of the value]
+	type [int]: [the type id]
+	swap [bool]: [whether the bytes are in big endian or not]
+Returns:
+	value [double]: [the value]
+*/
+inline double DecodePLYValue(const char* data, int type, bool swap)
+{
+	char bytes[8];
+	int size = PLY_TYPE_SIZES[type];
+	memcpy(bytes, data, size);
+	if (swap)
+	{
+		reverse(bytes, bytes + size);
+	}
+	switch (type)
+	{
+	case PLY_INT8: { int8_t value; memcpy(&value, bytes, 1); return value; }
+	case PLY_UINT8: { uint8_t value; memcpy(&value, bytes, 1); return value; }
+	case PLY_INT16: { int16_t value; memcpy(&value, bytes, 2); return value; }
+	case PLY_UINT16: { uint16_t value; memcpy(&value, bytes, 2); return value; }
+	case PLY_INT32: { int32_t value; memcpy(&value, bytes, 4); return value; }
+	case PLY_UINT32: { uint32_t value; memcpy(&value, bytes, 4); return value; }
+	case PLY_FLOAT32: { float value; memcpy(&value, bytes, 4); return value; }
+	default: { double value; memcpy(&value, bytes, 8); return value; }
+	}
+}
+
+/*
+Read the next value of a ply property and move forward
+Args:
+	p [const char*&]: [the current place]
+	end [const char*]: [the end of the data]
+	type [int]: [the type id]
+	format [int]: [PLY_ASCII, PLY_BINARY_LITTLE_ENDIAN or PLY_BINARY_BIG_ENDIAN]
+	value [double&]: [the result value]
+Returns:
+	result [bool]: [whether the value is read or not]
+*/
+inline bool ReadPLYValue(const char*& p, const char* end, int type, int format, double& value)
+{
+	if (format == PLY_ASCII)
+	{
+		return ReadNumber(p, end, value);
+	}
+	int size = PLY_TYPE_SIZES[type];
+	if (end - p < size)
+	{
+		return 0;
+	}
+	value = DecodePLYValue(p, type, format == PLY_BINARY_BIG_ENDIAN);
+	p += size;
+	return 1;
+}
+
+/*
+Read one item of a ply element, the scalar properties are stored in values, one list property is stored in list
+Args:
+	p [const char*&]: [the current place]
+	end [const char*]: [the end of the data]
+	element [PLYElement]: [the element]
+	format [int]: [the format of the file]
+	values [double*]: [the values of the properties in the declared order]
+	list_id [int]: [the property whose list is kept, -1 if none]
+	list [vector<int>]: [the kept list]
+Returns:
+	result [bool]: [whether the item is read or not]
+*/
+bool ReadPLYItem(const char*& p, const char* end, PLYElement& element, int format, double* values, int list_id, vector<int>& list)
+{
+	for (int k = 0; k < element.properties.size(); k++)
+	{
+		PLYProperty& property = element.properties[k];
+		if (property.count_type < 0)
+		{
+			if (!ReadPLYValue(p, end, property.type, format, values[k]))
+			{
+				return 0;
+			}
+			continue;
+		}
+		double count;
+		if (!ReadPLYValue(p, end, property.count_type, format, count))
+		{
+			return 0;
+		}
+		values[k] = count;
+		if (k == list_id)
 		{
-			double color_left_down = double(image.at<Vec3b>(y_down, x_down)[2 - k]) / 256.0;
-			double color_left_up = double(image.at<Vec3b>(y_up, x_down)[2 - k]) / 256.0;
-			double color_right_down = double(image.at<Vec3b>(y_down, x_up)[2 - k]) / 256.0;
-			double color_right_up = double(image.at<Vec3b>(y_up, x_up)[2 - k]) / 256.0;
-			double color_up = color_left_up * (1 - rate_x) + color_right_up * rate_x;
-			double color_down = color_left_down * (1 - rate_x) + color_right_down * rate_x;
-			double color = color_down * (1 - rate_y) + color_up * rate_y;
-			result(k) = color;
+			list.clear();
 		}
-		
-		textures.push_back(result);
+		for (int j = 0; j < int(count); j++)
+		{
+			double value;
+			if (!ReadPLYValue(p, end, property.type, format, value))
+			{
+				return 0;
+			}
+			if (k == list_id)
+			{
+				list.push_back(int(value));
+			}
+		}
+	}
+	return 1;
+}
+
+/*
+Report why a mesh file or a scene file cannot be read on the standard error, the mesh loaders then return no face
+Args:
+	filename [string]: [the filename]
+	line [int]: [the line of the error, 0 if the error is in a binary body or not on a line]
+	reason [string]: [the reason]
+*/
+void ReportMeshError(string filename, int line, string reason)
+{
+	cerr << filename;
+	if (line > 0)
+	{
+		cerr << ":" << line;
 	}
-	return textures;
+	cerr << ": " << reason << endl;
 }
 
+/*
+Report an item of a ply body that cannot be read
+Args:
+	filename [string]: [the filename]
+	format [int]: [the format of the body]
+	line_number [int]: [the lines read before the item, only used in ascii]
+	element [PLYElement]: [the element of the item]
+	item [int]: [the place of the item in the element]
+*/
+void ReportPLYItemError(string filename, int format, int line_number, PLYElement& element, int item)
+{
+	string reason = (format == PLY_ASCII ? "bad or missing " : "truncated ") + element.name + " " + to_string(item) + " of " +
+		to_string(element.count);
+	ReportMeshError(filename, format == PLY_ASCII ? line_number + 1 : 0, reason);
+}
 
 /*
-Read a ply mesh model
+Read a ply mesh model, the header decides the format and the properties,
+ascii and binary files with any property order, quads and polygons are supported,
+the polygons are split into triangle fans and the missing normals are computed from the faces
 Args:
 	filename [char*]: [the filename]
 	size [double]: [the new size of the mesh model]
 	center [Vector3d]: [the new center of the mesh model]
-	ambient [Vector3d]: [the ambient weight of the mesh model]
-	diffuse [Vector3d]: [the diffuse weight of the mesh model]
-	specular [Vector3d]: [the specular weight of the mesh model]
-	k_reflection [double]: [the reflection coefficient of the mesh model]
-	k_refraction [double]: [the refraction coefficient of the mesh model]
+	material_id [int]: [the material of the mesh model in the material table]
+	stats [MeshLoadStats*]: [if not NULL, record the parse time]
+	bounding_box [BoundingBox*]: [if not NULL, set to the bounds of the normalized vertexs]
 Returns:
 	faces [vector<TriangleMesh>]: [the faces]
 */
-vector<TriangleMesh> ReadPLYMesh(string filename, double size, Vector3d center,
-	Vector3d& ambient, Vector3d& diffuse, Vector3d& specular, double k_reflection, double k_refraction)
+vector<TriangleMesh> ReadPLYMesh(string filename, double size, Vector3d center, int material_id, MeshLoadStats* stats = NULL,
+	BoundingBox* bounding_box = NULL)
 {
-	
-	vector<Vertex> vertexs;
+	TRACE_SPAN("ReadPLYMesh", "load", filename);
+	auto start_time = chrono::steady_clock::now();
 	vector<TriangleMesh> faces;
-	vertexs.clear();
-	faces.clear();
-	int vertex_num = 0;
-	int face_num = 0;
+	MappedFile file;
+	if (!file.Open(filename))
+	{
+		ReportMeshError(filename, 0, "cannot open the file");
+		return faces;
+	}
+	size_t file_size = file.size;
+	const char* p = file.data;
+	const char* end = file.data + file.size;
 
-	ifstream infile;
-	infile.open(filename, ios::in);
+	//read the header
+	int format = PLY_ASCII;
+	vector<PLYElement> elements;
+	int line_number = 0; //the lines read, the ascii items are counted one on each line
 	while (1)
 	{
-		string line;
-		string vertex_line = "element vertex ";
-		string face_line = "element face ";
-		string end_line = "end_header";
-		getline(infile, line);
-		string substr_15 = line.substr(0, 15);
-		string substr_13 = line.substr(0, 13);
-		if (substr_15 == vertex_line)
+		const char* line_end = (const char*)memchr(p, '\n', end - p);
+		if (line_end == NULL)
+		{
+			ReportMeshError(filename, line_number + 1, "the header has no end_header");
+			return faces;
+		}
+		line_number++;
+		string line(p, line_end);
+		p = line_end + 1;
+		if (line.size() > 0 && line.back() == '\r')
 		{
-			string vertex_num_str = line.substr(15);
-			vertex_num = StringToInt(vertex_num_str);
+			line.pop_back();
 		}
-		else if (substr_13 == face_line)
+		istringstream words(line);
+		string head;
+		words >> head;
+		if (head == "format")
 		{
-			string face_num_str = line.substr(13);
-			face_num = StringToInt(face_num_str);
+			string name;
+			words >> name;
+			if (name == "binary_little_endian")
+			{
+				format = PLY_BINARY_LITTLE_ENDIAN;
+			}
+			else if (name == "binary_big_endian")
+			{
+				format = PLY_BINARY_BIG_ENDIAN;
+			}
+			else if (name != "ascii")
+			{
+				ReportMeshError(filename, line_number, "unsupported format " + name);
+				return faces;
+			}
+		}
+		else if (head == "element")
+		{
+			PLYElement element;
+			words >> element.name >> element.count;
+			elements.push_back(element);
+		}
+		else if (head == "property" && elements.size() > 0)
+		{
+			PLYProperty property;
+			string type;
+			words >> type;
+			if (type == "list")
+			{
+				string count_type;
+				words >> count_type >> type;
+				property.count_type = GetPLYType(count_type);
+				if (property.count_type < 0)
+				{
+					ReportMeshError(filename, line_number, "unsupported list count type " + count_type);
+					return faces;
+				}
+			}
+			property.type = GetPLYType(type);
+			if (property.type < 0)
+			{
+				ReportMeshError(filename, line_number, "unsupported property type " + type);
+				return faces;
+			}
+			words >> property.name;
+			elements.back().properties.push_back(property);
 		}
-		else if (line == end_line)
+		else if (head == "end_header")
 		{
 			break;
 		}
 	}
+	for (int i = 0; i < elements.size(); i++)
+	{
+		PLYElement& element = elements[i];
+		for (int k = 0; k < element.properties.size(); k++)
+		{
+			if (element.properties[k].count_type >= 0)
+			{
+				element.stride = 0;
+				break;
+			}
+			element.properties[k].offset = element.stride;
+			element.stride += PLY_TYPE_SIZES[element.properties[k].type];
+		}
+	}
 
-	//read the vertexs
+	//read the elements in the order of the file
 	vector<Vector3d> points;
 	vector<Vector3d> normals;
-	points.clear();
-	normals.clear();
-	for (int i = 0; i < vertex_num; i++)
+	vector<int> polygons; //the vertex number and the vertex ids of each polygon
+	bool has_normals = 0;
+	for (int i = 0; i < elements.size(); i++)
 	{
-		double x, y, z;
-		double nx, ny, nz;
-		infile >> x >> y >> z;
-		infile >> nx >> ny >> nz;
-		Vector3d new_point;
-		new_point << x, y, z;
-		Vector3d new_norm;
-		new_norm << nx, ny, nz;
-		points.push_back(new_point);
-		normals.push_back(new_norm);
-	}
-
-	//normalize the vertexs to the center
-	Vector3d mean;
-	mean << 0, 0, 0;
-	double square_error = 0;
-	for (int i = 0; i < vertex_num; i++)
+		PLYElement& element = elements[i];
+		vector<double> values(element.properties.size());
+		vector<int> list;
+		if (element.name == "vertex")
+		{
+			int place[6] = { element.Find("x"), element.Find("y"), element.Find("z"),
+				element.Find("nx"), element.Find("ny"), element.Find("nz") };
+			if (place[0] < 0 || place[1] < 0 || place[2] < 0)
+			{
+				ReportMeshError(filename, 0, "the vertex element has no x, y or z property");
+				return faces;
+			}
+			has_normals = place[3] >= 0 && place[4] >= 0 && place[5] >= 0;
+			points.resize(element.count);
+			normals.resize(element.count, Vector3d::Zero());
+			if (format != PLY_ASCII && element.stride > 0)
+			{
+				//fixed size binary vertexs are decoded in bulk by their offsets
+				if ((end - p) / element.stride < element.count)
+				{
+					ReportMeshError(filename, 0, "the body is truncated in the " + to_string(element.count) + " vertexs");
+					return faces;
+				}
+				bool swap = format == PLY_BINARY_BIG_ENDIAN;
+				PLYProperty* properties[6];
+				for (int k = 0; k < 6; k++)
+				{
+					properties[k] = place[k] >= 0 ? &element.properties[place[k]] : NULL;
+				}
+				for (int j = 0; j < element.count; j++)
+				{
+					const char* item = p + size_t(j) * element.stride;
+					for (int k = 0; k < 3; k++)
+					{
+						points[j](k) = DecodePLYValue(item + properties[k]->offset, properties[k]->type, swap);
+					}
+					if (has_normals)
+					{
+						for (int k = 0; k < 3; k++)
+						{
+							normals[j](k) = DecodePLYValue(item + properties[k + 3]->offset, properties[k + 3]->type, swap);
+						}
+					}
+				}
+				p += size_t(element.count) * element.stride;
+				continue;
+			}
+			for (int j = 0; j < element.count; j++)
+			{
+				if (!ReadPLYItem(p, end, element, format, values.data(), -1, list))
+				{
+					ReportPLYItemError(filename, format, line_number, element, j);
+					return faces;
+				}
+				line_number++;
+				points[j] << values[place[0]], values[place[1]], values[place[2]];
+				if (has_normals)
+				{
+					normals[j] << values[place[3]], values[place[4]], values[place[5]];
+				}
+			}
+		}
+		else if (element.name == "face")
+		{
+			int list_id = element.Find("vertex_indices");
+			if (list_id < 0)
+			{
+				list_id = element.Find("vertex_index");
+			}
+			for (int j = 0; j < element.count; j++)
+			{
+				if (!ReadPLYItem(p, end, element, format, values.data(), list_id, list))
+				{
+					ReportPLYItemError(filename, format, line_number, element, j);
+					return faces;
+				}
+				line_number++;
+				polygons.push_back(list.size());
+				polygons.insert(polygons.end(), list.begin(), list.end());
+			}
+		}
+		else if (format != PLY_ASCII && element.stride > 0)
+		{
+			if ((end - p) / element.stride < element.count)
+			{
+				ReportMeshError(filename, 0, "the body is truncated in the " + to_string(element.count) + " " + element.name + "s");
+				return faces;
+			}
+			p += size_t(element.count) * element.stride;
+		}
+		else
+		{
+			for (int j = 0; j < element.count; j++)
+			{
+				if (!ReadPLYItem(p, end, element, format, values.data(), -1, list))
+				{
+					ReportPLYItemError(filename, format, line_number, element, j);
+					return faces;
+				}
+				line_number++;
+			}
+		}
+	}
+	file.Close();
+	double parse_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+	int vertex_num = points.size();
+	if (vertex_num == 0)
 	{
-		mean = mean + points[i];
+		return faces;
 	}
-	mean = mean / double(vertex_num);
-	for (int i = 0; i < vertex_num; i++)
+
+	//split the polygons into triangle fans, the triangles with a missing point are dropped
+	auto preprocess_start = chrono::steady_clock::now();
+	vector<int> triangles;
+	int triangle_num = 0;
+	for (int i = 0; i < polygons.size(); i += polygons[i] + 1)
 	{
-		Vector3d dist = mean - points[i];
-		double error = dist.dot(dist);
-		square_error += error;
+		triangle_num += max(polygons[i] - 2, 0);
 	}
-	square_error = square_error / double(vertex_num);
-	double std_error = sqrt(square_error);
-	for (int i = 0; i < vertex_num; i++)
+	triangles.reserve(triangle_num * 3);
+	for (int i = 0; i < polygons.size(); i += polygons[i] + 1)
+	{
+		int* ids = &polygons[i + 1];
+		for (int k = 2; k < polygons[i]; k++)
+		{
+			if (ids[0] < 0 || ids[0] >= vertex_num || ids[k - 1] < 0 || ids[k - 1] >= vertex_num || ids[k] < 0 || ids[k] >= vertex_num)
+			{
+				continue;
+			}
+			triangles.push_back(ids[0]);
+			triangles.push_back(ids[k - 1]);
+			triangles.push_back(ids[k]);
+		}
+	}
+	size_t polygon_memory = polygons.capacity() * sizeof(int);
+	polygons = vector<int>();
+
+	//normalize the vertexs to the center, the missing normals are the area weighted normals of the faces around
+	BoundingBox point_bounds = PreprocessMesh(points, triangles, has_normals ? NULL : &normals, size, center);
+	if (has_normals)
+	{
+		for (int i = 0; i < vertex_num; i++)
+		{
+			if (normals[i].norm() == 0)
+			{
+				normals[i] << 0, 1, 0;
+			}
+		}
+	}
+	if (bounding_box != NULL)
 	{
-		Vector3d p = points[i];
-		p = p - mean;
-		p = p / std_error;
-		p = p * size;
-		p = p + center;
-		points[i] = p;
+		*bounding_box = point_bounds;
 	}
+	double preprocess_time = chrono::duration<double>(chrono::steady_clock::now() - preprocess_start).count();
 
 	//store the vertexs
+	vector<Vertex> vertexs;
+	vertexs.reserve(vertex_num);
 	for (int i = 0; i < vertex_num; i++)
 	{
-		Vertex new_vertex = Vertex(i, points[i], normals[i], ambient, diffuse, specular);
+		Vertex new_vertex = Vertex(i, points[i], normals[i]);
 		vertexs.push_back(new_vertex);
 	}
 
-	//read and store the faces
-	for (int i = 0; i < face_num; i++)
+	//store the faces
+	faces.reserve(triangles.size() / 3);
+	for (int i = 0; i < triangles.size(); i += 3)
 	{
-		int n, id_a, id_b, id_c;
-		infile >> n >> id_a >> id_b >> id_c;
-		
-		TriangleMesh new_face = TriangleMesh(i, vertexs[id_a], vertexs[id_b], vertexs[id_c], k_reflection, k_refraction);
+		TriangleMesh new_face = TriangleMesh(faces.size(), vertexs[triangles[i]], vertexs[triangles[i + 1]], vertexs[triangles[i + 2]],
+			material_id);
 		faces.push_back(new_face);
 	}
-	vertexs.clear();
-	normals.clear();
-	points.clear();
-	infile.close();
+	if (stats != NULL)
+	{
+		stats->filename = filename;
+		stats->bytes = file_size;
+		stats->threads = 1;
+		stats->parse_time = parse_time;
+		stats->preprocess_time = preprocess_time;
+		stats->total_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+		stats->peak_memory = (points.capacity() + normals.capacity()) * sizeof(Vector3d) + polygon_memory + triangles.capacity() * sizeof(int) +
+			vertexs.capacity() * sizeof(Vertex) + faces.capacity() * sizeof(TriangleMesh);
+	}
 	return faces;
 }
 
+#define OBJ_CHUNK_MIN_BYTES (1 << 20) //the files smaller than this are parsed by one thread
+
+//the vertex and face streams parsed from one chunk of an obj file
+class OBJChunk
+{
+public:
+	vector<Vector3d> points;
+	vector<Vector3d> normals;
+	vector<Vector2d> pixels;
+	vector<int> corners; //the raw vertex, pixel and normal ids of each corner, 0 if missing, negative if relative
+	vector<int> face_sizes; //the number of corners of each face
+	vector<int> face_counts; //the number of points, pixels and normals parsed before each face in the chunk
+	vector<pair<int, string>> mtl_changes; //the first face using each usemtl
+	string mtl_path;
+
+	/*
+	Get the bytes held by the chunk
+	Returns:
+		bytes [size_t]: [the bytes]
+	*/
+	size_t GetMemory()
+	{
+		return this->points.capacity() * sizeof(Vector3d) + this->normals.capacity() * sizeof(Vector3d) +
+			this->pixels.capacity() * sizeof(Vector2d) + (this->corners.capacity() + this->face_sizes.capacity() +
+			this->face_counts.capacity()) * sizeof(int);
+	}
+};
+
+/*
+Read the next word of a line
+Args:
+	p [const char*&]: [the current place, moved after the word]
+	end [const char*]: [the end of the line]
+Returns:
+	word [string]: [the word, empty if the line ends]
+*/
+string ReadOBJWord(const char*& p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+	{
+		p++;
+	}
+	const char* begin = p;
+	while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+	{
+		p++;
+	}
+	return string(begin, p);
+}
+
+/*
+Parse the lines of a chunk of an obj file
+Args:
+	begin [const char*]: [the first line of the chunk]
+	end [const char*]: [the end of the chunk, at a line break or the end of the file]
+	chunk [OBJChunk]: [the result streams]
+*/
+void ParseOBJChunk(const char* begin, const char* end, OBJChunk& chunk)
+{
+	const char* p = begin;
+	while (p < end)
+	{
+		const char* line_end = (const char*)memchr(p, '\n', end - p);
+		if (line_end == NULL)
+		{
+			line_end = end;
+		}
+		while (p < line_end && (*p == ' ' || *p == '\t'))
+		{
+			p++;
+		}
+		if (line_end - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			p += 2;
+			Vector3d point;
+			ReadNumber(p, line_end, point(0));
+			ReadNumber(p, line_end, point(1));
+			ReadNumber(p, line_end, point(2));
+			chunk.points.push_back(point);
+		}
+		else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 'n')
+		{
+			p += 2;
+			Vector3d normal;
+			ReadNumber(p, line_end, normal(0));
+			ReadNumber(p, line_end, normal(1));
+			ReadNumber(p, line_end, normal(2));
+			chunk.normals.push_back(normal);
+		}
+		else if (line_end - p >= 3 && p[0] == 'v' && p[1] == 't')
+		{
+			p += 2;
+			double px = 0;
+			double py = 0;
+			ReadNumber(p, line_end, px);
+			ReadNumber(p, line_end, py);
+			Vector2d pixel;
+			pixel << px, 1 - py;
+			chunk.pixels.push_back(pixel);
+		}
+		else if (line_end - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+		{
+			//each corner is v, v/t, v//n or v/t/n
+			p += 2;
+			int corner_num = 0;
+			while (1)
+			{
+				while (p < line_end && (*p == ' ' || *p == '\t' || *p == '\r'))
+				{
+					p++;
+				}
+				if (p >= line_end)
+				{
+					break;
+				}
+				int ids[3] = { 0, 0, 0 };
+				for (int k = 0; k < 3; k++)
+				{
+					from_chars_result result = from_chars(p, line_end, ids[k]);
+					p = result.ptr;
+					if (p >= line_end || *p != '/')
+					{
+						break;
+					}
+					p++;
+				}
+				while (p < line_end && *p != ' ' && *p != '\t' && *p != '\r')
+				{
+					p++;
+				}
+				chunk.corners.push_back(ids[0]);
+				chunk.corners.push_back(ids[1]);
+				chunk.corners.push_back(ids[2]);
+				corner_num++;
+			}
+			chunk.face_sizes.push_back(corner_num);
+			chunk.face_counts.push_back(chunk.points.size());
+			chunk.face_counts.push_back(chunk.pixels.size());
+			chunk.face_counts.push_back(chunk.normals.size());
+		}
+		else if (line_end - p >= 6 && strncmp(p, "usemtl", 6) == 0)
+		{
+			p += 6;
+			chunk.mtl_changes.push_back(make_pair(int(chunk.face_sizes.size()), ReadOBJWord(p, line_end)));
+		}
+		else if (line_end - p >= 6 && strncmp(p, "mtllib", 6) == 0)
+		{
+			p += 6;
+			chunk.mtl_path = ReadOBJWord(p, line_end);
+		}
+		p = line_end + 1;
+	}
+}
+
 /*
-Read a obj mesh model and texture mapping
+Read a obj mesh model and its materials, the file is split into chunks parsed in parallel,
+negative ids, polygons and missing pixel or normal ids are supported
 Args:
 	filename [char*]: [the filename]
 	size [double]: [the new size of the mesh model]
 	center [Vector3d]: [the new center of the mesh model]
 	k_reflection [double]: [the reflection coefficient of the mesh model]
 	k_refraction [double]: [the refraction coefficient of the mesh model]
+	materials [MaterialTable]: [the material table, the materials of the mtl file are added]
+	stats [MeshLoadStats*]: [if not NULL, record the parse throughput and the peak memory]
+	bounding_box [BoundingBox*]: [if not NULL, set to the bounds of the normalized vertexs]
+	chunk_num [int]: [the number of chunks, 0 to split by the size of the file and the threads of the task]
 Returns:
 	faces [vector<TriangleMesh>]: [the faces]
 */
-vector<TriangleMesh> ReadOBJMesh(string filename, double size, Vector3d center, double k_reflection, double k_refraction)
+vector<TriangleMesh> ReadOBJMesh(string filename, double size, Vector3d center, double k_reflection, double k_refraction,
+	MaterialTable& materials, MeshLoadStats* stats = NULL, BoundingBox* bounding_box = NULL, int chunk_num = 0)
 {
-	//store the information of faces
-	struct FaceInfo
-	{
-	public:
-		int av = 0, bv = 0, cv = 0; //vertex id
-		int an = 0, bn = 0, cn = 0; //normal id
-		int ap = 0, bp = 0, cp = 0; //pixel id
-		string mtl_name;
-		FaceInfo(int av, int ap, int an, int bv, int bp, int bn, int cv, int cp, int cn, string mtl_name)
-		{
-			this->av = av - 1;
-			this->ap = ap - 1;
-			this->an = an - 1;
-			this->bv = bv - 1;
-			this->bp = bp - 1;
-			this->bn = bn - 1;
-			this->cv = cv - 1;
-			this->cp = cp - 1;
-			this->cn = cn - 1;
-			this->mtl_name = mtl_name;
-		}
-	};
+	TRACE_SPAN("ReadOBJMesh", "load", filename);
 	//store the information of mtl
 	struct MTLInfo
 	{
@@ -277,16 +1206,7 @@ vector<TriangleMesh> ReadOBJMesh(string filename, double size, Vector3d center,
 		string ka_name;
 		string kd_name;
 		string ks_name;
-		MTLInfo() 
-		{
-			ka << 0, 0, 0;
-			kd << 0, 0, 0;
-			ks << 0, 0, 0;
-			ka_name = "";
-			kd_name = "";
-			ks_name = "";
-		}
-		void clear()
+		MTLInfo()
 		{
 			ka << 0, 0, 0;
 			kd << 0, 0, 0;
@@ -297,135 +1217,105 @@ vector<TriangleMesh> ReadOBJMesh(string filename, double size, Vector3d center,
 		}
 	};
 
-	//storage
+	auto start_time = chrono::steady_clock::now();
+	vector<TriangleMesh> faces;
+	MappedFile obj_file;
+	if (!obj_file.Open(filename))
+	{
+		ReportMeshError(filename, 0, "cannot open the file");
+		return faces;
+	}
+	size_t file_size = obj_file.size;
+
+	//split the file into chunks at line breaks and parse them in parallel
+	int thread_num = GetTaskThreads();
+	thread_num = max(1, min(thread_num, int(obj_file.size / OBJ_CHUNK_MIN_BYTES)));
+	if (chunk_num > 0)
+	{
+		thread_num = int(min(size_t(chunk_num), max(size_t(1), obj_file.size)));
+	}
+	vector<OBJChunk> chunks(thread_num);
+	vector<const char*> bounds(thread_num + 1);
+	const char* file_end = obj_file.data + obj_file.size;
+	bounds[0] = obj_file.data;
+	bounds[thread_num] = file_end;
+	for (int i = 1; i < thread_num; i++)
+	{
+		const char* p = obj_file.data + obj_file.size / thread_num * i;
+		const char* line_end = (const char*)memchr(p, '\n', file_end - p);
+		bounds[i] = max(bounds[i - 1], line_end == NULL ? file_end : line_end + 1);
+	}
+	vector<thread> threads;
+	for (int i = 1; i < thread_num; i++)
+	{
+		threads.push_back(thread(ParseOBJChunk, bounds[i], bounds[i + 1], ref(chunks[i])));
+	}
+	ParseOBJChunk(bounds[0], bounds[1], chunks[0]);
+	for (int i = 0; i < threads.size(); i++)
+	{
+		threads[i].join();
+	}
+	obj_file.Close();
+	double parse_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+	//merge the vertex streams, the ids of each chunk are offset by the streams before it
 	vector<Vector3d> points;
 	vector<Vector3d> normals;
 	vector<Vector2d> pixels;
-	vector<FaceInfo> face_infos;
-	vector<TriangleMesh> faces;
-	map<string, MTLInfo> mtl_infos;
-	map<string, vector<Vector3d>> textures;
-	points.clear();
-	normals.clear();
-	pixels.clear();
-	face_infos.clear();
-	mtl_infos.clear();
-	textures.clear();
-	faces.clear();
+	vector<int> offsets(thread_num * 3, 0);
+	size_t point_num = 0, pixel_num = 0, normal_num = 0, face_num = 0;
 	string mtl_path;
-	string mtl_name;
-
-	//headers
-	string mtllib = "mtllib";
-	string usemtl = "usemtl";
-	string v = "v";
-	string vn = "vn";
-	string vt = "vt";
-	string f = "f";
-	string empty = "";
-	string eof = " End of File";
-	string newmtl = "newmtl";
-	string Ka = "Ka";
-	string Kd = "Kd";
-	string Ks = "Ks";
-	string map_Ka = "map_Ka";
-	string map_Kd = "map_Kd";
-	string map_Ks = "map_Ks";
-
-
-    //read obj
-	ifstream obj_file;
-	obj_file.open(filename, ios::in);
-	while (obj_file.peek() != EOF)
+	for (int i = 0; i < thread_num; i++)
 	{
-		string head;
-		obj_file >> head;
-		if (head == mtllib)
-		{
-			obj_file >> mtl_path;
-		}
-		else if (head == usemtl)
-		{
-			obj_file >> mtl_name;
-		}
-		else if (head == v)
-		{
-			double x, y, z;
-			obj_file >> x >> y >> z;
-			Vector3d point;
-			point << x, y, z;
-			points.push_back(point);
-		}
-		else if (head == vn)
+		offsets[i * 3] = point_num;
+		offsets[i * 3 + 1] = pixel_num;
+		offsets[i * 3 + 2] = normal_num;
+		point_num += chunks[i].points.size();
+		pixel_num += chunks[i].pixels.size();
+		normal_num += chunks[i].normals.size();
+		face_num += chunks[i].face_sizes.size();
+		if (chunks[i].mtl_path != "")
 		{
-			double nx, ny, nz;
-			obj_file >> nx >> ny >> nz;
-			Vector3d normal;
-			normal << nx, ny, nz;
-			normals.push_back(normal);
-		}
-		else if (head == vt)
-		{
-			double px, py;
-			obj_file >> px >> py;
-			Vector2d pixel;
-			pixel << px, 1 - py;
-			pixels.push_back(pixel);
-		}
-		else if (head == f)
-		{
-			char s;
-			int av, ap, an, bv, bp, bn, cv, cp, cn;
-			obj_file >> av >> s >> ap >> s >> an >> bv >> s >> bp >> s >> bn >> cv >> s >> cp >> s >> cn;
-			FaceInfo face_info(av, ap, an, bv, bp, bn, cv, cp, cn, mtl_name);
-			face_infos.push_back(face_info);
-		}
-		else
-		{
-			string line;
-			getline(obj_file, line);
+			mtl_path = chunks[i].mtl_path;
 		}
 	}
-	obj_file.close();
-
-	//normalize the vertexs to the center
-	Vector3d mean;
-	mean << 0, 0, 0;
-	double square_error = 0;
-	for (int i = 0; i < points.size(); i++)
+	points.reserve(point_num);
+	normals.reserve(normal_num);
+	pixels.reserve(pixel_num);
+	for (int i = 0; i < thread_num; i++)
 	{
-		mean = mean + points[i];
+		points.insert(points.end(), chunks[i].points.begin(), chunks[i].points.end());
+		normals.insert(normals.end(), chunks[i].normals.begin(), chunks[i].normals.end());
+		pixels.insert(pixels.end(), chunks[i].pixels.begin(), chunks[i].pixels.end());
 	}
-	mean = mean / double(points.size());
-	for (int i = 0; i < points.size(); i++)
+	size_t chunk_memory = 0;
+	for (int i = 0; i < thread_num; i++)
 	{
-		Vector3d dist = mean - points[i];
-		double error = dist.dot(dist);
-		square_error += error;
+		chunk_memory += chunks[i].GetMemory();
+		chunks[i].points = vector<Vector3d>();
+		chunks[i].normals = vector<Vector3d>();
+		chunks[i].pixels = vector<Vector2d>();
 	}
-	square_error = square_error / double(points.size());
-	double std_error = sqrt(square_error);
-	for (int i = 0; i < points.size(); i++)
+	if (point_num == 0)
 	{
-		Vector3d p = points[i];
-		p = p - mean;
-		p = p / std_error;
-		p = p * size;
-		p = p + center;
-		points[i] = p;
+		return faces;
 	}
 
-
-	//read mtl
+	//read mtl, the mtl and texture files are in the folder of the obj file
+	string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+	map<string, MTLInfo> mtl_infos;
 	ifstream mtl_file;
-	string mtl_filename = "res\\" + mtl_path;
-	mtl_file.open(mtl_filename);
+	string mtl_filename = directory + mtl_path;
+	if (mtl_path != "")
+	{
+		mtl_file.open(mtl_filename);
+	}
 	string current_name = "";
-	while (mtl_file.peek() != EOF)
+	while (mtl_file.is_open() && mtl_file.peek() != EOF)
 	{
 		string head;
 		mtl_file >> head;
-		if (head == newmtl)
+		if (head == "newmtl")
 		{
 			string name;
 			mtl_file >> name;
@@ -433,187 +1323,222 @@ vector<TriangleMesh> ReadOBJMesh(string filename, double size, Vector3d center,
 			MTLInfo new_mtl;
 			mtl_infos[current_name] = new_mtl;
 		}
-		else if (head == Ka)
+		else if (head == "Ka")
 		{
 			double r, g, b;
-			Vector3d ka;
 			mtl_file >> r >> g >> b;
-			ka << r, g, b;
-			mtl_infos[current_name].ka = ka;
+			mtl_infos[current_name].ka << r, g, b;
 		}
-		else if (head == Kd)
+		else if (head == "Kd")
 		{
 			double r, g, b;
-			Vector3d kd;
 			mtl_file >> r >> g >> b;
-			kd << r, g, b;
-			mtl_infos[current_name].kd = kd;
+			mtl_infos[current_name].kd << r, g, b;
 		}
-		else if (head == Ks)
+		else if (head == "Ks")
 		{
 			double r, g, b;
-			Vector3d ks;
 			mtl_file >> r >> g >> b;
-			ks << r, g, b;
-			mtl_infos[current_name].ks = ks;
+			mtl_infos[current_name].ks << r, g, b;
 		}
-		else if (head == map_Ka)
+		else if (head == "map_Ka")
 		{
-			string name;
-			mtl_file >> name;
-			mtl_infos[current_name].ka_name = name;
-			vector<Vector3d> v;
-			v.clear();
-			textures[name] = v;
+			mtl_file >> mtl_infos[current_name].ka_name;
 		}
-		else if (head == map_Kd)
+		else if (head == "map_Kd")
 		{
-			string name;
-			mtl_file >> name;
-			mtl_infos[current_name].kd_name = name;
-			vector<Vector3d> v;
-			v.clear();
-			textures[name] = v;
+			mtl_file >> mtl_infos[current_name].kd_name;
 		}
-		else if (head == map_Ks)
+		else if (head == "map_Ks")
 		{
-			string name;
-			mtl_file >> name;
-			mtl_infos[current_name].ks_name = name;
-			vector<Vector3d> v;
-			v.clear();
-			textures[name] = v;
+			mtl_file >> mtl_infos[current_name].ks_name;
 		}
 		else
 		{
 			string line;
-			getline(obj_file, line);
+			getline(mtl_file, line);
 		}
 	}
 	mtl_file.close();
 
 
-	//read all the textures
-	vector<string> texture_names;
-	texture_names.clear();
-	for (auto it : textures) 
-	{
-		string texture_name = it.first;
-		texture_names.push_back(texture_name);
-	}
-	for (int i = 0; i < texture_names.size(); i++)
-	{
-		string texture_path = "res\\" + texture_names[i];
-		textures[texture_names[i]] = TextureMapping(texture_path, pixels);
-	}
-	texture_names.clear();
-
-
-	//build the vertexs and faces
-	for (int i = 0; i < face_infos.size(); i++)
-	{
-		FaceInfo face_info = face_infos[i];
-		Vector3d point_a = points[face_info.av];
-		Vector3d point_b = points[face_info.bv];
-		Vector3d point_c = points[face_info.cv];
-		Vector3d normal_a = normals[face_info.an];
-		Vector3d normal_b = normals[face_info.bn];
-		Vector3d normal_c = normals[face_info.cn];
-		string mtl_name = face_info.mtl_name;
-		MTLInfo mtl_info = mtl_infos[mtl_name];
-		Vector3d ka_a = mtl_info.ka;
-		Vector3d ka_b = mtl_info.ka;
-		Vector3d ka_c = mtl_info.ka;
-		Vector3d kd_a = mtl_info.kd;
-		Vector3d kd_b = mtl_info.kd;
-		Vector3d kd_c = mtl_info.kd;
-		Vector3d ks_a = mtl_info.ks;
-		Vector3d ks_b = mtl_info.ks; 
-		Vector3d ks_c = mtl_info.ks;
-		string ka_name = mtl_info.ka_name;
-		string kd_name = mtl_info.kd_name;
-		string ks_name = mtl_info.ks_name;
-		if (ka_name != "")
-		{
-			vector<Vector3d> ka_list = textures[ka_name];
-			ka_a = ka_list[face_info.ap];
-			ka_b = ka_list[face_info.bp];
-			ka_c = ka_list[face_info.cp];
-		}
-		if (kd_name != "")
-		{
-			vector<Vector3d> kd_list = textures[kd_name];
-			kd_a = kd_list[face_info.ap];
-			kd_b = kd_list[face_info.bp];
-			kd_c = kd_list[face_info.cp];
-		}
-		if (ks_name != "")
-		{
-			vector<Vector3d> ks_list = textures[ks_name];
-			ks_a = ks_list[face_info.ap];
-			ks_b = ks_list[face_info.bp];
-			ks_c = ks_list[face_info.cp];
-		}
-		Vertex a = Vertex(face_info.av, point_a, normal_a, ka_a, kd_a, ks_a);
-		Vertex b = Vertex(face_info.bv, point_b, normal_b, ka_b, kd_b, ks_b);
-		Vertex c = Vertex(face_info.cv, point_c, normal_c, ka_c, kd_c, ks_c);
-		TriangleMesh face = TriangleMesh(i, a, b, c, k_reflection, k_refraction);
-		faces.push_back(face);
-	}
-
-
-	//clear and return
-	points.clear();
-	normals.clear();
-	pixels.clear();
-	face_infos.clear();
-	mtl_infos.clear();
-	textures.clear();
-	return faces;
-}
+	//add the materials to the material table, each texture file is decoded once by the texture cache
+	map<string, int> material_ids;
+	for (auto it : mtl_infos)
+	{
+		MTLInfo& mtl_info = it.second;
+		Material material(mtl_info.ka, mtl_info.kd, mtl_info.ks, k_reflection, k_refraction);
+		string texture_names[3] = { mtl_info.ka_name, mtl_info.kd_name, mtl_info.ks_name };
+		for (int k = 0; k < 3; k++)
+		{
+			if (texture_names[k] != "")
+			{
+				material.texture_ids[k] = materials.textures.Load(directory + texture_names[k]);
+			}
+		}
+		material_ids[it.first] = materials.AddMaterial(material);
+	}
+	if (material_ids.find("") == material_ids.end())
+	{
+		Material material;
+		material.k_reflection = k_reflection;
+		material.k_refraction = k_refraction;
+		material_ids[""] = materials.AddMaterial(material);
+	}
 
+	//resolve the ids of the corners, 1 based, negative ids count back from the streams before the face
+	vector<int> corners;
+	vector<int> face_sizes;
+	vector<int> face_materials;
+	corners.reserve(face_num * 9);
+	face_sizes.reserve(face_num);
+	face_materials.reserve(face_num);
+	int stream_sizes[3] = { int(point_num), int(pixel_num), int(normal_num) };
+	int material_id = material_ids[""];
+	bool missing_normals = 0;
+	for (int i = 0; i < thread_num; i++)
+	{
+		OBJChunk& chunk = chunks[i];
+		int change = 0;
+		int corner = 0;
+		for (int j = 0; j < chunk.face_sizes.size(); j++)
+		{
+			while (change < chunk.mtl_changes.size() && chunk.mtl_changes[change].first == j)
+			{
+				auto it = material_ids.find(chunk.mtl_changes[change].second);
+				material_id = it == material_ids.end() ? material_ids[""] : it->second;
+				change++;
+			}
+			bool valid = chunk.face_sizes[j] >= 3;
+			int first_corner = corners.size();
+			for (int c = 0; c < chunk.face_sizes[j]; c++, corner++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					int id = chunk.corners[corner * 3 + k];
+					if (id > 0)
+					{
+						id = id - 1;
+					}
+					else if (id < 0)
+					{
+						id = offsets[i * 3 + k] + chunk.face_counts[j * 3 + k] + id;
+					}
+					else
+					{
+						id = -1;
+					}
+					if (id >= stream_sizes[k])
+					{
+						id = -1;
+					}
+					if (k == 0 && id < 0)
+					{
+						valid = 0;
+					}
+					corners.push_back(id);
+				}
+				missing_normals = missing_normals || corners.back() < 0;
+			}
+			if (!valid)
+			{
+				corners.resize(first_corner);
+				continue;
+			}
+			face_sizes.push_back(chunk.face_sizes[j]);
+			face_materials.push_back(material_id);
+		}
+		//the changes after the last face of the chunk apply to the faces of the next chunks
+		for (; change < chunk.mtl_changes.size(); change++)
+		{
+			auto it = material_ids.find(chunk.mtl_changes[change].second);
+			material_id = it == material_ids.end() ? material_ids[""] : it->second;
+		}
+	}
+	size_t peak_memory = chunk_memory + points.capacity() * sizeof(Vector3d) + normals.capacity() * sizeof(Vector3d) +
+		pixels.capacity() * sizeof(Vector2d) + (corners.capacity() + face_sizes.capacity() + face_materials.capacity()) * sizeof(int);
+	chunks.clear();
 
+	//normalize the vertexs to the center, the missing normals are the area weighted normals of the faces around,
+	//the polygons are split into triangle fans
+	auto preprocess_start = chrono::steady_clock::now();
+	size_t triangle_num = 0;
+	for (int i = 0; i < face_sizes.size(); i++)
+	{
+		triangle_num += face_sizes[i] - 2;
+	}
+	vector<int> triangles;
+	vector<Vector3d> point_normals;
+	if (missing_normals)
+	{
+		triangles.reserve(triangle_num * 3);
+		for (int i = 0, corner = 0; i < face_sizes.size(); corner += face_sizes[i], i++)
+		{
+			int* ids = &corners[corner * 3];
+			for (int k = 2; k < face_sizes[i]; k++)
+			{
+				triangles.push_back(ids[0]);
+				triangles.push_back(ids[(k - 1) * 3]);
+				triangles.push_back(ids[k * 3]);
+			}
+		}
+	}
+	BoundingBox point_bounds = PreprocessMesh(points, triangles, missing_normals ? &point_normals : NULL, size, center);
+	if (bounding_box != NULL)
+	{
+		*bounding_box = point_bounds;
+	}
+	size_t triangle_memory = triangles.capacity() * sizeof(int);
+	triangles = vector<int>();
+	double preprocess_time = chrono::duration<double>(chrono::steady_clock::now() - preprocess_start).count();
 
-class BoundingBox
-{
-public:
-	double min_x = 0;
-	double min_y = 0;
-	double min_z = 0;
-	double max_x = 0;
-	double max_y = 0;
-	double max_z = 0;
-	BoundingBox() {}
-	/*
-	Init a bounding box
-	Args:
-		min_x [double]: [the min x of the object]
-		min_y [double]: [the min y of the object]
-		min_z [double]: [the min z of the object]
-		max_x [double]: [the max x of the object]
-		max_y [double]: [the max y of the object]
-		max_z [double]: [the max z of the object]
-	*/
-	BoundingBox(double min_x, double min_y, double min_z, double max_x, double max_y, double max_z)
+	//build the vertexs and faces, only the textured faces with all the pixel ids store texture coordinates
+	faces.reserve(triangle_num);
+	for (int i = 0, corner = 0; i < face_sizes.size(); corner += face_sizes[i], i++)
 	{
-		this->min_x = min_x;
-		this->min_y = min_y;
-		this->min_z = min_z;
-		this->max_x = max_x;
-		this->max_y = max_y;
-		this->max_z = max_z;
+		Material& material = materials.materials[face_materials[i]];
+		bool textured = material.texture_ids[CHANNEL_AMBIENT] >= 0 || material.texture_ids[CHANNEL_DIFFUSE] >= 0 ||
+			material.texture_ids[CHANNEL_SPECULAR] >= 0;
+		Vertex vertexs[3];
+		for (int k = 2; k < face_sizes[i]; k++)
+		{
+			int* ids[3] = { &corners[corner * 3], &corners[(corner + k - 1) * 3], &corners[(corner + k) * 3] };
+			for (int c = 0; c < 3; c++)
+			{
+				Vector3d normal = ids[c][2] >= 0 ? normals[ids[c][2]] : point_normals[ids[c][0]];
+				vertexs[c] = Vertex(ids[c][0], points[ids[c][0]], normal);
+			}
+			TriangleMesh face = TriangleMesh(faces.size(), vertexs[0], vertexs[1], vertexs[2], face_materials[i]);
+			if (textured && ids[0][1] >= 0 && ids[1][1] >= 0 && ids[2][1] >= 0)
+			{
+				face.texture_id = materials.texture_uvs.size();
+				for (int c = 0; c < 3; c++)
+				{
+					materials.texture_uvs.push_back(pixels[ids[c][1]].cast<float>());
+				}
+			}
+			faces.push_back(face);
+		}
 	}
+	peak_memory = max(peak_memory, points.capacity() * sizeof(Vector3d) + normals.capacity() * sizeof(Vector3d) +
+		pixels.capacity() * sizeof(Vector2d) + point_normals.capacity() * sizeof(Vector3d) +
+		(corners.capacity() + face_sizes.capacity() + face_materials.capacity()) * sizeof(int) + triangle_memory +
+		faces.capacity() * sizeof(TriangleMesh));
 
-	void Set(double min_x, double min_y, double min_z, double max_x, double max_y, double max_z)
+	if (stats != NULL)
 	{
-		this->min_x = min_x;
-		this->min_y = min_y;
-		this->min_z = min_z;
-		this->max_x = max_x;
-		this->max_y = max_y;
-		this->max_z = max_z;
+		stats->filename = filename;
+		stats->bytes = file_size;
+		stats->threads = thread_num;
+		stats->parse_time = parse_time;
+		stats->preprocess_time = preprocess_time;
+		stats->total_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+		stats->peak_memory = peak_memory;
 	}
-};
+	return faces;
+}
+
+
 
 /*
 Judge whether a face is inside a bounding box
@@ -652,22 +1577,45 @@ public:
 	vector<TriangleMesh> faces;
 	BoundingBox bounding_box;
 	OctNode* sons[8] = { NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL };
+	int page_id = -1; //the page of the faces of a paged leaf, -1 if the faces are resident or empty
 
-	OctNode(int depth, BoundingBox bounding_box, vector<TriangleMesh>& faces)
+	/*
+	Build an octnode and its sons
+	Args:
+		depth [int]: [the depth of the node, 1 for the root]
+		bounding_box [BoundingBox]: [the bounds of the node]
+		faces [vector<TriangleMesh>]: [the faces inside the bounds, moved into the node]
+		memory [MemoryUsage]: [the usage of the object, the nodes and their faces are counted as the hierarchy]
+	*/
+	OctNode(int depth, BoundingBox bounding_box, vector<TriangleMesh>&& faces, MemoryUsage& memory)
 	{
 		this->depth = depth;
 		this->bounding_box = bounding_box;
-		this->faces = faces;
-		if (depth < max_depth && faces.size() > min_faces)
+		this->faces = move(faces);
+		memory.Add(MEMORY_HIERARCHY, sizeof(OctNode) + GetVectorBytes(this->faces));
+		if (depth < max_depth && this->faces.size() > min_faces)
+		{
+			this->BuildSons(memory);
+		}
+	}
+
+	OctNode(const OctNode&) = delete;
+	OctNode& operator=(const OctNode&) = delete;
+
+	~OctNode()
+	{
+		for (int i = 0; i < 8; i++)
 		{
-			this->BuildSons();
+			delete this->sons[i];
 		}
 	}
 
 	/*
 	Build the sons of an octnode
+	Args:
+		memory [MemoryUsage]: [the usage of the object]
 	*/
-	void BuildSons()
+	void BuildSons(MemoryUsage& memory)
 	{
 		double min_x = this->bounding_box.min_x;
 		double min_y = this->bounding_box.min_y;
@@ -698,27 +1646,387 @@ public:
 					faces.push_back(this->faces[j]);
 				}
 			}
-			this->sons[i] = new OctNode(this->depth + 1, bounding_boxes[i], faces);
-			faces.clear();
+			this->sons[i] = new OctNode(this->depth + 1, bounding_boxes[i], move(faces), memory);
+		}
+
+		//only the leaves keep their faces, the traversal never reads the faces of the inner nodes
+		memory.Remove(MEMORY_HIERARCHY, GetVectorBytes(this->faces));
+		this->faces = vector<TriangleMesh>();
+	}
+};
+
+
+#define PAGE_CACHE_BYTES (64 << 20) //the default budget of the resident pages
+
+/*
+The leaf faces of the paged objects, each leaf is written as one page of a scratch file and read back on demand,
+the resident pages are kept in a LRU cache bounded by a byte budget
+*/
+class GeometryPager
+{
+public:
+	string filename;
+	FILE* file = NULL;
+	long long file_size = 0;
+	vector<pair<long long, int>> pages; //the offset and the face number of each page
+	size_t cache_bytes = PAGE_CACHE_BYTES;
+	size_t resident_bytes = 0;
+	size_t peak_bytes = 0;
+	list<int> lru; //the resident pages, the most recently used first
+	unordered_map<int, pair<vector<TriangleMesh>, list<int>::iterator>> cache;
+	mutex lock;
+
+	//the statistics since the last reset
+	long long hits = 0;
+	long long misses = 0;
+	long long evictions = 0;
+	long long bytes_read = 0;
+	long long bytes_written = 0;
+
+	GeometryPager() {}
+
+	GeometryPager(const GeometryPager&) = delete;
+	GeometryPager& operator=(const GeometryPager&) = delete;
+
+	~GeometryPager()
+	{
+		this->Close();
+	}
+
+	/*
+	Create the page file, the pages written before are dropped
+	Args:
+		filename [string]: [the full filename of the page file]
+		cache_bytes [size_t]: [the max bytes of the resident pages]
+	Returns:
+		result [bool]: [whether the file is created or not]
+	*/
+	bool Open(string filename, size_t cache_bytes)
+	{
+		this->Close();
+		this->file = OpenFile(filename, "w+b");
+		if (this->file == NULL)
+		{
+			return 0;
+		}
+		this->filename = filename;
+		this->cache_bytes = cache_bytes;
+		return 1;
+	}
+
+	/*
+	Close and remove the page file, drop all the pages
+	*/
+	void Close()
+	{
+		if (this->file != NULL)
+		{
+			fclose(this->file);
+			remove(this->filename.c_str());
+			this->file = NULL;
+		}
+		this->file_size = 0;
+		this->pages.clear();
+		this->Flush();
+		this->ResetStats();
+	}
+
+	/*
+	Drop all the resident pages, the next reads come from the file
+	*/
+	void Flush()
+	{
+		lock_guard<mutex> guard(this->lock);
+		this->cache.clear();
+		this->lru.clear();
+		this->resident_bytes = 0;
+	}
+
+	void ResetStats()
+	{
+		this->hits = 0;
+		this->misses = 0;
+		this->evictions = 0;
+		this->bytes_read = 0;
+		this->bytes_written = 0;
+		this->peak_bytes = this->resident_bytes;
+	}
+
+	/*
+	Get the fraction of the page reads served by the cache
+	Returns:
+		rate [double]: [the hit rate, 0 if nothing read]
+	*/
+	double HitRate()
+	{
+		long long total = this->hits + this->misses;
+		return total > 0 ? double(this->hits) / total : 0;
+	}
+
+	/*
+	Move to a place of the page file
+	Args:
+		offset [long long]: [the offset from the start of the file]
+	Returns:
+		result [bool]: [whether the place is reached or not]
+	*/
+	bool Seek(long long offset)
+	{
+		return SeekFile(this->file, offset);
+	}
+
+	/*
+	Write the faces of a leaf as a new page
+	Args:
+		faces [vector<TriangleMesh>]: [the faces of the leaf]
+	Returns:
+		page_id [int]: [the id of the page, -1 if the faces are empty or the file is not open]
+	*/
+	int AddPage(vector<TriangleMesh>& faces)
+	{
+		if (this->file == NULL || faces.empty())
+		{
+			return -1;
+		}
+		lock_guard<mutex> guard(this->lock);
+		this->Seek(this->file_size);
+		fwrite(faces.data(), sizeof(TriangleMesh), faces.size(), this->file);
+		this->pages.push_back(make_pair(this->file_size, int(faces.size())));
+		long long page_bytes = (long long)(faces.size() * sizeof(TriangleMesh));
+		this->file_size += page_bytes;
+		this->bytes_written += page_bytes;
+		return this->pages.size() - 1;
+	}
+
+	/*
+	Get the faces of a page, read from the file on a miss, the least recently used pages are evicted to keep the budget,
+	the caller must hold the lock, the result is valid until the next load
+	Args:
+		page_id [int]: [the id of the page]
+	Returns:
+		faces [vector<TriangleMesh>]: [the faces of the page]
+	*/
+	vector<TriangleMesh>& LoadPage(int page_id)
+	{
+		auto found = this->cache.find(page_id);
+		if (found != this->cache.end())
+		{
+			this->hits++;
+			this->lru.splice(this->lru.begin(), this->lru, found->second.second);
+			return found->second.first;
+		}
+
+		this->misses++;
+		vector<TriangleMesh> faces(this->pages[page_id].second);
+		size_t page_bytes = faces.size() * sizeof(TriangleMesh);
+		this->Seek(this->pages[page_id].first);
+		fread(faces.data(), sizeof(TriangleMesh), faces.size(), this->file);
+		this->bytes_read += page_bytes;
+
+		//the new page is always kept, even if it is larger than the budget alone
+		while (!this->lru.empty() && this->resident_bytes + page_bytes > this->cache_bytes)
+		{
+			int old_id = this->lru.back();
+			this->resident_bytes -= this->cache[old_id].first.size() * sizeof(TriangleMesh);
+			this->cache.erase(old_id);
+			this->lru.pop_back();
+			this->evictions++;
 		}
+		this->lru.push_front(page_id);
+		pair<vector<TriangleMesh>, list<int>::iterator>& entry = this->cache[page_id];
+		entry.first = move(faces);
+		entry.second = this->lru.begin();
+		this->resident_bytes += page_bytes;
+		this->peak_bytes = max(this->peak_bytes, this->resident_bytes);
+		return entry.first;
+	}
+
+	/*
+	Append the faces of a page to a list
+	Args:
+		page_id [int]: [the id of the page]
+		faces [vector<TriangleMesh>]: [the list of faces]
+	*/
+	void ReadPage(int page_id, vector<TriangleMesh>& faces)
+	{
+		lock_guard<mutex> guard(this->lock);
+		vector<TriangleMesh>& page = this->LoadPage(page_id);
+		faces.insert(faces.end(), page.begin(), page.end());
+	}
+
+	/*
+	Get one face of a page
+	Args:
+		page_id [int]: [the id of the page]
+		slot [int]: [the place of the face in the page]
+	Returns:
+		face [TriangleMesh]: [the face]
+	*/
+	TriangleMesh GetFace(int page_id, int slot)
+	{
+		lock_guard<mutex> guard(this->lock);
+		return this->LoadPage(page_id)[slot];
 	}
 };
 
 
+//The view independent lighting of all the vertexs of an object, rebuilt when the light or the material table change
+class LightingCache
+{
+public:
+	vector<Vector3f> colors; //the ambient + diffuse color of each vertex of each face, [faces * 3]
+	Matrix3d light_key; //the direction, ambient and diffuse of the light used in building
+	int material_version = -1; //the material version used in building
+	bool valid = 0;
+};
+
+
 //The bounding box and octtree of an object
 class MeshModel
 {
 public:
-	vector<TriangleMesh> faces;
+	vector<TriangleMesh> faces; //empty when the object is paged
 	OctNode* root = NULL;
+	LightingCache lighting_cache;
+	GeometryPager* pager = NULL; //the pager of the leaf faces, NULL if the faces are resident
+	vector<pair<int, int>> face_pages; //the page and the slot of each face when paged, (-1, -1) if in no leaf
+	MemoryUsage memory; //the bytes held by the object
 
 	MeshModel() {}
 
 	MeshModel(vector<TriangleMesh>& faces)
 	{
+		TRACE_SPAN("BuildOctree", "build");
 		this->faces = faces;
+		this->memory.Add(MEMORY_GEOMETRY, GetVectorBytes(this->faces));
 		BoundingBox bounding_box = this->BuildBoundingBox();
-		this->root = new OctNode(1, bounding_box, this->faces);
+		this->root = new OctNode(1, bounding_box, vector<TriangleMesh>(this->faces), this->memory);
+	}
+
+	/*
+	Init with the bounds got by the loader, the faces are not swept again
+	Args:
+		faces [vector<TriangleMesh>]: [the faces]
+		bounding_box [BoundingBox]: [the bounds of all the vertexs]
+	*/
+	MeshModel(vector<TriangleMesh>& faces, BoundingBox bounding_box)
+	{
+		TRACE_SPAN("BuildOctree", "build");
+		this->faces = faces;
+		this->memory.Add(MEMORY_GEOMETRY, GetVectorBytes(this->faces));
+		this->root = new OctNode(1, bounding_box, vector<TriangleMesh>(this->faces), this->memory);
+	}
+
+	//the octree is owned by the object, so the objects are only moved
+	MeshModel(const MeshModel&) = delete;
+	MeshModel& operator=(const MeshModel&) = delete;
+
+	MeshModel(MeshModel&& other) noexcept
+	{
+		*this = move(other);
+	}
+
+	MeshModel& operator=(MeshModel&& other) noexcept
+	{
+		if (this != &other)
+		{
+			delete this->root;
+			this->faces = move(other.faces);
+			this->root = other.root;
+			this->lighting_cache = move(other.lighting_cache);
+			this->pager = other.pager;
+			this->face_pages = move(other.face_pages);
+			this->memory = other.memory;
+			other.root = NULL;
+			other.pager = NULL;
+			other.memory = MemoryUsage();
+		}
+		return *this;
+	}
+
+	~MeshModel()
+	{
+		delete this->root;
+	}
+
+	/*
+	Get the number of faces of the object
+	Returns:
+		face_num [int]: [the number of faces, resident or paged]
+	*/
+	int GetFaceNum()
+	{
+		return this->pager == NULL ? this->faces.size() : this->face_pages.size();
+	}
+
+	/*
+	Get a face by its id, a paged face is read through the pager into a per thread copy,
+	which is valid until the next paged face is got on the same thread
+	Args:
+		id [int]: [the id of the face]
+	Returns:
+		face [TriangleMesh]: [the face]
+	*/
+	TriangleMesh& GetFace(int id)
+	{
+		if (this->pager == NULL)
+		{
+			return this->faces[id];
+		}
+		thread_local TriangleMesh paged_face;
+		paged_face = this->pager->GetFace(this->face_pages[id].first, this->face_pages[id].second);
+		return paged_face;
+	}
+
+	/*
+	Move the faces of all the leaves to the pager, only the hierarchy stays resident
+	Args:
+		pager [GeometryPager*]: [the pager with an open page file]
+	*/
+	void PageOut(GeometryPager* pager)
+	{
+		if (this->pager != NULL || this->root == NULL || pager->file == NULL)
+		{
+			return;
+		}
+		TRACE_SPAN("PageOut", "build");
+		this->face_pages.assign(this->faces.size(), make_pair(-1, -1));
+		this->PageOutNode(this->root, pager);
+		this->faces = vector<TriangleMesh>();
+		this->lighting_cache = LightingCache();
+		this->pager = pager;
+		this->memory.Set(MEMORY_GEOMETRY, GetVectorBytes(this->face_pages));
+		this->memory.Set(MEMORY_SCRATCH, 0);
+	}
+
+	/*
+	Write the leaves of an octnode as pages, recursive function
+	Args:
+		node [OctNode*]: [the octnode]
+		pager [GeometryPager*]: [the pager]
+	*/
+	void PageOutNode(OctNode* node, GeometryPager* pager)
+	{
+		if (node->sons[0] != NULL)
+		{
+			for (int i = 0; i < 8; i++)
+			{
+				this->PageOutNode(node->sons[i], pager);
+			}
+			return;
+		}
+		node->page_id = pager->AddPage(node->faces);
+		for (int slot = 0; slot < node->faces.size(); slot++)
+		{
+			//a face inside several leaves is got from its first page
+			pair<int, int>& place = this->face_pages[node->faces[slot].id];
+			if (place.first < 0)
+			{
+				place = make_pair(node->page_id, slot);
+			}
+		}
+		this->memory.Remove(MEMORY_HIERARCHY, GetVectorBytes(node->faces));
+		node->faces = vector<TriangleMesh>();
 	}
 
 	/*
@@ -731,9 +2039,9 @@ public:
 		double min_x = DBL_MAX;
 		double min_y = DBL_MAX;
 		double min_z = DBL_MAX;
-		double max_x = DBL_MIN;
-		double max_y = DBL_MIN;
-		double max_z = DBL_MIN;
+		double max_x = -DBL_MAX;
+		double max_y = -DBL_MAX;
+		double max_z = -DBL_MAX;
 		for (int i = 0; i < this->faces.size(); i++)
 		{
 			for (int j = 0; j < 3; j++)
@@ -0,0 +1,86 @@
+//the pictures encoded and written on a background thread, the renderer only waits for the conversion
+#pragma once
+#include "utils.hpp"
+#include "thread_pool.hpp"
+using namespace std;
+using namespace Eigen;
+using namespace cv;
+#define PICTURE_MAX_PENDING 4 //the max pictures waiting to be written, the submitting thread waits beyond it
+
+class PictureWriter
+{
+public:
+	mutex lock;
+	condition_variable picture_done; //notified when a picture is written
+	int pending = 0; //the number of pictures submitted but not written
+	int written = 0;
+	int failed = 0;
+	double convert_time = 0; //the time of converting the pictures on the submitting thread, in seconds
+	double encode_time = 0; //the time of encoding and writing the pictures on the background thread, in seconds
+	ThreadPool pool = ThreadPool(1); //declared last, so the worker stops before the members it uses
+
+	PictureWriter() {}
+
+	PictureWriter(const PictureWriter&) = delete;
+	PictureWriter& operator=(const PictureWriter&) = delete;
+
+	~PictureWriter()
+	{
+		this->Wait();
+	}
+
+	/*
+	Convert a picture and queue it to be written, the data can be changed once this returns,
+	the format is chosen by the extension, .exr and .hdr keep the colors as floats
+	Args:
+		data [array of Vector3d], [H * W]: [the result data]
+		filename [string]: [the full saving place]
+		width [int]: [the width of the picture]
+		height [int]: [the height of the picture]
+	*/
+	void Submit(Vector3d* data, string filename, int width, int height)
+	{
+		TRACE_SPAN("ConvertPicture", "output", filename);
+		auto start_time = chrono::steady_clock::now();
+		Mat image = ConvertPicture(data, width, height, JudgeHDRFile(filename));
+		{
+			unique_lock<mutex> guard(this->lock);
+			this->picture_done.wait(guard, [this] { return this->pending < PICTURE_MAX_PENDING; });
+			this->pending++;
+			this->convert_time += chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+		}
+		this->pool.Submit([this, image, filename]()
+		{
+			auto encode_start = chrono::steady_clock::now();
+			bool result = 0;
+			try
+			{
+				//the span ends before the waiting threads are notified
+				TRACE_SPAN("EncodePicture", "output", filename);
+				result = imwrite(filename, image);
+			}
+			catch (cv::Exception&)
+			{
+				//the codec of the format is not built in opencv
+				result = 0;
+			}
+			{
+				unique_lock<mutex> guard(this->lock);
+				this->pending--;
+				this->written += result ? 1 : 0;
+				this->failed += result ? 0 : 1;
+				this->encode_time += chrono::duration<double>(chrono::steady_clock::now() - encode_start).count();
+			}
+			this->picture_done.notify_all();
+		});
+	}
+
+	/*
+	Wait until all the submitted pictures are written
+	*/
+	void Wait()
+	{
+		unique_lock<mutex> guard(this->lock);
+		this->picture_done.wait(guard, [this] { return this->pending == 0; });
+	}
+};
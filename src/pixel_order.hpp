@@ -0,0 +1,106 @@
+//the traversal orders of the pixels, used to make the tracing and the framebuffer writes cache coherent
+#pragma once
+#include "utils.hpp"
+using namespace std;
+#define ORDER_ROW 0 //scanline order, row by row
+#define ORDER_MORTON 1 //tiles ordered along the morton (z-order) curve
+#define ORDER_HILBERT 2 //tiles ordered along the hilbert curve
+
+/*
+Get the morton code of a 2D point by interleaving the bits of x and y
+Args:
+	x [int]: [the x of the point]
+	y [int]: [the y of the point]
+Returns:
+	code [unsigned int]: [the morton code]
+*/
+unsigned int GetMortonCode(int x, int y)
+{
+	unsigned int code = 0;
+	for (int k = 0; k < 16; k++)
+	{
+		code |= ((unsigned(x) >> k) & 1u) << (2 * k);
+		code |= ((unsigned(y) >> k) & 1u) << (2 * k + 1);
+	}
+	return code;
+}
+
+/*
+Get the distance of a 2D point along the hilbert curve
+Args:
+	n [int]: [the size of the square grid, power of 2]
+	x [int]: [the x of the point]
+	y [int]: [the y of the point]
+Returns:
+	d [unsigned int]: [the distance along the hilbert curve]
+*/
+unsigned int GetHilbertCode(int n, int x, int y)
+{
+	unsigned int d = 0;
+	for (int s = n / 2; s > 0; s /= 2)
+	{
+		int rx = (x & s) > 0;
+		int ry = (y & s) > 0;
+		d += unsigned(s) * unsigned(s) * ((3 * rx) ^ ry);
+		//rotate the quadrant
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				x = s - 1 - x;
+				y = s - 1 - y;
+			}
+			int temp = x;
+			x = y;
+			y = temp;
+		}
+	}
+	return d;
+}
+
+/*
+Get the traversal order of the tiles of a picture
+Args:
+	width [int]: [the width of the picture]
+	height [int]: [the height of the picture]
+	tile_size [int]: [the size of a square tile]
+	order [int]: [the order type, ORDER_ROW, ORDER_MORTON or ORDER_HILBERT]
+Returns:
+	tiles [vector<int>]: [the tile ids (ty * tiles_x + tx) in traversal order]
+*/
+vector<int> BuildTileOrder(int width, int height, int tile_size, int order)
+{
+	int tiles_x = (width + tile_size - 1) / tile_size;
+	int tiles_y = (height + tile_size - 1) / tile_size;
+	int n = 1;
+	while (n < tiles_x || n < tiles_y)
+	{
+		n *= 2;
+	}
+	vector<pair<unsigned int, int>> codes;
+	codes.clear();
+	for (int ty = 0; ty < tiles_y; ty++)
+	{
+		for (int tx = 0; tx < tiles_x; tx++)
+		{
+			unsigned int code = ty * tiles_x + tx;
+			if (order == ORDER_MORTON)
+			{
+				code = GetMortonCode(tx, ty);
+			}
+			else if (order == ORDER_HILBERT)
+			{
+				code = GetHilbertCode(n, tx, ty);
+			}
+			codes.push_back(make_pair(code, ty * tiles_x + tx));
+		}
+	}
+	sort(codes.begin(), codes.end());
+	vector<int> tiles;
+	tiles.clear();
+	for (int i = 0; i < codes.size(); i++)
+	{
+		tiles.push_back(codes[i].second);
+	}
+	return tiles;
+}
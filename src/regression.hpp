@@ -0,0 +1,541 @@
+//the golden picture regression suite, the reference scenes are rendered from fixed cameras, the pictures are compared
+//with the stored golden pictures by PSNR and the frame time and the traced rays with the stored baselines
+#pragma once
+#include "utils.hpp"
+#include "camera_model.hpp"
+#include "light_model.hpp"
+using namespace std;
+using namespace Eigen;
+using namespace cv;
+#define REGRESSION_BASELINES "baselines.txt" //the baselines in the golden folder, "name frame_time traced_rays" on each line
+#define REGRESSION_PAGE_FILE "regression_pages.bin"
+
+//a case of the suite, a scene seen from a camera with some options
+class RegressionCase
+{
+public:
+	string name;
+	string scene_file;
+	double camera_r = 0;
+	double camera_theta = 0;
+	double camera_phi = 0;
+	bool adaptive_sampling = 0;
+	bool antialiasing = 0;
+	bool shadow_mapping = 0;
+	bool light_importance_sampling = 0;
+	bool paging = 0;
+	int pixel_order = ORDER_ROW;
+};
+
+//a parse case of the suite, an obj file read in several chunks must give the faces read in one chunk
+class RegressionParseCase
+{
+public:
+	string name;
+	string filename;
+	int max_chunks = 2; //the file is read in 2 to max_chunks chunks
+};
+
+//the measures of a case and its verdict
+class RegressionResult
+{
+public:
+	double psnr = 0; //in dB, DBL_MAX if the pictures are equal
+	int max_difference = 0; //the largest difference of a channel, in [0, 255]
+	double frame_time = 0; //the fastest of the repeated frames, in seconds
+	long long traced_rays = 0;
+	double baseline_time = 0; //0 if there is no baseline
+	long long baseline_rays = 0;
+	vector<string> failures; //why the case failed, empty if it passed
+};
+
+/*
+The regression suite, one item on each line, the paths are relative to the suite file and use "/", for example
+	golden golden
+	psnr 40
+	time 1.25
+	rays 0.01
+	repeat 3
+	case front scene.txt 14.142 135 0
+	case side_adaptive scene.txt 14.142 135 90 adaptive order morton
+	parse boundary boundary.obj 4
+golden gives the folder of the golden pictures and the baselines, which the update mode (--regress-update) makes and fills
+with a <case>.png for each case and the baselines, psnr the lowest PSNR in dB, time the highest ratio of the
+frame time to its baseline, rays the highest relative change of the traced rays, repeat the frames of each case, the fastest
+is measured, the case gives a name, a scene, the camera r, theta and phi in degrees and the options, which are adaptive,
+antialiasing, shadow_mapping, light_sampling, paged and order row | morton | hilbert, the parse gives a name, an obj file and
+the most chunks it is read in, the lines starting with # are comments,
+the suite of the shipped scenes is res/regression/suite.txt, its goldens are written by the update mode on the reference machine
+*/
+class RegressionSuite
+{
+public:
+	string golden_directory;
+	double min_psnr = 40;
+	double max_time_ratio = 1.25; //the baselines are measured on the same machine
+	double max_ray_change = 0.01; //fewer rays fail too, the picture or the work changed
+	int repeat = 3;
+	vector<RegressionCase> cases;
+	vector<RegressionParseCase> parse_cases;
+
+	/*
+	Read a suite file
+	Args:
+		filename [string]: [the full filename]
+	Returns:
+		result [bool]: [whether the file is read with at least one case or not]
+	*/
+	bool Read(string filename)
+	{
+		ifstream suite_file;
+		suite_file.open(filename, ios::in);
+		if (!suite_file.is_open())
+		{
+			return 0;
+		}
+		string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+		this->golden_directory = directory + "golden/";
+		string line;
+		while (getline(suite_file, line))
+		{
+			istringstream words(line);
+			string head;
+			if (!(words >> head) || head[0] == '#')
+			{
+				continue;
+			}
+			if (head == "golden")
+			{
+				words >> this->golden_directory;
+				this->golden_directory = directory + this->golden_directory + "/";
+			}
+			else if (head == "psnr")
+			{
+				words >> this->min_psnr;
+			}
+			else if (head == "time")
+			{
+				words >> this->max_time_ratio;
+			}
+			else if (head == "rays")
+			{
+				words >> this->max_ray_change;
+			}
+			else if (head == "repeat")
+			{
+				words >> this->repeat;
+				this->repeat = max(this->repeat, 1);
+			}
+			else if (head == "case")
+			{
+				RegressionCase test;
+				if (!(words >> test.name >> test.scene_file >> test.camera_r >> test.camera_theta >> test.camera_phi))
+				{
+					continue;
+				}
+				test.scene_file = directory + test.scene_file;
+				test.camera_theta = test.camera_theta / 180.0 * PI;
+				test.camera_phi = test.camera_phi / 180.0 * PI;
+				string key;
+				while (words >> key)
+				{
+					if (key == "adaptive")
+					{
+						test.adaptive_sampling = 1;
+					}
+					else if (key == "antialiasing")
+					{
+						test.antialiasing = 1;
+					}
+					else if (key == "shadow_mapping")
+					{
+						test.shadow_mapping = 1;
+					}
+					else if (key == "light_sampling")
+					{
+						test.light_importance_sampling = 1;
+					}
+					else if (key == "paged")
+					{
+						test.paging = 1;
+					}
+					else if (key == "order")
+					{
+						string order;
+						words >> order;
+						test.pixel_order = order == "morton" ? ORDER_MORTON : (order == "hilbert" ? ORDER_HILBERT : ORDER_ROW);
+					}
+				}
+				this->cases.push_back(test);
+			}
+			else if (head == "parse")
+			{
+				RegressionParseCase test;
+				if (words >> test.name >> test.filename >> test.max_chunks)
+				{
+					test.filename = directory + test.filename;
+					this->parse_cases.push_back(test);
+				}
+			}
+		}
+		suite_file.close();
+		return this->cases.size() + this->parse_cases.size() > 0;
+	}
+};
+
+/*
+Read the baselines of the suite
+Args:
+	filename [string]: [the full filename of the baselines]
+	baselines [map<string, pair<double, long long>>]: [the frame time and the traced rays of each case]
+Returns:
+	result [bool]: [whether the file is read or not]
+*/
+bool ReadRegressionBaselines(string filename, map<string, pair<double, long long>>& baselines)
+{
+	ifstream baseline_file;
+	baseline_file.open(filename, ios::in);
+	if (!baseline_file.is_open())
+	{
+		return 0;
+	}
+	baselines.clear();
+	string line;
+	while (getline(baseline_file, line))
+	{
+		istringstream words(line);
+		string name;
+		double frame_time = 0;
+		long long traced_rays = 0;
+		if (line.size() > 0 && line[0] != '#' && words >> name >> frame_time >> traced_rays)
+		{
+			baselines[name] = make_pair(frame_time, traced_rays);
+		}
+	}
+	baseline_file.close();
+	return 1;
+}
+
+/*
+Compare a picture with its golden picture
+Args:
+	golden [Mat]: [the golden picture, CV_8UC3]
+	current [Mat]: [the rendered picture, CV_8UC3 of the same size]
+	max_difference [int]: [the largest difference of a channel]
+	differences [array of double], [H * W]: [the largest difference of the channels of each pixel, in [0, 1]]
+Returns:
+	psnr [double]: [the PSNR in dB, DBL_MAX if the pictures are equal]
+*/
+double ComparePictures(Mat& golden, Mat& current, int& max_difference, double* differences)
+{
+	double squared_error = 0;
+	max_difference = 0;
+	int total_size = golden.rows * golden.cols;
+	for (int i = 0; i < total_size; i++)
+	{
+		int pixel_difference = 0;
+		for (int c = 0; c < 3; c++)
+		{
+			int difference = abs(int(golden.data[i * 3 + c]) - int(current.data[i * 3 + c]));
+			squared_error += double(difference) * difference;
+			pixel_difference = max(pixel_difference, difference);
+		}
+		differences[i] = pixel_difference / 255.0;
+		max_difference = max(max_difference, pixel_difference);
+	}
+	if (squared_error == 0)
+	{
+		return DBL_MAX;
+	}
+	double mean_error = squared_error / (total_size * 3.0);
+	return 10 * log10(255.0 * 255.0 / mean_error);
+}
+
+/*
+Read the obj file of a parse case in one chunk and in 2 to max_chunks chunks, the faces, their vertexs, their materials and
+their texture coordinates must be the same
+Args:
+	test [RegressionParseCase]: [the parse case]
+	face_num [int]: [the number of faces read in one chunk]
+Returns:
+	failures [vector<string>]: [why the case failed, empty if it passed]
+*/
+vector<string> RunRegressionParseCase(RegressionParseCase& test, int& face_num)
+{
+	vector<string> failures;
+	MaterialTable reference_materials;
+	vector<TriangleMesh> reference = ReadOBJMesh(test.filename, 1, Vector3d::Zero(), 0, 0, reference_materials, NULL, NULL, 1);
+	face_num = reference.size();
+	if (reference.size() == 0)
+	{
+		failures.push_back("no face in " + test.filename);
+		return failures;
+	}
+	for (int chunk_num = 2; chunk_num <= test.max_chunks; chunk_num++)
+	{
+		MaterialTable materials;
+		vector<TriangleMesh> faces = ReadOBJMesh(test.filename, 1, Vector3d::Zero(), 0, 0, materials, NULL, NULL, chunk_num);
+		string chunks = " in " + to_string(chunk_num) + " chunks";
+		if (faces.size() != reference.size())
+		{
+			failures.push_back(to_string(faces.size()) + " faces" + chunks + ", " + to_string(reference.size()) + " in one");
+			continue;
+		}
+		for (int i = 0; i < faces.size(); i++)
+		{
+			bool same = faces[i].material_id == reference[i].material_id && faces[i].texture_id == reference[i].texture_id;
+			for (int k = 0; k < 3; k++)
+			{
+				same = same && faces[i].vertexs[k].point == reference[i].vertexs[k].point;
+			}
+			if (!same)
+			{
+				failures.push_back("face " + to_string(i) + " differs" + chunks);
+				break;
+			}
+		}
+	}
+	return failures;
+}
+
+/*
+Render a case, the scene is loaded again and the frame is rendered several times, the fastest is measured,
+temporal reuse and dynamic resolution are off so the picture only depends on the case
+Args:
+	model [RayTracing]: [the ray tracing model]
+	test [RegressionCase]: [the case]
+	repeat [int]: [the number of frames]
+	result [RegressionResult]: [the frame time and the traced rays of the case]
+Returns:
+	loaded [bool]: [whether the scene is loaded or not]
+*/
+bool RenderRegressionCase(RayTracing& model, RegressionCase& test, int repeat, RegressionResult& result)
+{
+	//the objects of a paged case are paged out again from a new page file
+	model.paging = 0;
+	if (!model.LoadScene(test.scene_file))
+	{
+		return 0;
+	}
+	model.pager.Close();
+	model.camera = Camera(model.picture_size, test.camera_r, test.camera_theta, test.camera_phi);
+	model.adaptive_sampling = test.adaptive_sampling;
+	model.antialiasing = test.antialiasing;
+	model.shadow_mapping = test.shadow_mapping;
+	model.light_importance_sampling = test.light_importance_sampling;
+	model.pixel_order = test.pixel_order;
+	model.temporal_reuse = 0;
+	model.dynamic_resolution = 0;
+	if (test.paging)
+	{
+		model.EnablePaging(REGRESSION_PAGE_FILE, model.pager.cache_bytes);
+	}
+
+	result.frame_time = DBL_MAX;
+	for (int k = 0; k < repeat; k++)
+	{
+		model.Main();
+		result.frame_time = min(result.frame_time, model.frame_time);
+	}
+	result.traced_rays = model.traced_rays;
+	return 1;
+}
+
+/*
+Run the regression suite, each case is compared with its golden picture and its baselines and the verdicts are written to
+a report, a failed case also gets a false color map of its differences next to the report, as report_name_diff.png,
+in the update mode the golden pictures and the baselines are written instead,
+the options are restored after the suite but the model keeps the scene, the camera and the paging of the last case
+Args:
+	model [RayTracing]: [the ray tracing model]
+	suite_file [string]: [the full filename of the suite]
+	report_file [string]: [the full filename of the report]
+	update [bool]: [whether to write the golden pictures and the baselines instead of comparing]
+Returns:
+	result [bool]: [whether all the cases passed or not]
+*/
+bool RunRegression(RayTracing& model, string suite_file, string report_file, bool update)
+{
+	TRACE_SPAN("RunRegression", "frame", suite_file);
+	ofstream report;
+	report.open(report_file, ios::out);
+	RegressionSuite suite;
+	if (!suite.Read(suite_file))
+	{
+		report << "FAILED: no case in the suite " << suite_file << endl;
+		report.close();
+		return 0;
+	}
+	bool old_options[7] = { model.adaptive_sampling, model.antialiasing, model.shadow_mapping, model.light_importance_sampling,
+		model.temporal_reuse, model.dynamic_resolution, model.paging };
+	int old_order = model.pixel_order;
+
+	string baseline_file = suite.golden_directory + REGRESSION_BASELINES;
+	map<string, pair<double, long long>> baselines;
+	bool has_baselines = ReadRegressionBaselines(baseline_file, baselines);
+	size_t dot = report_file.find_last_of('.');
+	string stem = dot == string::npos ? report_file : report_file.substr(0, dot);
+	report << "suite " << suite_file << ", " << suite.cases.size() + suite.parse_cases.size() << " cases, golden " << suite.golden_directory
+		<< ", psnr >= " << suite.min_psnr << " dB, time <= " << suite.max_time_ratio << "x, rays within "
+		<< suite.max_ray_change * 100 << "%" << endl;
+	if (!update && !has_baselines)
+	{
+		report << "no baselines in " << baseline_file << ", run the update mode first" << endl;
+	}
+	//the first update of a suite makes its golden folder
+	if (update && !MakeDirectory(suite.golden_directory))
+	{
+		report << "FAILED: cannot make the golden folder " << suite.golden_directory << endl;
+	}
+	report << "case, psnr (dB), max difference, frame time (s), baseline time (s), traced rays, baseline rays, result" << endl;
+
+	int total_size = model.picture_size * model.picture_size;
+	vector<double> differences(total_size);
+	vector<Vector3d> colors(total_size);
+	vector<RegressionResult> results(suite.cases.size());
+	int failed_num = 0;
+	for (int i = 0; i < suite.cases.size(); i++)
+	{
+		RegressionCase& test = suite.cases[i];
+		RegressionResult& result = results[i];
+		string golden_file = suite.golden_directory + test.name + ".png";
+		if (!RenderRegressionCase(model, test, suite.repeat, result))
+		{
+			result.failures.push_back("cannot load the scene " + test.scene_file);
+		}
+		else if (update)
+		{
+			if (!imwrite(golden_file, ConvertPicture(model.results, model.picture_size, model.picture_size, 0)))
+			{
+				result.failures.push_back("cannot write " + golden_file);
+			}
+			baselines[test.name] = make_pair(result.frame_time, result.traced_rays);
+		}
+		else
+		{
+			//the picture
+			Mat golden = imread(golden_file, IMREAD_COLOR);
+			Mat current = ConvertPicture(model.results, model.picture_size, model.picture_size, 0);
+			if (golden.empty())
+			{
+				result.failures.push_back("no golden picture " + golden_file);
+			}
+			else if (golden.rows != current.rows || golden.cols != current.cols)
+			{
+				result.failures.push_back("golden picture is " + to_string(golden.cols) + "x" + to_string(golden.rows)
+					+ ", rendered " + to_string(current.cols) + "x" + to_string(current.rows));
+			}
+			else
+			{
+				result.psnr = ComparePictures(golden, current, result.max_difference, differences.data());
+				if (result.psnr < suite.min_psnr)
+				{
+					string diff_file = stem + "_" + test.name + "_diff.png";
+					FalseColorPicture(differences.data(), total_size, max(result.max_difference, 1) / 255.0, colors.data());
+					SavePicture(colors.data(), diff_file, model.picture_size, model.picture_size);
+					ostringstream failure;
+					failure << "psnr " << result.psnr << " dB below " << suite.min_psnr << " dB, max difference "
+						<< result.max_difference << ", differences in " << diff_file;
+					result.failures.push_back(failure.str());
+				}
+			}
+
+			//the speed and the work
+			auto found = baselines.find(test.name);
+			if (found == baselines.end())
+			{
+				result.failures.push_back("no baseline");
+			}
+			else
+			{
+				result.baseline_time = found->second.first;
+				result.baseline_rays = found->second.second;
+				if (result.frame_time > result.baseline_time * suite.max_time_ratio)
+				{
+					ostringstream failure;
+					failure << "frame time " << result.frame_time << " s is " << result.frame_time / result.baseline_time
+						<< "x the baseline " << result.baseline_time << " s";
+					result.failures.push_back(failure.str());
+				}
+				double ray_change = double(result.traced_rays - result.baseline_rays) / max(result.baseline_rays, 1LL);
+				if (abs(ray_change) > suite.max_ray_change)
+				{
+					ostringstream failure;
+					failure << "traced rays " << result.traced_rays << " changed by " << ray_change * 100 << "% from the baseline "
+						<< result.baseline_rays;
+					result.failures.push_back(failure.str());
+				}
+			}
+		}
+
+		failed_num += result.failures.size() > 0;
+		string psnr = update ? "-" : (result.psnr == DBL_MAX ? "inf" : to_string(result.psnr));
+		report << test.name << ", " << psnr << ", " << result.max_difference
+			<< ", " << result.frame_time << ", " << result.baseline_time << ", " << result.traced_rays << ", "
+			<< result.baseline_rays << ", " << (result.failures.size() > 0 ? "FAILED" : (update ? "updated" : "passed")) << endl;
+	}
+
+	if (update)
+	{
+		ofstream baseline_output;
+		baseline_output.open(baseline_file, ios::out);
+		baseline_output << "# case, frame time (s), traced rays" << endl;
+		for (auto& baseline : baselines)
+		{
+			baseline_output << baseline.first << " " << baseline.second.first << " " << baseline.second.second << endl;
+		}
+		baseline_output.close();
+		if (!baseline_output)
+		{
+			report << "FAILED: cannot write " << baseline_file << endl;
+			failed_num++;
+		}
+	}
+
+	//the parse cases only compare the chunked reads, there is nothing to update
+	vector<vector<string>> parse_failures(suite.parse_cases.size());
+	if (suite.parse_cases.size() > 0)
+	{
+		report << "parse case, faces, most chunks, result" << endl;
+	}
+	for (int i = 0; i < suite.parse_cases.size(); i++)
+	{
+		int face_num = 0;
+		parse_failures[i] = RunRegressionParseCase(suite.parse_cases[i], face_num);
+		failed_num += parse_failures[i].size() > 0;
+		report << suite.parse_cases[i].name << ", " << face_num << ", " << suite.parse_cases[i].max_chunks << ", "
+			<< (parse_failures[i].size() > 0 ? "FAILED" : "passed") << endl;
+	}
+
+	//the reasons of the failures after the table, so they are read first in a failed run
+	for (int i = 0; i < suite.cases.size(); i++)
+	{
+		for (int k = 0; k < results[i].failures.size(); k++)
+		{
+			report << "FAILED " << suite.cases[i].name << ": " << results[i].failures[k] << endl;
+		}
+	}
+	for (int i = 0; i < suite.parse_cases.size(); i++)
+	{
+		for (int k = 0; k < parse_failures[i].size(); k++)
+		{
+			report << "FAILED " << suite.parse_cases[i].name << ": " << parse_failures[i][k] << endl;
+		}
+	}
+	int case_num = suite.cases.size() + suite.parse_cases.size();
+	report << max(case_num - failed_num, 0) << " passed, " << failed_num << " failed" << endl;
+	report.close();
+
+	model.adaptive_sampling = old_options[0];
+	model.antialiasing = old_options[1];
+	model.shadow_mapping = old_options[2];
+	model.light_importance_sampling = old_options[3];
+	model.temporal_reuse = old_options[4];
+	model.dynamic_resolution = old_options[5];
+	model.pixel_order = old_order;
+	if (old_options[6] && !model.paging)
+	{
+		model.EnablePaging("pages.bin", model.pager.cache_bytes);
+	}
+	return failed_num == 0;
+}
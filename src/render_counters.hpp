@@ -0,0 +1,140 @@
+//the counters of the work of a frame, each thread counts into its own counters and they are merged at the end of the frame,
+//the counting is compiled only with ENABLE_RENDER_COUNTERS defined, otherwise COUNT_RENDER does nothing
+#pragma once
+#include "utils.hpp"
+using namespace std;
+#define COUNTER_RAY_TYPES 4 //TYPE_INIT, TYPE_LOCAL, TYPE_REFLECTION and TYPE_REFRACTION
+#define COUNTER_MAX_DEPTH 8 //the deeper rays are counted in the last bucket of the depth histogram
+
+class RenderCounters
+{
+public:
+	long long rays[COUNTER_RAY_TYPES] = { 0 }; //the traced rays of each type
+	long long box_tests = 0; //the ray and bounding box tests
+	long long nodes_visited = 0; //the octree nodes entered by the rays
+	long long triangle_tests = 0; //the ray and triangle tests
+	long long hits = 0; //the rays hitting a face
+	long long depth_histogram[COUNTER_MAX_DEPTH + 1] = { 0 }; //the traced rays of each recursion depth
+
+	RenderCounters() {}
+
+	/*
+	Add the counts of other counters
+	Args:
+		other [RenderCounters]: [the other counters]
+	*/
+	void Add(RenderCounters& other)
+	{
+		for (int k = 0; k < COUNTER_RAY_TYPES; k++)
+		{
+			this->rays[k] += other.rays[k];
+		}
+		this->box_tests += other.box_tests;
+		this->nodes_visited += other.nodes_visited;
+		this->triangle_tests += other.triangle_tests;
+		this->hits += other.hits;
+		for (int k = 0; k <= COUNTER_MAX_DEPTH; k++)
+		{
+			this->depth_histogram[k] += other.depth_histogram[k];
+		}
+	}
+
+	/*
+	Write the counters of a frame as one line of JSON
+	Args:
+		frame_id [long long]: [the id of the frame]
+		frame_time [double]: [the time of the frame, in seconds]
+	Returns:
+		json [string]: [the JSON object]
+	*/
+	string ToJson(long long frame_id, double frame_time)
+	{
+		ostringstream json;
+		json << "{\"frame\": " << frame_id << ", \"frame_time\": " << frame_time << ", \"rays\": {\"init\": " << this->rays[0]
+			<< ", \"local\": " << this->rays[1] << ", \"reflection\": " << this->rays[2] << ", \"refraction\": " << this->rays[3]
+			<< "}, \"box_tests\": " << this->box_tests << ", \"nodes_visited\": " << this->nodes_visited
+			<< ", \"triangle_tests\": " << this->triangle_tests << ", \"hits\": " << this->hits << ", \"depth_histogram\": [";
+		for (int k = 0; k <= COUNTER_MAX_DEPTH; k++)
+		{
+			json << (k > 0 ? ", " : "") << this->depth_histogram[k];
+		}
+		json << "]}";
+		return json.str();
+	}
+};
+
+#ifdef ENABLE_RENDER_COUNTERS
+//the counters of all the threads, a thread registers its counters at its first count
+class RenderCounterRegistry
+{
+public:
+	mutex lock;
+	vector<RenderCounters*> threads;
+	RenderCounters retired; //the counts of the threads ended since the last gathering
+};
+RenderCounterRegistry render_counter_registry;
+
+//the counters of one thread, only written by the thread
+class ThreadRenderCounters
+{
+public:
+	RenderCounters counters;
+
+	ThreadRenderCounters()
+	{
+		lock_guard<mutex> guard(render_counter_registry.lock);
+		render_counter_registry.threads.push_back(&this->counters);
+	}
+
+	~ThreadRenderCounters()
+	{
+		lock_guard<mutex> guard(render_counter_registry.lock);
+		render_counter_registry.retired.Add(this->counters);
+		vector<RenderCounters*>& threads = render_counter_registry.threads;
+		threads.erase(find(threads.begin(), threads.end(), &this->counters));
+	}
+};
+thread_local ThreadRenderCounters thread_render_counters;
+
+/*
+Merge and reset the counters of all the threads, called between frames while no thread is tracing
+Returns:
+	counters [RenderCounters]: [the counts since the last gathering]
+*/
+RenderCounters GatherRenderCounters()
+{
+	lock_guard<mutex> guard(render_counter_registry.lock);
+	RenderCounters counters = render_counter_registry.retired;
+	render_counter_registry.retired = RenderCounters();
+	for (int i = 0; i < render_counter_registry.threads.size(); i++)
+	{
+		counters.Add(*render_counter_registry.threads[i]);
+		*render_counter_registry.threads[i] = RenderCounters();
+	}
+	return counters;
+}
+
+/*
+Read the counters of the calling thread without resetting them
+Returns:
+	counters [RenderCounters]: [the counts of the thread since the last gathering]
+*/
+RenderCounters ReadThreadRenderCounters()
+{
+	return thread_render_counters.counters;
+}
+
+#define COUNT_RENDER(field) (thread_render_counters.counters.field++)
+#else
+RenderCounters GatherRenderCounters()
+{
+	return RenderCounters();
+}
+
+RenderCounters ReadThreadRenderCounters()
+{
+	return RenderCounters();
+}
+
+#define COUNT_RENDER(field) ((void)0)
+#endif
@@ -0,0 +1,251 @@
+//the scene description file and the concurrent loading of its objects
+#pragma once
+#include "utils.hpp"
+#include "mesh_model.hpp"
+#include "camera_model.hpp"
+#include "thread_pool.hpp"
+using namespace std;
+using namespace Eigen;
+
+//a mesh listed in the scene description
+class SceneObject
+{
+public:
+	string filename; //the full filename of the mesh
+	double size = 1; //the new size of the mesh
+	Vector3d center = Vector3d::Zero(); //the new center of the mesh
+	Material material; //the colors are only used by ply meshes, obj meshes take theirs from the mtl file
+};
+
+//a light listed in the scene description
+class SceneLight
+{
+public:
+	bool point = 0; //a point light or a directional light
+	Vector3d place = Vector3d::Zero(); //the position of a point light or the direction of a directional light
+	double range = 0;
+	Vector3d ambient = Vector3d::Zero();
+	Vector3d diffuse = Vector3d::Zero();
+	Vector3d specular = Vector3d::Zero();
+};
+
+/*
+The scene description, one item on each line, the paths are relative to the scene file and use "/", for example
+	camera 14.142 135 0
+	light directional 0 -1 0 ambient 1 1 1 diffuse 1 1 1 specular 1 1 1
+	light point 0 5 0 range 10 ambient 0 0 0 diffuse 1 1 1 specular 1 1 1
+	mesh bunny.ply size 2 center 5 2 0 ambient 0.2 0.2 0.2 diffuse 0.7 0.7 0.2 specular 0.2 0.2 0.2 reflection 0.2 refraction 0.1
+the camera gives r, theta and phi in degrees of the unit sphere, the lines starting with # are comments
+*/
+class SceneDescription
+{
+public:
+	vector<SceneObject> objects;
+	vector<SceneLight> lights;
+	bool has_camera = 0;
+	double camera_r = 0;
+	double camera_theta = 0;
+	double camera_phi = 0;
+
+	/*
+	Read a scene description file, the reason of a failure is written to stderr with its line
+	Args:
+		filename [string]: [the full filename]
+	Returns:
+		result [bool]: [whether the file is read with at least one mesh and no bad item or not]
+	*/
+	bool Read(string filename)
+	{
+		ifstream scene_file;
+		scene_file.open(filename, ios::in);
+		if (!scene_file.is_open())
+		{
+			ReportMeshError(filename, 0, "cannot open the file");
+			return 0;
+		}
+		string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+		string line;
+		int line_number = 0;
+		bool valid = 1;
+		while (getline(scene_file, line))
+		{
+			line_number++;
+			istringstream words(line);
+			string head;
+			if (!(words >> head) || head[0] == '#')
+			{
+				continue;
+			}
+			if (head == "camera")
+			{
+				if (!(words >> this->camera_r >> this->camera_theta >> this->camera_phi))
+				{
+					ReportMeshError(filename, line_number, "the camera needs r, theta and phi");
+					valid = 0;
+				}
+				this->camera_theta = this->camera_theta / 180.0 * PI;
+				this->camera_phi = this->camera_phi / 180.0 * PI;
+				this->has_camera = 1;
+			}
+			else if (head == "light")
+			{
+				SceneLight light;
+				string type;
+				bool has_place = bool(words >> type >> light.place(0) >> light.place(1) >> light.place(2));
+				if (!has_place || (type != "point" && type != "directional"))
+				{
+					ReportMeshError(filename, line_number, "the light needs point or directional and a position or a direction");
+					valid = 0;
+				}
+				light.point = type == "point";
+				string key;
+				while (words >> key)
+				{
+					if (key == "range")
+					{
+						words >> light.range;
+					}
+					else if (key == "ambient")
+					{
+						words >> light.ambient(0) >> light.ambient(1) >> light.ambient(2);
+					}
+					else if (key == "diffuse")
+					{
+						words >> light.diffuse(0) >> light.diffuse(1) >> light.diffuse(2);
+					}
+					else if (key == "specular")
+					{
+						words >> light.specular(0) >> light.specular(1) >> light.specular(2);
+					}
+				}
+				if (!words.eof())
+				{
+					ReportMeshError(filename, line_number, "bad value in the light");
+					valid = 0;
+				}
+				this->lights.push_back(light);
+			}
+			else if (head == "mesh")
+			{
+				SceneObject object;
+				if (!(words >> object.filename))
+				{
+					ReportMeshError(filename, line_number, "the mesh needs a filename");
+					valid = 0;
+					continue;
+				}
+				object.filename = directory + object.filename;
+				string key;
+				while (words >> key)
+				{
+					if (key == "size")
+					{
+						words >> object.size;
+					}
+					else if (key == "center")
+					{
+						words >> object.center(0) >> object.center(1) >> object.center(2);
+					}
+					else if (key == "ambient")
+					{
+						Vector3d& color = object.material.colors[CHANNEL_AMBIENT];
+						words >> color(0) >> color(1) >> color(2);
+					}
+					else if (key == "diffuse")
+					{
+						Vector3d& color = object.material.colors[CHANNEL_DIFFUSE];
+						words >> color(0) >> color(1) >> color(2);
+					}
+					else if (key == "specular")
+					{
+						Vector3d& color = object.material.colors[CHANNEL_SPECULAR];
+						words >> color(0) >> color(1) >> color(2);
+					}
+					else if (key == "reflection")
+					{
+						words >> object.material.k_reflection;
+					}
+					else if (key == "refraction")
+					{
+						words >> object.material.k_refraction;
+					}
+				}
+				if (!words.eof())
+				{
+					ReportMeshError(filename, line_number, "bad value in the mesh " + object.filename);
+					valid = 0;
+				}
+				this->objects.push_back(object);
+			}
+			else
+			{
+				ReportMeshError(filename, line_number, "unknown item " + head);
+				valid = 0;
+			}
+		}
+		scene_file.close();
+		if (valid && this->objects.size() == 0)
+		{
+			ReportMeshError(filename, 0, "the scene has no mesh");
+			valid = 0;
+		}
+		return valid;
+	}
+};
+
+/*
+Load all the objects of a scene concurrently, each task reads, normalizes and textures one mesh and builds its hierarchy,
+so the reading of an object overlaps the building of the others, the materials are merged in the order the objects finish reading
+Args:
+	scene [SceneDescription]: [the scene]
+	pool [ThreadPool]: [the thread pool running the tasks]
+	objects [vector<MeshModel>]: [the loaded objects, in the order of the scene]
+	materials [MaterialTable]: [the material table, the materials of all the objects are added]
+	stats [vector<MeshLoadStats>]: [the loading statistics of each object]
+*/
+void LoadSceneObjects(SceneDescription& scene, ThreadPool& pool, vector<MeshModel>& objects, MaterialTable& materials,
+	vector<MeshLoadStats>& stats)
+{
+	TRACE_SPAN("LoadSceneObjects", "load");
+	auto start_time = chrono::steady_clock::now();
+	int object_num = scene.objects.size();
+	objects.clear();
+	objects.resize(object_num);
+	stats.assign(object_num, MeshLoadStats());
+	mutex material_lock;
+	for (int i = 0; i < object_num; i++)
+	{
+		pool.Submit([&, i]()
+		{
+			SceneObject& object = scene.objects[i];
+			MeshLoadStats& object_stats = stats[i];
+			MaterialTable object_materials;
+			vector<TriangleMesh> faces;
+			BoundingBox bounding_box;
+			string extension = object.filename.substr(object.filename.find_last_of('.') + 1);
+			if (extension == "obj" || extension == "OBJ")
+			{
+				faces = ReadOBJMesh(object.filename, object.size, object.center, object.material.k_reflection,
+					object.material.k_refraction, object_materials, &object_stats, &bounding_box);
+			}
+			else
+			{
+				int material_id = object_materials.AddMaterial(object.material);
+				faces = ReadPLYMesh(object.filename, object.size, object.center, material_id, &object_stats, &bounding_box);
+			}
+			{
+				lock_guard<mutex> guard(material_lock);
+				materials.Merge(object_materials, faces);
+			}
+
+			auto build_time = chrono::steady_clock::now();
+			objects[i] = MeshModel(faces, bounding_box);
+			auto ready_time = chrono::steady_clock::now();
+			object_stats.filename = object.filename;
+			object_stats.faces = faces.size();
+			object_stats.build_time = chrono::duration<double>(ready_time - build_time).count();
+			object_stats.ready_time = chrono::duration<double>(ready_time - start_time).count();
+		});
+	}
+	pool.Wait();
+}
@@ -0,0 +1,233 @@
+//the input sessions, the camera events of the window are recorded to a file and replayed headless to measure the latency
+#pragma once
+#include "utils.hpp"
+#include "camera_model.hpp"
+#include "light_model.hpp"
+using namespace std;
+using namespace Eigen;
+#define EVENT_MOUSE_DOWN 0
+#define EVENT_MOUSE_UP 1
+#define EVENT_MOUSE_MOVE 2
+#define EVENT_MOUSE_WHEEL 3 //x is the wheel information
+#define EVENT_KEY_UP 4 //x is the virtual key code
+#define EVENT_TYPE_NUM 5
+const string event_names[EVENT_TYPE_NUM] = { "down", "up", "move", "wheel", "key" };
+
+//an input event of the window
+class SessionEvent
+{
+public:
+	double time = 0; //the time since the recording started, in seconds
+	int type = EVENT_MOUSE_MOVE;
+	int x = 0;
+	int y = 0;
+
+	SessionEvent() {}
+	SessionEvent(int type, int x, int y)
+	{
+		this->type = type;
+		this->x = x;
+		this->y = y;
+	}
+};
+
+/*
+Apply an input event to the camera and the options of the model, shared by the window and the replayer
+Args:
+	model [RayTracing]: [the ray tracing model]
+	event [SessionEvent]: [the event]
+Returns:
+	repaint [bool]: [whether the event changes the picture or not]
+*/
+bool ApplySessionEvent(RayTracing& model, SessionEvent& event)
+{
+	switch (event.type)
+	{
+	case EVENT_MOUSE_DOWN:
+		model.camera.MouseDown(event.x, event.y);
+		return 0;
+	case EVENT_MOUSE_UP:
+		model.camera.MouseUp();
+		return 1;
+	case EVENT_MOUSE_MOVE:
+		model.camera.MouseMove(event.x, event.y);
+		return 0;
+	case EVENT_MOUSE_WHEEL:
+		model.camera.MouseWheel(event.x);
+		return 1;
+	}
+
+	Vector3d move_direction_camera;
+	move_direction_camera << 0, 0, 0;
+	switch (event.x)
+	{
+	case VK_LEFT:
+		move_direction_camera << -1, 0, 0;
+		break;
+	case VK_RIGHT:
+		move_direction_camera << 1, 0, 0;
+		break;
+	case VK_UP:
+		move_direction_camera << 0, 0, 1;
+		break;
+	case VK_DOWN:
+		move_direction_camera << 0, 0, -1;
+		break;
+	case 'R':
+		model.dynamic_resolution = !model.dynamic_resolution;
+		return 1;
+	case 'A':
+		model.adaptive_sampling = !model.adaptive_sampling;
+		return 1;
+	case 'S':
+		model.antialiasing = !model.antialiasing;
+		return 1;
+	case 'O':
+		model.pixel_order = (model.pixel_order + 1) % 3;
+		return 1;
+	case 'M':
+		model.shadow_mapping = !model.shadow_mapping;
+		return 1;
+	default:
+		return 0;
+	}
+	model.camera.KeyUp(move_direction_camera);
+	return 1;
+}
+
+//writes the events of the window to a session file, one event on each line as "time type x y"
+class SessionRecorder
+{
+public:
+	ofstream file;
+	chrono::steady_clock::time_point start_time;
+
+	SessionRecorder() {}
+
+	/*
+	Start recording
+	Args:
+		filename [string]: [the full filename of the session file]
+	Returns:
+		result [bool]: [whether the file is opened or not]
+	*/
+	bool Open(string filename)
+	{
+		this->file.open(filename, ios::out);
+		this->start_time = chrono::steady_clock::now();
+		return this->file.is_open();
+	}
+
+	/*
+	Record an event if recording, the time is filled in
+	Args:
+		event [SessionEvent]: [the event]
+	*/
+	void Record(SessionEvent& event)
+	{
+		if (!this->file.is_open())
+		{
+			return;
+		}
+		event.time = chrono::duration<double>(chrono::steady_clock::now() - this->start_time).count();
+		this->file << event.time << " " << event_names[event.type] << " " << event.x << " " << event.y << endl;
+	}
+};
+
+/*
+Read a session file
+Args:
+	filename [string]: [the full filename of the session file]
+	events [vector<SessionEvent>]: [the events in order]
+Returns:
+	result [bool]: [whether the file is read or not]
+*/
+bool ReadSession(string filename, vector<SessionEvent>& events)
+{
+	ifstream session_file;
+	session_file.open(filename, ios::in);
+	if (!session_file.is_open())
+	{
+		return 0;
+	}
+	events.clear();
+	string line;
+	while (getline(session_file, line))
+	{
+		istringstream words(line);
+		SessionEvent event;
+		string name;
+		if (!(words >> event.time >> name >> event.x >> event.y))
+		{
+			continue;
+		}
+		event.type = int(find(event_names, event_names + EVENT_TYPE_NUM, name) - event_names);
+		if (event.type < EVENT_TYPE_NUM)
+		{
+			events.push_back(event);
+		}
+	}
+	session_file.close();
+	return 1;
+}
+
+/*
+Get a percentile of sorted values by the nearest rank
+Args:
+	values [vector<double>]: [the values in ascending order]
+	rate [double]: [the percentile, between (0, 1]]
+Returns:
+	value [double]: [the percentile value, 0 if there is no value]
+*/
+double GetPercentile(vector<double>& values, double rate)
+{
+	if (values.size() == 0)
+	{
+		return 0;
+	}
+	int rank = int(ceil(rate * values.size()));
+	return values[min(max(rank, 1), int(values.size())) - 1];
+}
+
+/*
+Replay a session headless as fast as possible, each event is applied and a frame is rendered after it,
+the latency of an event is the time from applying it to the end of its frame, the percentiles are written to a report
+Args:
+	model [RayTracing]: [the ray tracing model, at the camera the session was recorded from]
+	events [vector<SessionEvent>]: [the events]
+	filename [string]: [the full filename of the report]
+*/
+void ReplaySession(RayTracing& model, vector<SessionEvent>& events, string filename)
+{
+	vector<double> latencies[EVENT_TYPE_NUM];
+	vector<double> all_latencies;
+	auto start_time = chrono::steady_clock::now();
+	for (int i = 0; i < events.size(); i++)
+	{
+		auto event_start = chrono::steady_clock::now();
+		ApplySessionEvent(model, events[i]);
+		model.Main();
+		double latency = chrono::duration<double>(chrono::steady_clock::now() - event_start).count();
+		latencies[events[i].type].push_back(latency);
+		all_latencies.push_back(latency);
+	}
+	double replay_time = chrono::duration<double>(chrono::steady_clock::now() - start_time).count();
+
+	ofstream report;
+	report.open(filename, ios::out);
+	double session_time = events.size() > 0 ? events.back().time : 0;
+	report << events.size() << " events, recorded in " << session_time << " s, replayed in " << replay_time << " s" << endl;
+	report << "event, count, p50 (s), p95 (s), p99 (s), max (s)" << endl;
+	for (int k = 0; k <= EVENT_TYPE_NUM; k++)
+	{
+		vector<double>& values = k < EVENT_TYPE_NUM ? latencies[k] : all_latencies;
+		if (values.size() == 0)
+		{
+			continue;
+		}
+		sort(values.begin(), values.end());
+		report << (k < EVENT_TYPE_NUM ? event_names[k] : "all") << ", " << values.size() << ", " << GetPercentile(values, 0.5) << ", "
+			<< GetPercentile(values, 0.95) << ", " << GetPercentile(values, 0.99) << ", " << values.back() << endl;
+	}
+	report.close();
+}
@@ -0,0 +1,206 @@
+//the light space transmittance map of a directional light, used to look up the shadows instead of tracing local rays
+#pragma once
+#include "utils.hpp"
+#include "mesh_model.hpp"
+#include "camera_model.hpp"
+#include "intersection.hpp"
+using namespace std;
+using namespace Eigen;
+
+class ShadowMap
+{
+public:
+	int resolution = 512; //the number of texels of each side
+	int filter_radius = 0; //the radius of the percentage closer filter, 0 means bilinear filtering
+	double bias_rate = 0.001; //the depth bias, relative to the scene size
+
+	//the light space, u and v are the texel axes, the depth is along the light direction
+	Vector3d direction;
+	Vector3d axis_u;
+	Vector3d axis_v;
+	double min_u = 0;
+	double min_v = 0;
+	double min_depth = 0;
+	double texel_size = 1;
+	double bias = 0;
+
+	//the first hit of each object along the light, [resolution * resolution * objects]
+	int object_num = 0;
+	vector<float> depths;
+	vector<float> transmittances;
+
+	//the light, geometry and materials used in building, the map is rebuilt if they change
+	bool valid = 0;
+	int built_resolution = 0;
+	Vector3d built_direction;
+	int material_version = -1;
+	vector<pair<OctNode*, int>> geometry_key;
+
+	ShadowMap() {}
+
+	/*
+	Build the light space of a directional light covering all the objects
+	Args:
+		direction [Vector3d]: [the direction of the light]
+		objects [vector<MeshModel>]: [all the objects]
+	*/
+	void BuildLightSpace(Vector3d direction, vector<MeshModel>& objects)
+	{
+		this->direction = direction / direction.norm();
+		Vector3d helper;
+		helper << 1, 0, 0;
+		if (fabs(this->direction(0)) > 0.9)
+		{
+			helper << 0, 1, 0;
+		}
+		this->axis_u = helper.cross(this->direction);
+		this->axis_u = this->axis_u / this->axis_u.norm();
+		this->axis_v = this->direction.cross(this->axis_u);
+
+		double max_u = -DBL_MAX;
+		double max_v = -DBL_MAX;
+		this->min_u = DBL_MAX;
+		this->min_v = DBL_MAX;
+		this->min_depth = DBL_MAX;
+		for (int i = 0; i < objects.size(); i++)
+		{
+			BoundingBox& box = objects[i].root->bounding_box;
+			for (int k = 0; k < 8; k++)
+			{
+				Vector3d corner;
+				corner << ((k & 1) ? box.max_x : box.min_x), ((k & 2) ? box.max_y : box.min_y), ((k & 4) ? box.max_z : box.min_z);
+				double u = corner.dot(this->axis_u);
+				double v = corner.dot(this->axis_v);
+				double depth = corner.dot(this->direction);
+				this->min_u = min(this->min_u, u);
+				this->min_v = min(this->min_v, v);
+				max_u = max(max_u, u);
+				max_v = max(max_v, v);
+				this->min_depth = min(this->min_depth, depth);
+			}
+		}
+		double size = max(max_u - this->min_u, max_v - this->min_v);
+		this->texel_size = size / (this->resolution - 1);
+		this->bias = size * this->bias_rate;
+		this->min_depth = this->min_depth - 1;
+	}
+
+	/*
+	Rebuild the map if the light direction, the resolution or the geometry changed
+	Args:
+		direction [Vector3d]: [the direction of the light]
+		objects [vector<MeshModel>]: [all the objects]
+		materials [MaterialTable]: [the material table]
+	*/
+	void Update(Vector3d direction, vector<MeshModel>& objects, MaterialTable& materials)
+	{
+		vector<pair<OctNode*, int>> key;
+		key.clear();
+		for (int i = 0; i < objects.size(); i++)
+		{
+			key.push_back(make_pair(objects[i].root, objects[i].GetFaceNum()));
+		}
+		if (this->valid && direction == this->built_direction && key == this->geometry_key && 
+			this->resolution == this->built_resolution && materials.version == this->material_version)
+		{
+			return;
+		}
+
+		this->BuildLightSpace(direction, objects);
+		this->object_num = objects.size();
+		int total_size = this->resolution * this->resolution * this->object_num;
+		this->depths.assign(total_size, FLT_MAX);
+		this->transmittances.assign(total_size, 1);
+		for (int j = 0; j < this->resolution; j++)
+		{
+			for (int i = 0; i < this->resolution; i++)
+			{
+				Vector3d start = this->axis_u * (this->min_u + i * this->texel_size) + 
+					this->axis_v * (this->min_v + j * this->texel_size) + this->direction * this->min_depth;
+				Ray ray(start, this->direction, 1.0, TYPE_LOCAL, -1);
+				for (int k = 0; k < this->object_num; k++)
+				{
+					double t;
+					int mesh_id;
+					Vector3d fraction;
+					GetIntersectionRayMeshModel(ray, objects[k], mesh_id, t, fraction);
+					if (t > 0)
+					{
+						int place = (j * this->resolution + i) * this->object_num + k;
+						this->depths[place] = float(this->min_depth + t);
+						this->transmittances[place] = float(materials.materials[objects[k].GetFace(mesh_id).material_id].k_refraction);
+					}
+				}
+			}
+		}
+		this->geometry_key = key;
+		this->built_resolution = this->resolution;
+		this->built_direction = direction;
+		this->material_version = materials.version;
+		this->valid = 1;
+	}
+
+	/*
+	Get the transmittance of one texel
+	Args:
+		i [int]: [the u of the texel]
+		j [int]: [the v of the texel]
+		depth [double]: [the depth of the lighted point]
+		object_id [int]: [the object of the lighted point, not judged]
+	Returns:
+		transmittance [double]: [the light passing through the objects above the point]
+	*/
+	double GetTexelTransmittance(int i, int j, double depth, int object_id)
+	{
+		i = min(max(i, 0), this->resolution - 1);
+		j = min(max(j, 0), this->resolution - 1);
+		double transmittance = 1;
+		int place = (j * this->resolution + i) * this->object_num;
+		for (int k = 0; k < this->object_num; k++)
+		{
+			if (k != object_id && this->depths[place + k] < depth - this->bias)
+			{
+				transmittance *= this->transmittances[place + k];
+			}
+		}
+		return transmittance;
+	}
+
+	/*
+	Look up the filtered transmittance of a point, the texels around the point are weighted by a tent filter
+	Args:
+		point [Vector3d]: [the point to be lighted]
+		object_id [int]: [the object of the point, not judged]
+	Returns:
+		transmittance [double]: [the light passing through the objects above the point]
+	*/
+	double Lookup(Vector3d& point, int object_id)
+	{
+		double u = (point.dot(this->axis_u) - this->min_u) / this->texel_size;
+		double v = (point.dot(this->axis_v) - this->min_v) / this->texel_size;
+		double depth = point.dot(this->direction);
+		double radius = this->filter_radius + 1;
+		int min_i = int(floor(u - radius)) + 1;
+		int min_j = int(floor(v - radius)) + 1;
+		double transmittance = 0;
+		double weight_sum = 0;
+		for (int j = min_j; j < v + radius; j++)
+		{
+			for (int i = min_i; i < u + radius; i++)
+			{
+				double weight = (1 - fabs(i - u) / radius) * (1 - fabs(j - v) / radius);
+				if (weight <= 0)
+				{
+					continue;
+				}
+				transmittance += weight * this->GetTexelTransmittance(i, j, depth, object_id);
+				weight_sum += weight;
+			}
+		}
+		if (weight_sum <= 0)
+		{
+			return 1;
+		}
+		return transmittance / weight_sum;
+	}
+};
@@ -0,0 +1,276 @@
+//the textures decoded once into tiled mip chains and sampled at the hit points
+#pragma once
+#include "utils.hpp"
+using namespace std;
+using namespace Eigen;
+using namespace cv;
+#define TEXTURE_TILE_SIZE 4 //the texels are stored in 4 x 4 tiles, 64 bytes of RGBA8 in one tile
+#define FILTER_BILINEAR 0 //bilinear sampling on the finest level
+#define FILTER_TRILINEAR 1 //bilinear sampling on the two levels nearest to the footprint
+
+//one level of the mip chain, RGBA8 texels stored tile by tile
+class MipLevel
+{
+public:
+	int width = 0;
+	int height = 0;
+	int tiles_x = 0;
+	vector<unsigned int> texels;
+
+	MipLevel() {}
+
+	/*
+	Init an empty level
+	Args:
+		width [int]: [the width of the level]
+		height [int]: [the height of the level]
+	*/
+	MipLevel(int width, int height)
+	{
+		this->width = width;
+		this->height = height;
+		this->tiles_x = (width + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		int tiles_y = (height + TEXTURE_TILE_SIZE - 1) / TEXTURE_TILE_SIZE;
+		this->texels.resize(this->tiles_x * tiles_y * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE, 0);
+	}
+
+	/*
+	Get the place of a texel in the tiled storage
+	Args:
+		x [int]: [the column of the texel]
+		y [int]: [the row of the texel]
+	Returns:
+		place [int]: [the place in texels]
+	*/
+	int GetPlace(int x, int y)
+	{
+		int tile = (y / TEXTURE_TILE_SIZE) * this->tiles_x + x / TEXTURE_TILE_SIZE;
+		return tile * TEXTURE_TILE_SIZE * TEXTURE_TILE_SIZE + (y % TEXTURE_TILE_SIZE) * TEXTURE_TILE_SIZE + x % TEXTURE_TILE_SIZE;
+	}
+
+	/*
+	Get the color of a texel, the coordinates are clamped to the edge
+	Args:
+		x [int]: [the column of the texel]
+		y [int]: [the row of the texel]
+	Returns:
+		color [Vector3f]: [the RGB color, between [0, 1]]
+	*/
+	Vector3f Fetch(int x, int y)
+	{
+		x = min(max(x, 0), this->width - 1);
+		y = min(max(y, 0), this->height - 1);
+		unsigned int texel = this->texels[this->GetPlace(x, y)];
+		Vector3f color;
+		color << float(texel & 255), float((texel >> 8) & 255), float((texel >> 16) & 255);
+		return color / 255.0f;
+	}
+
+	/*
+	Set the color of a texel
+	Args:
+		x [int]: [the column of the texel]
+		y [int]: [the row of the texel]
+		color [Vector3f]: [the RGB color, between [0, 1]]
+	*/
+	void Store(int x, int y, Vector3f color)
+	{
+		unsigned int texel = 255u << 24;
+		for (int k = 0; k < 3; k++)
+		{
+			float value = min(max(color(k), 0.0f), 1.0f);
+			texel |= (unsigned int)(value * 255.0f + 0.5f) << (8 * k);
+		}
+		this->texels[this->GetPlace(x, y)] = texel;
+	}
+
+	/*
+	Bilinear sampling of the level, the texel centers are at half integers
+	Args:
+		u [double]: [the u of the texture coordinate, between [0, 1]]
+		v [double]: [the v of the texture coordinate, between [0, 1], 0 is the top row]
+	Returns:
+		color [Vector3f]: [the RGB color]
+	*/
+	Vector3f Sample(double u, double v)
+	{
+		double x = u * this->width - 0.5;
+		double y = v * this->height - 0.5;
+		int x_down = int(floor(x));
+		int y_down = int(floor(y));
+		float rate_x = float(x - x_down);
+		float rate_y = float(y - y_down);
+		Vector3f color_down = this->Fetch(x_down, y_down) * (1 - rate_x) + this->Fetch(x_down + 1, y_down) * rate_x;
+		Vector3f color_up = this->Fetch(x_down, y_down + 1) * (1 - rate_x) + this->Fetch(x_down + 1, y_down + 1) * rate_x;
+		return color_down * (1 - rate_y) + color_up * rate_y;
+	}
+};
+
+//a texture with its mip chain, the level 0 is the full picture
+class Texture
+{
+public:
+	vector<MipLevel> levels;
+
+	Texture() {}
+
+	/*
+	Build the mip chain of a decoded picture
+	Args:
+		image [Mat]: [the BGR picture]
+	*/
+	Texture(Mat& image)
+	{
+		MipLevel base(max(image.cols, 1), max(image.rows, 1));
+		for (int y = 0; y < image.rows; y++)
+		{
+			for (int x = 0; x < image.cols; x++)
+			{
+				Vec3b pixel = image.at<Vec3b>(y, x);
+				Vector3f color;
+				color << pixel[2] / 255.0f, pixel[1] / 255.0f, pixel[0] / 255.0f;
+				base.Store(x, y, color);
+			}
+		}
+		this->levels.push_back(base);
+
+		//each level averages 2 x 2 texels of the last level
+		while (this->levels.back().width > 1 || this->levels.back().height > 1)
+		{
+			MipLevel& last = this->levels.back();
+			MipLevel level(max(last.width / 2, 1), max(last.height / 2, 1));
+			for (int y = 0; y < level.height; y++)
+			{
+				for (int x = 0; x < level.width; x++)
+				{
+					Vector3f color = last.Fetch(x * 2, y * 2) + last.Fetch(x * 2 + 1, y * 2) +
+						last.Fetch(x * 2, y * 2 + 1) + last.Fetch(x * 2 + 1, y * 2 + 1);
+					level.Store(x, y, color / 4.0f);
+				}
+			}
+			this->levels.push_back(level);
+		}
+	}
+
+	/*
+	Sample the texture with a footprint
+	Args:
+		uv [Vector2f]: [the texture coordinate]
+		footprint [double]: [the width of the sampled area in texture coordinates]
+		filter [int]: [FILTER_BILINEAR or FILTER_TRILINEAR]
+	Returns:
+		color [Vector3f]: [the RGB color]
+	*/
+	Vector3f Sample(Vector2f uv, double footprint, int filter)
+	{
+		if (filter == FILTER_BILINEAR || footprint <= 0)
+		{
+			return this->levels[0].Sample(uv(0), uv(1));
+		}
+		double lod = log2(footprint * max(this->levels[0].width, this->levels[0].height));
+		int max_level = this->levels.size() - 1;
+		if (lod <= 0)
+		{
+			return this->levels[0].Sample(uv(0), uv(1));
+		}
+		if (lod >= max_level)
+		{
+			return this->levels[max_level].Sample(uv(0), uv(1));
+		}
+		int level = int(lod);
+		float rate = float(lod - level);
+		return this->levels[level].Sample(uv(0), uv(1)) * (1 - rate) + this->levels[level + 1].Sample(uv(0), uv(1)) * rate;
+	}
+};
+
+//all the textures of the scene, each file is decoded only once
+class TextureCache
+{
+public:
+	vector<Texture> textures;
+	map<string, int> texture_ids;
+	int filter = FILTER_TRILINEAR;
+
+	TextureCache() {}
+
+	/*
+	Get the id of a texture file, decode it and build its mip chain if not loaded
+	Args:
+		filename [string]: [the full filename of the texture file]
+	Returns:
+		texture_id [int]: [the id of the texture]
+	*/
+	int Load(string filename)
+	{
+		auto it = this->texture_ids.find(filename);
+		if (it != this->texture_ids.end())
+		{
+			return it->second;
+		}
+		TRACE_SPAN("LoadTexture", "load", filename);
+		Mat image = imread(filename);
+		this->textures.push_back(Texture(image));
+		int texture_id = this->textures.size() - 1;
+		this->texture_ids[filename] = texture_id;
+		return texture_id;
+	}
+
+	/*
+	Move the textures of another cache into this cache, the files loaded by both are kept once
+	Args:
+		other [TextureCache]: [the other cache, emptied after merging]
+	Returns:
+		texture_ids [vector<int>]: [the new id of each texture of the other cache]
+	*/
+	vector<int> Merge(TextureCache& other)
+	{
+		vector<int> texture_ids(other.textures.size(), -1);
+		for (auto it : other.texture_ids)
+		{
+			auto found = this->texture_ids.find(it.first);
+			if (found != this->texture_ids.end())
+			{
+				texture_ids[it.second] = found->second;
+				continue;
+			}
+			this->textures.push_back(move(other.textures[it.second]));
+			texture_ids[it.second] = this->textures.size() - 1;
+			this->texture_ids[it.first] = this->textures.size() - 1;
+		}
+		other.textures.clear();
+		other.texture_ids.clear();
+		return texture_ids;
+	}
+
+	/*
+	Sample a texture
+	Args:
+		texture_id [int]: [the id of the texture]
+		uv [Vector2f]: [the texture coordinate]
+		footprint [double]: [the width of the sampled area in texture coordinates]
+	Returns:
+		color [Vector3f]: [the RGB color]
+	*/
+	Vector3f Sample(int texture_id, Vector2f uv, double footprint)
+	{
+		return this->textures[texture_id].Sample(uv, footprint, this->filter);
+	}
+
+	/*
+	Get the bytes of the mip chains of all the textures
+	Returns:
+		bytes [size_t]: [the bytes of the texels]
+	*/
+	size_t GetBytes()
+	{
+		size_t bytes = 0;
+		for (int i = 0; i < this->textures.size(); i++)
+		{
+			for (int k = 0; k < this->textures[i].levels.size(); k++)
+			{
+				bytes += this->textures[i].levels[k].texels.capacity() * sizeof(unsigned int);
+			}
+		}
+		return bytes;
+	}
+};
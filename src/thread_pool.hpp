@@ -0,0 +1,108 @@
+//a fixed size thread pool running the submitted tasks in the order of submission
+#pragma once
+#include "utils.hpp"
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <queue>
+using namespace std;
+
+class ThreadPool
+{
+public:
+	vector<thread> workers;
+	queue<function<void()>> tasks;
+	mutex lock;
+	condition_variable task_ready; //notified when a task is submitted or the pool stops
+	condition_variable task_done; //notified when a task finishes
+	int running = 0; //the number of tasks being run
+	bool stopping = 0;
+
+	/*
+	Start the worker threads, each worker may run its share of the hardware threads in its tasks
+	Args:
+		thread_num [int]: [the number of workers, the number of hardware threads if not positive]
+	*/
+	ThreadPool(int thread_num = 0)
+	{
+		if (thread_num <= 0)
+		{
+			thread_num = max(1, int(thread::hardware_concurrency()));
+		}
+		int budget = max(1, int(thread::hardware_concurrency()) / thread_num);
+		for (int i = 0; i < thread_num; i++)
+		{
+			this->workers.push_back(thread(&ThreadPool::Work, this, budget));
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	~ThreadPool()
+	{
+		{
+			unique_lock<mutex> guard(this->lock);
+			this->stopping = 1;
+		}
+		this->task_ready.notify_all();
+		for (int i = 0; i < this->workers.size(); i++)
+		{
+			this->workers[i].join();
+		}
+	}
+
+	/*
+	Submit a task to the pool
+	Args:
+		task [function<void()>]: [the task]
+	*/
+	void Submit(function<void()> task)
+	{
+		{
+			unique_lock<mutex> guard(this->lock);
+			this->tasks.push(task);
+		}
+		this->task_ready.notify_one();
+	}
+
+	/*
+	Wait until all the submitted tasks finish
+	*/
+	void Wait()
+	{
+		unique_lock<mutex> guard(this->lock);
+		this->task_done.wait(guard, [this] { return this->tasks.empty() && this->running == 0; });
+	}
+
+	/*
+	The loop of a worker, take the tasks until the pool stops
+	Args:
+		budget [int]: [the threads a task of the worker may run at once]
+	*/
+	void Work(int budget)
+	{
+		task_thread_budget = budget;
+		while (1)
+		{
+			function<void()> task;
+			{
+				unique_lock<mutex> guard(this->lock);
+				this->task_ready.wait(guard, [this] { return this->stopping || !this->tasks.empty(); });
+				if (this->tasks.empty())
+				{
+					return;
+				}
+				task = this->tasks.front();
+				this->tasks.pop();
+				this->running++;
+			}
+			task();
+			{
+				unique_lock<mutex> guard(this->lock);
+				this->running--;
+			}
+			this->task_done.notify_all();
+		}
+	}
+};
@@ -0,0 +1,232 @@
+//the timing spans of the phases of a run, each thread records into its own buffer and the spans are written as a Chrome trace,
+//which chrome://tracing and Perfetto open, only the standard library is used so every header can record spans
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdio>
+#include <algorithm>
+using namespace std;
+#define TRACE_SPAN_NAME_JOIN(a, b) a##b
+#define TRACE_SPAN_NAME(line) TRACE_SPAN_NAME_JOIN(trace_span_, line)
+//record a span from here to the end of the scope
+#define TRACE_SPAN(...) TraceSpan TRACE_SPAN_NAME(__LINE__)(__VA_ARGS__)
+
+//a finished span, the name and the category are string literals
+class TraceEvent
+{
+public:
+	const char* name;
+	const char* category;
+	long long start; //in microseconds since the trace started
+	long long duration; //in microseconds
+	string detail; //shown in the arguments of the span, empty if nothing
+};
+
+//the spans of one thread, only the thread appends to it
+class TraceBuffer
+{
+public:
+	int thread_id = 0;
+	vector<TraceEvent> events;
+};
+
+//all the buffers, a thread registers its buffer at its first span, the buffers of the ended threads are kept
+class TraceRegistry
+{
+public:
+	atomic<bool> enabled = 0;
+	chrono::steady_clock::time_point start_time = chrono::steady_clock::now();
+	mutex lock;
+	vector<TraceBuffer*> threads;
+	vector<TraceBuffer> retired;
+	int thread_num = 0;
+};
+TraceRegistry trace_registry;
+
+//the buffer of the calling thread
+class ThreadTraceBuffer
+{
+public:
+	TraceBuffer buffer;
+
+	ThreadTraceBuffer()
+	{
+		lock_guard<mutex> guard(trace_registry.lock);
+		this->buffer.thread_id = trace_registry.thread_num++;
+		trace_registry.threads.push_back(&this->buffer);
+	}
+
+	~ThreadTraceBuffer()
+	{
+		lock_guard<mutex> guard(trace_registry.lock);
+		vector<TraceBuffer*>& threads = trace_registry.threads;
+		threads.erase(find(threads.begin(), threads.end(), &this->buffer));
+		if (this->buffer.events.size() > 0)
+		{
+			trace_registry.retired.push_back(move(this->buffer));
+		}
+	}
+};
+thread_local ThreadTraceBuffer thread_trace_buffer;
+
+/*
+Get the time since the trace started
+Returns:
+	time [long long]: [microseconds]
+*/
+inline long long GetTraceTime()
+{
+	return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - trace_registry.start_time).count();
+}
+
+//a span from its construction to its destruction, nothing is recorded while tracing is off
+class TraceSpan
+{
+public:
+	const char* name;
+	const char* category;
+	long long start = -1; //-1 if tracing was off at the start
+	string detail;
+
+	TraceSpan(const char* name, const char* category)
+	{
+		this->name = name;
+		this->category = category;
+		if (trace_registry.enabled.load(memory_order_relaxed))
+		{
+			this->start = GetTraceTime();
+		}
+	}
+
+	TraceSpan(const char* name, const char* category, string detail) : TraceSpan(name, category)
+	{
+		if (this->start >= 0)
+		{
+			this->detail = detail;
+		}
+	}
+
+	TraceSpan(const char* name, const char* category, int x, int y) : TraceSpan(name, category)
+	{
+		if (this->start >= 0)
+		{
+			this->detail = to_string(x) + " " + to_string(y);
+		}
+	}
+
+	TraceSpan(const TraceSpan&) = delete;
+	TraceSpan& operator=(const TraceSpan&) = delete;
+
+	~TraceSpan()
+	{
+		if (this->start < 0)
+		{
+			return;
+		}
+		TraceEvent event;
+		event.name = this->name;
+		event.category = this->category;
+		event.start = this->start;
+		event.duration = GetTraceTime() - this->start;
+		event.detail = move(this->detail);
+		thread_trace_buffer.buffer.events.push_back(move(event));
+	}
+};
+
+/*
+Start recording the spans, the spans recorded before are dropped
+*/
+void StartTrace()
+{
+	lock_guard<mutex> guard(trace_registry.lock);
+	for (int i = 0; i < trace_registry.threads.size(); i++)
+	{
+		trace_registry.threads[i]->events.clear();
+	}
+	trace_registry.retired.clear();
+	trace_registry.start_time = chrono::steady_clock::now();
+	trace_registry.enabled = 1;
+}
+
+/*
+Escape a string for JSON
+Args:
+	text [string]: [the text]
+Returns:
+	escaped [string]: [the text with the quotes, the backslashes and the control characters escaped]
+*/
+string EscapeJson(string text)
+{
+	string escaped;
+	for (int i = 0; i < text.size(); i++)
+	{
+		char c = text[i];
+		if (c == '"' || c == '\\')
+		{
+			escaped += '\\';
+			escaped += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", c);
+			escaped += code;
+		}
+		else
+		{
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+/*
+Stop recording and write all the spans as a Chrome trace, called while no thread is inside a span
+Args:
+	filename [string]: [the full filename of the trace, .json]
+Returns:
+	result [bool]: [whether the trace is written or not]
+*/
+bool WriteTrace(string filename)
+{
+	trace_registry.enabled = 0;
+	ofstream trace_file;
+	trace_file.open(filename, ios::out);
+	if (!trace_file.is_open())
+	{
+		return 0;
+	}
+	lock_guard<mutex> guard(trace_registry.lock);
+	vector<TraceBuffer*> buffers;
+	for (int i = 0; i < trace_registry.retired.size(); i++)
+	{
+		buffers.push_back(&trace_registry.retired[i]);
+	}
+	buffers.insert(buffers.end(), trace_registry.threads.begin(), trace_registry.threads.end());
+
+	trace_file << "{\"traceEvents\": [" << endl;
+	bool first = 1;
+	for (int i = 0; i < buffers.size(); i++)
+	{
+		for (int k = 0; k < buffers[i]->events.size(); k++)
+		{
+			TraceEvent& event = buffers[i]->events[k];
+			trace_file << (first ? "" : ",\n") << "{\"name\": \"" << event.name << "\", \"cat\": \"" << event.category
+				<< "\", \"ph\": \"X\", \"ts\": " << event.start << ", \"dur\": " << event.duration << ", \"pid\": 1, \"tid\": "
+				<< buffers[i]->thread_id;
+			if (event.detail.size() > 0)
+			{
+				trace_file << ", \"args\": {\"detail\": \"" << EscapeJson(event.detail) << "\"}";
+			}
+			trace_file << "}";
+			first = 0;
+		}
+	}
+	trace_file << endl << "], \"displayTimeUnit\": \"ms\"}" << endl;
+	trace_file.close();
+	return 1;
+}
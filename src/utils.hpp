@@ -2,16 +2,38 @@
 #pragma once
 #include <string>
 #include <map>
+#include <list>
+#include <unordered_map>
 #include <cstdlib>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <vector>
+#include <algorithm>
 #include <numbers>
 #include <assert.h>
 #include <Eigen\Dense>
 #include <opencv2/core/core.hpp> 
 #include <opencv2/highgui/highgui.hpp>  
 #include <time.h>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "tracing.hpp"
 using namespace std;
 using namespace Eigen;
 using namespace cv;
@@ -37,86 +59,439 @@ int StringToInt(string str)
 }
 
 /*
-Use opencv to save the result picture
+Get a deterministic pseudo random number from integer keys, used in jittering the samples
 Args:
-	data [array of Vector3d], [H * W]: [the result data]
-	save_place [const char*]: [the full saving place]
-	width [int]: [the width of the picture]
-	height [int]: [the height of the picture]
+	a [int]: [the first key]
+	b [int]: [the second key]
+	c [int]: [the third key]
+Returns:
+	result [double]: [the random number, between[0, 1)]
 */
-void SavePicture(Vector3d* data, string save_place, int width, int height)
+double HashRandom(int a, int b, int c)
+{
+	unsigned int h = unsigned(a) * 73856093u ^ unsigned(b) * 19349663u ^ unsigned(c) * 83492791u;
+	h ^= h >> 16;
+	h *= 0x7feb352du;
+	h ^= h >> 15;
+	h *= 0x846ca68bu;
+	h ^= h >> 16;
+	return double(h) / 4294967296.0;
+}
+
+//the threads a task may run at once, set on the workers of a thread pool so the pools share the hardware threads
+thread_local int task_thread_budget = 0;
+
+/*
+Get the threads the current task may run at once, all the hardware threads outside the thread pools
+Returns:
+	thread_num [int]: [the number of threads, at least 1]
+*/
+int GetTaskThreads()
+{
+	return task_thread_budget > 0 ? task_thread_budget : max(1, int(thread::hardware_concurrency()));
+}
+
+/*
+Open a file with the c library, through fopen_s on windows where fopen is deprecated
+Args:
+	filename [string]: [the full filename]
+	mode [char*]: [the mode of fopen]
+Returns:
+	file [FILE*]: [the opened file, NULL if it cannot be opened]
+*/
+FILE* OpenFile(string filename, const char* mode)
+{
+#ifdef _WIN32
+	FILE* file = NULL;
+	return fopen_s(&file, filename.c_str(), mode) == 0 ? file : NULL;
+#else
+	return fopen(filename.c_str(), mode);
+#endif
+}
+
+/*
+Make a folder and the folders above it that do not exist
+Args:
+	directory [string]: [the folder, "/" or "\\" separated]
+Returns:
+	result [bool]: [whether the folder exists at the end or not]
+*/
+bool MakeDirectory(string directory)
+{
+	for (size_t end = 0; end != string::npos;)
+	{
+		end = directory.find_first_of("/\\", end + 1);
+		string part = directory.substr(0, end);
+		if (part.size() == 0 || part.back() == ':')
+		{
+			continue;
+		}
+#ifdef _WIN32
+		_mkdir(part.c_str());
+#else
+		mkdir(part.c_str(), 0755);
+#endif
+	}
+#ifdef _WIN32
+	DWORD attributes = GetFileAttributesA(directory.c_str());
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+#else
+	struct stat status;
+	return stat(directory.c_str(), &status) == 0 && S_ISDIR(status.st_mode);
+#endif
+}
+
+/*
+Move to a place of a file, the places beyond 2 GB are supported
+Args:
+	file [FILE*]: [the opened file]
+	offset [long long]: [the offset from the start of the file]
+Returns:
+	result [bool]: [whether the place is reached or not]
+*/
+bool SeekFile(FILE* file, long long offset)
+{
+#ifdef _WIN32
+	return _fseeki64(file, offset, SEEK_SET) == 0;
+#else
+	return fseeko(file, off_t(offset), SEEK_SET) == 0;
+#endif
+}
+
+//a read only file mapped into memory, the loaders parse the mapped bytes directly
+class MappedFile
+{
+public:
+	const char* data = NULL;
+	size_t size = 0;
+#ifdef _WIN32
+	HANDLE file = INVALID_HANDLE_VALUE;
+	HANDLE mapping = NULL;
+#endif
+
+	MappedFile() {}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile()
+	{
+		this->Close();
+	}
+
+	/*
+	Map a file into memory
+	Args:
+		filename [string]: [the full filename]
+	Returns:
+		result [bool]: [whether the file is mapped or not]
+	*/
+	bool Open(string filename)
+	{
+		this->Close();
+#ifdef _WIN32
+		this->file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (this->file == INVALID_HANDLE_VALUE)
+		{
+			return 0;
+		}
+		LARGE_INTEGER file_size;
+		if (!GetFileSizeEx(this->file, &file_size) || file_size.QuadPart == 0)
+		{
+			this->Close();
+			return 0;
+		}
+		this->mapping = CreateFileMappingA(this->file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (this->mapping == NULL)
+		{
+			this->Close();
+			return 0;
+		}
+		this->data = (const char*)MapViewOfFile(this->mapping, FILE_MAP_READ, 0, 0, 0);
+		if (this->data == NULL)
+		{
+			this->Close();
+			return 0;
+		}
+		this->size = size_t(file_size.QuadPart);
+#else
+		int file = open(filename.c_str(), O_RDONLY);
+		if (file < 0)
+		{
+			return 0;
+		}
+		struct stat file_stat;
+		if (fstat(file, &file_stat) != 0 || file_stat.st_size == 0)
+		{
+			close(file);
+			return 0;
+		}
+		void* address = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+		close(file);
+		if (address == MAP_FAILED)
+		{
+			return 0;
+		}
+		madvise(address, file_stat.st_size, MADV_SEQUENTIAL);
+		this->data = (const char*)address;
+		this->size = size_t(file_stat.st_size);
+#endif
+		return 1;
+	}
+
+	/*
+	Unmap the file
+	*/
+	void Close()
+	{
+#ifdef _WIN32
+		if (this->data != NULL)
+		{
+			UnmapViewOfFile(this->data);
+		}
+		if (this->mapping != NULL)
+		{
+			CloseHandle(this->mapping);
+		}
+		if (this->file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle(this->file);
+		}
+		this->mapping = NULL;
+		this->file = INVALID_HANDLE_VALUE;
+#else
+		if (this->data != NULL)
+		{
+			munmap((void*)this->data, this->size);
+		}
+#endif
+		this->data = NULL;
+		this->size = 0;
+	}
+};
+
+/*
+Read the next number of a text buffer, the spaces and line breaks before it are skipped
+Args:
+	p [const char*&]: [the current place, moved after the number]
+	end [const char*]: [the end of the buffer]
+	value [double&]: [the result number]
+Returns:
+	result [bool]: [whether a number is read or not]
+*/
+bool ReadNumber(const char*& p, const char* end, double& value)
 {
-	Mat image = Mat::zeros(Size(width, height), CV_8UC3);
-	for (int j = 0; j < height; j++)
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
 	{
-		for (int i = 0; i < width; i++)
+		p++;
+	}
+	if (p < end && *p == '+')
+	{
+		p++;
+	}
+	from_chars_result result = from_chars(p, end, value);
+	if (result.ec != errc())
+	{
+		return 0;
+	}
+	p = result.ptr;
+	return 1;
+}
+
+#define PIXEL_RGB8 0 //packed 8 bit pixels in the order of the channels
+#define PIXEL_BGR8 1
+#define PIXEL_RGBA8 2 //the alpha is always 255
+#define PIXEL_BGRA8 3
+#define QUANTIZE_BLOCK 256 //the pixels quantized together before packing
+
+/*
+Clamp and quantize a picture to packed 8 bit pixels, a block of channels is quantized at once by eigen,
+the channels of [0, 1) are mapped to [0, 255] by truncation
+Args:
+	data [array of Matrix<Scalar, 3, 1>], [count]: [the RGB colors, float or double]
+	count [int]: [the number of pixels]
+	target [unsigned char*], [count * 3 or count * 4]: [the packed pixels]
+	format [int]: [PIXEL_RGB8, PIXEL_BGR8, PIXEL_RGBA8 or PIXEL_BGRA8]
+*/
+template <typename Scalar>
+void QuantizePicture(const Matrix<Scalar, 3, 1>* data, int count, unsigned char* target, int format)
+{
+	int channels = format == PIXEL_RGBA8 || format == PIXEL_BGRA8 ? 4 : 3;
+	int first = format == PIXEL_BGR8 || format == PIXEL_BGRA8 ? 2 : 0;
+	unsigned char block[QUANTIZE_BLOCK * 3];
+	for (int start = 0; start < count; start += QUANTIZE_BLOCK)
+	{
+		int block_size = min(QUANTIZE_BLOCK, count - start);
+		Map<const Matrix<Scalar, Dynamic, 1>> values(data[start].data(), block_size * 3);
+		Map<Matrix<unsigned char, Dynamic, 1>> bytes(block, block_size * 3);
+		bytes = (values * Scalar(256)).cwiseMax(Scalar(0)).cwiseMin(Scalar(255)).template cast<unsigned char>();
+		unsigned char* pixel = target + size_t(start) * channels;
+		for (int i = 0; i < block_size; i++, pixel += channels)
 		{
-			for (int k = 0; k < 3; k++)
+			pixel[0] = block[i * 3 + first];
+			pixel[1] = block[i * 3 + 1];
+			pixel[2] = block[i * 3 + 2 - first];
+			if (channels == 4)
 			{
-				int color = int(data[j * width + i](k) * 256);
-				if (color >= 256)
-				{
-					color = 255;
-				}
-				else if (color < 0)
-				{
-					color = 0;
-				}
-				uchar ucolor = uchar(color);
-				image.at<Vec3b>(i, j)[2 - k] = ucolor;
+				pixel[3] = 255;
 			}
 		}
 	}
-	imwrite(save_place, image);
 }
 
 /*
-Use the Win32 API to show the picture
+Judge whether a picture file keeps the colors as floats, the colors are not clamped in such files
+Args:
+	filename [string]: [the filename]
+Returns:
+	result [bool]: [whether the file is .exr or .hdr or not]
+*/
+bool JudgeHDRFile(string filename)
+{
+	string extension = filename.substr(filename.find_last_of('.') + 1);
+	for (int i = 0; i < extension.size(); i++)
+	{
+		extension[i] = char(tolower(extension[i]));
+	}
+	return extension == "exr" || extension == "hdr";
+}
+
+/*
+Convert the result picture to an opencv picture
 Args:
 	data [array of Vector3d], [H * W]: [the result data]
 	width [int]: [the width of the picture]
 	height [int]: [the height of the picture]
-	hdc [HDC]: [the HWND used in painting]
+	hdr [bool]: [whether to keep the colors as floats or quantize them to 8 bits]
+Returns:
+	image [Mat]: [the BGR picture, CV_32FC3 or CV_8UC3]
 */
-void ShowPicture(Vector3d* data, int width, int height, HDC& hdc)
+Mat ConvertPicture(Vector3d* data, int width, int height, bool hdr)
 {
-	for (int j = 0; j < height; j++)
+	if (hdr == 0)
 	{
-		for (int i = 0; i < width; i++)
-		{
-			Vector3d color = data[j * width + i];
-			int r = int(color(0) * 256);
-			if (r > 255)
-			{
-				r = 255;
-			}
-			if (r < 0)
-			{
-				r = 0;
-			}
+		Mat image(height, width, CV_8UC3);
+		QuantizePicture(data, width * height, image.data, PIXEL_BGR8);
+		return image;
+	}
+	Mat image(height, width, CV_32FC3);
+	float* pixel = (float*)image.data;
+	for (int i = 0; i < width * height; i++, pixel += 3)
+	{
+		pixel[0] = float(data[i](2));
+		pixel[1] = float(data[i](1));
+		pixel[2] = float(data[i](0));
+	}
+	return image;
+}
 
-			int g = int(color(1) * 256);
-			if (g > 255)
-			{
-				g = 255;
-			}
-			if (g < 0)
-			{
-				g = 0;
-			}
+/*
+Use opencv to save the result picture
+Args:
+	data [array of Vector3d], [H * W]: [the result data]
+	save_place [const char*]: [the full saving place, the format is chosen by the extension]
+	width [int]: [the width of the picture]
+	height [int]: [the height of the picture]
+*/
+void SavePicture(Vector3d* data, string save_place, int width, int height)
+{
+	TRACE_SPAN("SavePicture", "output", save_place);
+	imwrite(save_place, ConvertPicture(data, width, height, JudgeHDRFile(save_place)));
+}
 
-			int b = int(color(2) * 256);
-			if (b > 255)
+/*
+Resize a picture with bilinear interpolation, used in upscaling the picture rendered at a lower resolution
+Args:
+	source [array of Vector3d], [H * W]: [the source data]
+	source_width [int]: [the width of the source picture]
+	source_height [int]: [the height of the source picture]
+	target [array of Vector3d], [H * W]: [the target data]
+	target_width [int]: [the width of the target picture]
+	target_height [int]: [the height of the target picture]
+*/
+void ResizePicture(Vector3d* source, int source_width, int source_height, Vector3d* target, int target_width, int target_height)
+{
+	double scale_x = double(source_width) / double(target_width);
+	double scale_y = double(source_height) / double(target_height);
+	for (int j = 0; j < target_height; j++)
+	{
+		//map the pixel center of the target to the source
+		double y = (j + 0.5) * scale_y - 0.5;
+		if (y < 0)
+		{
+			y = 0;
+		}
+		int y_down = int(y);
+		int y_up = y_down + 1;
+		if (y_up >= source_height)
+		{
+			y_up = source_height - 1;
+		}
+		double rate_y = y - y_down;
+		for (int i = 0; i < target_width; i++)
+		{
+			double x = (i + 0.5) * scale_x - 0.5;
+			if (x < 0)
 			{
-				b = 255;
+				x = 0;
 			}
-			if (b < 0)
+			int x_down = int(x);
+			int x_up = x_down + 1;
+			if (x_up >= source_width)
 			{
-				b = 0;
+				x_up = source_width - 1;
 			}
+			double rate_x = x - x_down;
+			Vector3d color_down = source[y_down * source_width + x_down] * (1 - rate_x) + source[y_down * source_width + x_up] * rate_x;
+			Vector3d color_up = source[y_up * source_width + x_down] * (1 - rate_x) + source[y_up * source_width + x_up] * rate_x;
+			target[j * target_width + i] = color_down * (1 - rate_y) + color_up * rate_y;
+		}
+	}
+}
 
-			COLORREF rgb = RGB(r, g, b);
-			SetPixel(hdc, i, j, rgb);
+/*
+Map values to false colors, from black through blue, green, yellow and red to white at the scale,
+the values beyond the scale are white
+Args:
+	values [array of double], [count]: [the values, not negative]
+	count [int]: [the number of values]
+	scale [double]: [the value mapped to white, nothing is mapped if not positive]
+	target [array of Vector3d], [count]: [the colors]
+*/
+void FalseColorPicture(double* values, int count, double scale, Vector3d* target)
+{
+	const int key_num = 6;
+	double keys[key_num][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 }, { 1, 1, 1 } };
+	for (int k = 0; k < count; k++)
+	{
+		double place = scale > 0 ? min(max(values[k] / scale, 0.0), 1.0) * (key_num - 1) : 0;
+		int key = min(int(place), key_num - 2);
+		double rate = place - key;
+		for (int c = 0; c < 3; c++)
+		{
+			target[k](c) = keys[key][c] * (1 - rate) + keys[key + 1][c] * rate;
 		}
 	}
+}
+
+/*
+Use the Win32 API to show the picture, the picture is packed and drawn at once
+Args:
+	data [array of Vector3d], [H * W]: [the result data]
+	width [int]: [the width of the picture]
+	height [int]: [the height of the picture]
+	hdc [HDC]: [the HWND used in painting]
+*/
+void ShowPicture(Vector3d* data, int width, int height, HDC& hdc)
+{
+	vector<unsigned char> pixels(size_t(width) * height * 4);
+	QuantizePicture(data, width * height, pixels.data(), PIXEL_BGRA8);
+	BITMAPINFO info;
+	memset(&info, 0, sizeof(info));
+	info.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	info.bmiHeader.biWidth = width;
+	info.bmiHeader.biHeight = -height; //the rows are top down
+	info.bmiHeader.biPlanes = 1;
+	info.bmiHeader.biBitCount = 32;
+	info.bmiHeader.biCompression = BI_RGB;
+	SetDIBitsToDevice(hdc, 0, 0, width, height, 0, 0, 0, height, pixels.data(), &info, DIB_RGB_COLORS);
 }
\ No newline at end of file
@@ -0,0 +1,173 @@
+/*
+The reference viewer of the shared memory ring, it prints each published slot and dumps the frames as .ppm pictures,
+it only needs the standard library and src/frame_ring.hpp, for example
+	g++ -std=c++17 -O2 -I src tools/frame_dump.cpp -o frame_dump -lrt
+	cl /std:c++17 /O2 /EHsc /I src tools\frame_dump.cpp
+run the renderer with --sink [name] [frames | tiles] and then
+	frame_dump [name] [frames to dump] [prefix of the pictures]
+*/
+#include "frame_ring.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <thread>
+using namespace std;
+#define DUMP_WAIT_SECONDS 10 //give up if nothing is published for this long
+
+/*
+Copy a published slot out of the ring, the pixels are read in place and the copy is kept only if the slot was not rewritten
+Args:
+	memory [unsigned char*]: [the mapped ring]
+	header [FrameRingHeader*]: [the header of the ring]
+	sequence [unsigned long long]: [the sequence to read]
+	slot_copy [FrameSlotHeader]: [the copied fields of the slot]
+	pixels [vector<unsigned char>]: [the copied BGRA8 pixels]
+Returns:
+	result [bool]: [whether the slot still holds the sequence or not]
+*/
+bool ReadSlot(unsigned char* memory, FrameRingHeader* header, unsigned long long sequence, FrameSlotHeader& slot_copy,
+	vector<unsigned char>& pixels)
+{
+	FrameSlotHeader* slot = GetFrameSlot(memory, header->slot_bytes, sequence % header->slot_num);
+	unsigned long long begin = slot->sequence.load(memory_order_acquire);
+	if (begin != sequence * 2)
+	{
+		return 0;
+	}
+	slot_copy.kind = slot->kind;
+	slot_copy.width = slot->width;
+	slot_copy.height = slot->height;
+	slot_copy.x = slot->x;
+	slot_copy.y = slot->y;
+	slot_copy.frame_width = slot->frame_width;
+	slot_copy.frame_height = slot->frame_height;
+	slot_copy.bytes = min(slot->bytes, header->slot_bytes);
+	slot_copy.frame_id = slot->frame_id;
+	slot_copy.render_time = slot->render_time;
+	slot_copy.timestamp = slot->timestamp;
+	pixels.assign(GetFrameSlotPixels(slot), GetFrameSlotPixels(slot) + slot_copy.bytes);
+	atomic_thread_fence(memory_order_acquire);
+	return slot->sequence.load(memory_order_relaxed) == begin;
+}
+
+/*
+Write BGRA8 pixels as a binary .ppm picture
+Args:
+	filename [string]: [the full saving place]
+	pixels [vector<unsigned char>]: [the BGRA8 pixels]
+	width [int]: [the width of the picture]
+	height [int]: [the height of the picture]
+Returns:
+	result [bool]: [whether the picture is written or not]
+*/
+bool WritePPM(string filename, vector<unsigned char>& pixels, int width, int height)
+{
+	FILE* file = fopen(filename.c_str(), "wb");
+	if (file == NULL)
+	{
+		return 0;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	vector<unsigned char> row(width * 3);
+	for (int j = 0; j < height; j++)
+	{
+		for (int i = 0; i < width; i++)
+		{
+			unsigned char* pixel = &pixels[(size_t(j) * width + i) * 4];
+			row[i * 3] = pixel[2];
+			row[i * 3 + 1] = pixel[1];
+			row[i * 3 + 2] = pixel[0];
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	return fclose(file) == 0;
+}
+
+int main(int argc, char** argv)
+{
+	string name = argc > 1 ? argv[1] : "rendering_frames";
+	int frame_num = argc > 2 ? atoi(argv[2]) : 1;
+	string prefix = argc > 3 ? argv[3] : "frame";
+
+	//wait for the renderer to create the ring
+	SharedMemory shared;
+	auto wait_start = chrono::steady_clock::now();
+	FrameRingHeader* header = NULL;
+	while (header == NULL)
+	{
+		if (shared.Open(name, 0) && shared.bytes >= sizeof(FrameRingHeader))
+		{
+			header = (FrameRingHeader*)shared.memory;
+			if (header->magic != FRAME_RING_MAGIC || header->version != FRAME_RING_VERSION)
+			{
+				header = NULL;
+				shared.Close();
+			}
+		}
+		if (header == NULL)
+		{
+			if (chrono::steady_clock::now() - wait_start > chrono::seconds(DUMP_WAIT_SECONDS))
+			{
+				printf("no ring named %s\n", name.c_str());
+				return 1;
+			}
+			this_thread::sleep_for(chrono::milliseconds(10));
+		}
+	}
+	atomic_thread_fence(memory_order_acquire);
+	printf("ring %s: %u slots of %u bytes, up to %ux%u\n", name.c_str(), header->slot_num, header->slot_bytes,
+		header->max_width, header->max_height);
+
+	//follow the write sequence, the slots overwritten before they are read are counted as skipped
+	unsigned long long next = header->write_sequence.load(memory_order_acquire) + 1;
+	int frames = 0;
+	long long tiles = 0;
+	long long skipped = 0;
+	FrameSlotHeader slot;
+	vector<unsigned char> pixels;
+	auto last_time = chrono::steady_clock::now();
+	while (frames < frame_num)
+	{
+		unsigned long long last = header->write_sequence.load(memory_order_acquire);
+		if (last < next)
+		{
+			if (chrono::steady_clock::now() - last_time > chrono::seconds(DUMP_WAIT_SECONDS))
+			{
+				break;
+			}
+			this_thread::sleep_for(chrono::milliseconds(1));
+			continue;
+		}
+		last_time = chrono::steady_clock::now();
+		if (last - next >= header->slot_num)
+		{
+			skipped += last - next - header->slot_num + 1;
+			next = last - header->slot_num + 1;
+		}
+		for (; next <= last; next++)
+		{
+			if (!ReadSlot(shared.memory, header, next, slot, pixels))
+			{
+				skipped++;
+				continue;
+			}
+			double latency = (GetFrameRingClock() - slot.timestamp) / 1e6;
+			if (slot.kind == FRAME_KIND_TILE)
+			{
+				tiles++;
+				continue;
+			}
+			string filename = prefix + "_" + to_string(slot.frame_id) + ".ppm";
+			bool result = WritePPM(filename, pixels, slot.width, slot.height);
+			printf("frame %llu, sequence %llu: %ux%u, render %.3f s, latency %.3f ms, %s %s\n", slot.frame_id, next,
+				slot.width, slot.height, slot.render_time, latency, result ? "saved" : "failed to save", filename.c_str());
+			frames++;
+			if (frames >= frame_num)
+			{
+				break;
+			}
+		}
+	}
+	printf("%d frames, %lld tiles, %lld skipped\n", frames, tiles, skipped);
+	return frames > 0 ? 0 : 1;
+}